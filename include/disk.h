@@ -13,6 +13,7 @@
 #define MB  (1048576ULL)
 #define KB  (1024ULL)
 #define MAX(a,b)    ((a) > (b) ? (a) : (b))
+#define MIN(a,b)    ((a) < (b) ? (a) : (b))
 
 
 #define MAX_DISKS           32
@@ -31,6 +32,8 @@ typedef enum {
 } disk_err_t;
 
 
+struct disk_info_t;
+
 typedef struct {
     bool     active;
     uint8_t  type;
@@ -40,10 +43,18 @@ typedef struct {
     uint8_t* data;
     /* We will write at most 64KB*3, 32-bit is more than enough*/
     uint32_t data_len;
+    /* When not NULL, the partition content will be cloned from the given disk's partition */
+    const struct disk_info_t* clone_src;
+    int      clone_src_part;
+    /* Location of the source partition when the clone was staged, the source disk may change meanwhile */
+    uint32_t clone_src_lba;
+    uint32_t clone_src_sectors;
+    /* Set when `clone_src` describes an image file allocated for this partition only, freed with it */
+    bool     clone_src_owned;
 } partition_t;
 
 
-typedef struct {
+typedef struct disk_info_t {
     char        name[256];
     char        path[256];
     uint64_t    size_bytes;
@@ -57,9 +68,27 @@ typedef struct {
     uint8_t     staged_mbr[DISK_SECTOR_SIZE];
     partition_t staged_partitions[MAX_PART_COUNT];
     int         free_part_idx;
+    /* Updated each time the partitions, staged or not, change, the views derived from them can be cached */
+    uint32_t    generation;
 } disk_info_t;
 
 
+/* ZealFS partition found by the recovery scan */
+#define MAX_RECOVERED_PARTS 32
+
+typedef struct {
+    uint32_t start_lba;
+    uint32_t size_sectors;
+    uint32_t page_bytes;
+    uint32_t used_pages;
+    uint32_t total_pages;
+} recovered_part_t;
+
+
+/* Opened disk, the content is specific to each backend */
+typedef struct disk_handle_t disk_handle_t;
+
+
 void disk_apply_changes(disk_info_t* disk);
 
 void disk_revert_changes(disk_info_t* disk);
@@ -80,6 +109,33 @@ const char* disk_get_fs_type(uint8_t fs_byte);
 
 void disk_get_size_str(uint64_t size, char* buffer, int buffer_size);
 
+uint32_t disk_aligned_free_space(disk_info_t *disk, uint32_t *largest_free_lba);
+
+const char* disk_clone_partition(disk_info_t *disk, uint32_t lba, const disk_info_t *src, int src_part);
+
+const char* disk_clone_image(disk_info_t *disk, uint32_t lba, const char* path, uint64_t size);
+
 const char* disk_write_changes(disk_info_t* disk);
 
+const char* disk_recover_scan(const disk_info_t* disk, recovered_part_t* out, int max, int* out_count);
+
+const char* disk_recover_partition(disk_info_t* disk, const recovered_part_t* found);
+
+const char* disk_resize_partition(disk_info_t* disk, int partition, uint32_t size_sectors);
+
+void disk_image_info(disk_info_t* info, const char* path, uint64_t size);
+
+/**
+ * @brief Backend specific functions to access the content of a disk.
+ * All of them return NULL on success, an error message else.
+ * Offsets and lengths must be multiple of DISK_SECTOR_SIZE.
+ */
+const char* disk_open(const disk_info_t* disk, bool write, disk_handle_t** out_handle);
+
+const char* disk_read(disk_handle_t* handle, uint64_t offset, void* buffer, uint32_t len);
+
+const char* disk_write(disk_handle_t* handle, uint64_t offset, const void* buffer, uint32_t len);
+
+void disk_close(disk_handle_t* handle);
+
 #endif // DISK_H
@@ -0,0 +1,39 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+
+/* Sectors read at once, the blocks are aligned on their size */
+#define DISK_CACHE_BLOCK_SECTORS    128
+#define DISK_CACHE_BLOCK_SIZE       (DISK_CACHE_BLOCK_SECTORS * DISK_SECTOR_SIZE)
+/* Blocks kept in memory, the least recently used one is replaced */
+#define DISK_CACHE_BLOCKS           64
+/* Blocks waiting to be read, the readahead requests are the first ones dropped when it's full */
+#define DISK_CACHE_QUEUE            16
+/* Blocks read ahead of the last access, in the direction of the scrolling */
+#define DISK_CACHE_READAHEAD        4
+/* Failed blocks remembered so that they are not read again, more than a frame and its readahead can request */
+#define DISK_CACHE_FAILED           32
+
+typedef struct disk_cache_t disk_cache_t;
+
+const char* disk_cache_open(const disk_info_t* disk, disk_cache_t** out_cache);
+
+void disk_cache_close(disk_cache_t* cache);
+
+bool disk_cache_read(disk_cache_t* cache, uint64_t offset, void* buffer, uint32_t len);
+
+void disk_cache_readahead(disk_cache_t* cache, uint64_t offset, int direction);
+
+bool disk_cache_busy(disk_cache_t* cache);
+
+const char* disk_cache_error(disk_cache_t* cache);
+
+#endif // DISK_CACHE_H
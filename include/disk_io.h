@@ -0,0 +1,47 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_IO_H
+#define DISK_IO_H
+
+#include <stdint.h>
+#include "disk.h"
+
+/* Size of each buffer in the I/O pipeline */
+#define DISK_IO_CHUNK_SIZE  (1*MB)
+/* Number of buffers in flight between the reader and the writer */
+#define DISK_IO_SLOTS       4
+/* Requests of a batch closer than this are merged into a single access */
+#define DISK_IO_MERGE_GAP   (64*KB)
+/* Initial value of an incremental hash */
+#define DISK_IO_HASH_INIT   0xcbf29ce484222325ULL
+
+typedef struct {
+    uint64_t src_offset;
+    uint64_t dst_offset;
+    uint64_t len;
+} disk_copy_t;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t len;
+    uint8_t* data;
+} disk_io_req_t;
+
+const char* disk_io_read_batch(disk_handle_t* handle, disk_io_req_t* reqs, int count);
+
+const char* disk_io_write_batch(disk_handle_t* handle, disk_io_req_t* reqs, int count);
+
+uint64_t disk_io_hash(const void* data, uint64_t len);
+
+uint64_t disk_io_hash_update(uint64_t hash, const void* data, uint64_t len);
+
+const char* disk_io_write_diff(disk_handle_t* handle, uint64_t offset, const uint8_t* data,
+                               const uint8_t* current, uint32_t len, uint32_t block, uint32_t* written);
+
+const char* disk_io_copy(disk_handle_t* src, disk_handle_t* dst, const disk_copy_t* extents, int count,
+                         uint32_t delta_block);
+
+#endif // DISK_IO_H
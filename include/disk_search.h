@@ -0,0 +1,39 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef DISK_SEARCH_H
+#define DISK_SEARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+
+/* Number of threads reading the disk concurrently */
+#define DISK_SEARCH_THREADS     4
+/* Size of each read, each chunk also reads the sector after it to find the matches crossing its end */
+#define DISK_SEARCH_CHUNK_SIZE  (4*MB)
+/* Longest pattern, it must fit in the extra sector read after each chunk */
+#define DISK_SEARCH_MAX_PATTERN 64
+/* Only the first matches of the disk are kept, the chunks after the last one kept are skipped */
+#define DISK_SEARCH_MAX_RESULTS 1024
+
+typedef struct disk_search_t disk_search_t;
+
+const char* disk_search_start(const disk_info_t* disk, uint64_t start, uint64_t size,
+                              const uint8_t* pattern, uint32_t len, disk_search_t** out_search);
+
+void disk_search_close(disk_search_t* search);
+
+bool disk_search_running(disk_search_t* search);
+
+float disk_search_progress(disk_search_t* search);
+
+int disk_search_count(disk_search_t* search, bool* truncated);
+
+uint64_t disk_search_result(disk_search_t* search, int index);
+
+const char* disk_search_error(disk_search_t* search);
+
+#endif // DISK_SEARCH_H
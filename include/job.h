@@ -0,0 +1,33 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Function executed by a background job.
+ *
+ * @return NULL on success, an error message else.
+ */
+typedef const char* (*job_fn_t)(void* arg);
+
+bool job_start(const char* name, job_fn_t fn, void* arg);
+
+bool job_running(void);
+
+const char* job_name(void);
+
+bool job_finished(const char** result);
+
+void job_add_total(uint64_t total);
+
+void job_add_progress(uint64_t done);
+
+float job_get_progress(void);
+
+#endif // JOB_H
@@ -0,0 +1,49 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+
+/* Numeric so that they can be compared by the preprocessor, they don't clash with raylib's LOG_INFO and others */
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARN      2
+#define LOG_LEVEL_ERROR     3
+
+/* Messages below this level are not compiled in, build with -DLOG_MIN_LEVEL=0 to get the debug ones */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL       LOG_LEVEL_INFO
+#endif
+
+bool log_init(void);
+
+void log_write(int level, const char* tag, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+/* A stripped message still has its arguments type-checked, but the compiler drops the call */
+#define LOG_STRIPPED(...)   do { if (0) log_write(__VA_ARGS__); } while (0)
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_D(tag, ...)     log_write(LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#else
+#define LOG_D(tag, ...)     LOG_STRIPPED(LOG_LEVEL_DEBUG, tag, __VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_I(tag, ...)     log_write(LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#else
+#define LOG_I(tag, ...)     LOG_STRIPPED(LOG_LEVEL_INFO, tag, __VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_W(tag, ...)     log_write(LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#else
+#define LOG_W(tag, ...)     LOG_STRIPPED(LOG_LEVEL_WARN, tag, __VA_ARGS__)
+#endif
+
+#define LOG_E(tag, ...)     log_write(LOG_LEVEL_ERROR, tag, __VA_ARGS__)
+
+#endif // LOG_H
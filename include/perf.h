@@ -0,0 +1,47 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Parts of a frame timed by the UI thread */
+typedef enum {
+    PERF_UI_BUILD,
+    PERF_DRAW,
+    PERF_SWAP,
+    PERF_SECTION_COUNT,
+} perf_section_t;
+
+/* Disk accesses over the last sampling window */
+typedef struct {
+    double   read_mbps;
+    double   write_mbps;
+    /* Average duration of a single access, in milliseconds */
+    double   latency_ms;
+    double   accesses_per_s;
+    /* Accesses in progress when sampled, and the most seen at once during the window */
+    uint32_t in_flight;
+    uint32_t max_in_flight;
+} perf_io_t;
+
+
+uint64_t perf_now(void);
+
+void perf_section_add(perf_section_t section, uint64_t start);
+
+void perf_frame_end(void);
+
+double perf_section_ms(perf_section_t section);
+
+uint64_t perf_io_begin(void);
+
+void perf_io_end(uint64_t start, uint64_t bytes, bool write);
+
+void perf_io_stats(perf_io_t* stats);
+
+#endif // PERF_H
@@ -9,13 +9,26 @@
 #include <stdint.h>
 #include "nuklear.h"
 
-#define POPUP_COUNT    4
+#define POPUP_COUNT    17
 
 typedef enum {
     POPUP_MBR     = 0,
     POPUP_NEWPART = 1,
     POPUP_APPLY   = 2,
     POPUP_CANCEL  = 3,
+    POPUP_CLONE   = 4,
+    POPUP_RECOVER = 5,
+    POPUP_IMPORT  = 6,
+    POPUP_EXPORT  = 7,
+    POPUP_FSCK    = 8,
+    POPUP_SYNC    = 9,
+    POPUP_IMAGE   = 10,
+    POPUP_BACKUP  = 11,
+    POPUP_RESTORE = 12,
+    POPUP_DEFRAG  = 13,
+    POPUP_ADVISOR = 14,
+    POPUP_RESIZE  = 15,
+    POPUP_VIEWER  = 16,
 } popup_t;
 
 
@@ -53,6 +53,13 @@
 #endif  // NDEBUG
 #endif  // NK_ASSERT
 
+/*
+ * Spacing is determined by the font size multiplied by RAYLIB_NUKLEAR_FONT_SPACING_RATIO.
+ */
+#ifndef RAYLIB_NUKLEAR_FONT_SPACING_RATIO
+#define RAYLIB_NUKLEAR_FONT_SPACING_RATIO 0.01f
+#endif // RAYLIB_NUKLEAR_FONT_SPACING_RATIO
+
 #include "nuklear.h"
 
 #ifdef __cplusplus
@@ -61,6 +68,7 @@ extern "C" {
 
 NK_API struct nk_context* InitNuklear(int fontSize);                // Initialize the Nuklear GUI context using raylib's font
 NK_API struct nk_context* InitNuklearEx(Font font, float fontSize); // Initialize the Nuklear GUI context, with a custom font
+NK_API struct nk_context* InitNuklearFixed(Font font, float fontSize, nk_size memorySize); // Initialize the Nuklear GUI context, with a custom font and a fixed memory arena
 NK_API Font LoadFontFromNuklear(int fontSize);                      // Loads the default Nuklear font
 NK_API void UpdateNuklear(struct nk_context * ctx);                 // Update the input state and internal components for Nuklear
 NK_API void UpdateNuklearEx(struct nk_context * ctx, float deltaTime); // Update the input state and internal components for Nuklear, with a custom frame time
@@ -79,6 +87,9 @@ NK_API void UnloadNuklearImage(struct nk_image img);                // Unload a
 NK_API void CleanupNuklearImage(struct nk_image img);               // Frees the data stored by the Nuklear image
 NK_API void SetNuklearScaling(struct nk_context * ctx, float scaling); // Sets the scaling for the given Nuklear context
 NK_API float GetNuklearScaling(struct nk_context * ctx);            // Retrieves the scaling of the given Nuklear context
+NK_API int GetNuklearDrawCalls(struct nk_context * ctx);            // Retrieves the number of draw calls submitted by the last DrawNuklear
+NK_API nk_size GetNuklearMemoryPeak(struct nk_context * ctx);       // Retrieves the most memory a drawn frame needed, commands and windows
+NK_API nk_size GetNuklearMemorySize(struct nk_context * ctx);       // Retrieves the size of the fixed memory arena, 0 when Nuklear allocates from the heap
 
 // Internal Nuklear functions
 NK_API float nk_raylib_font_get_text_width(nk_handle handle, float height, const char *text, int len);
@@ -88,6 +99,7 @@ NK_API void nk_raylib_clipboard_copy(nk_handle usr, const char *text, int len);
 NK_API void* nk_raylib_malloc(nk_handle unused, void *old, nk_size size);
 NK_API void nk_raylib_mfree(nk_handle unused, void *ptr);
 NK_API struct nk_context* InitNuklearContext(struct nk_user_font* userFont);
+NK_API struct nk_context* InitNuklearContextFixed(struct nk_user_font* userFont, nk_size memorySize);
 NK_API void nk_raylib_input_keyboard(struct nk_context * ctx);
 NK_API void nk_raylib_input_mouse(struct nk_context * ctx);
 
@@ -117,6 +129,7 @@ NK_API void nk_raylib_input_mouse(struct nk_context * ctx);
 
 #define NK_IMPLEMENTATION
 #include "nuklear.h"
+#include "rlgl.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -129,13 +142,6 @@ extern "C" {
 #define RAYLIB_NUKLEAR_DEFAULT_FONTSIZE 13
 #endif  // RAYLIB_NUKLEAR_DEFAULT_FONTSIZE
 
-/*
- * Spacing is determined by the font size multiplied by RAYLIB_NUKLEAR_FONT_SPACING_RATIO.
- */
-#ifndef RAYLIB_NUKLEAR_FONT_SPACING_RATIO
-#define RAYLIB_NUKLEAR_FONT_SPACING_RATIO 0.01f
-#endif // RAYLIB_NUKLEAR_FONT_SPACING_RATIO
-
 #ifndef RAYLIB_NUKLEAR_DEFAULT_ARC_SEGMENTS
 /**
  * The amount of segments used when drawing an arc.
@@ -154,8 +160,156 @@ extern "C" {
  */
 typedef struct NuklearUserData {
     float scaling; // The scaling of the Nuklear user interface.
+    rlRenderBatch batch; // Vertex buffer the commands are converted to, submitted once per scissor region.
+    bool batchLoaded;
+    int drawCalls; // Draw calls submitted by the last DrawNuklear.
+    void* arena; // Memory given to nk_init_fixed, NULL when Nuklear allocates from the heap.
+    nk_size arenaSize;
+    nk_size memoryPeak; // Most memory needed by a drawn frame, see nk_raylib_track_memory.
+    bool arenaExhausted;
 } NuklearUserData;
 
+#ifndef RAYLIB_NUKLEAR_BATCH_ELEMENTS
+/**
+ * The number of quads the vertex buffer of DrawNuklear holds before it has to be submitted.
+ */
+#define RAYLIB_NUKLEAR_BATCH_ELEMENTS 16384
+#endif  // RAYLIB_NUKLEAR_BATCH_ELEMENTS
+
+#ifndef RAYLIB_NUKLEAR_SHAPE_VERTICES
+/**
+ * The most vertices raylib adds to the batch for a shape: rounded rectangles, circles, arcs and curves.
+ */
+#define RAYLIB_NUKLEAR_SHAPE_VERTICES 512
+#endif  // RAYLIB_NUKLEAR_SHAPE_VERTICES
+
+/**
+ * The font given to Nuklear by InitNuklearEx, along with the advance of its glyphs so that measuring a text
+ * is a sum of table lookups. The raylib font must stay the first member, the draw commands use the user
+ * font handle as a Font pointer.
+ */
+typedef struct NuklearFont {
+    Font font;
+    float ascii[128];       // Advance of the ASCII codepoints, in font units.
+    float fallback;         // Advance of the codepoints missing from the font, drawn as '?'.
+    int* wideCodepoints;    // Open addressing table of the other codepoints of the font, 0 marks a free slot.
+    float* wideAdvances;    // Advance of each codepoint of wideCodepoints.
+    int wideMask;           // Size of the table minus one, the size is a power of two.
+    Rectangle whiteRec;     // White texel of the atlas, to draw the shapes without switching textures.
+    bool hasWhiteRec;
+} NuklearFont;
+
+/**
+ * Get the advance of a glyph the way MeasureTextEx computes it, in font units.
+ *
+ * @internal
+ */
+static float
+nk_raylib_glyph_advance(Font font, int index)
+{
+    if (font.glyphs[index].advanceX != 0) {
+        return (float)font.glyphs[index].advanceX;
+    }
+    return font.recs[index].width + (float)font.glyphs[index].offsetX;
+}
+
+/**
+ * Build the advance tables of the given font. The codepoints beyond ASCII are hashed in a table twice as
+ * big as the number of glyphs, so that the probe sequences stay short.
+ *
+ * @internal
+ */
+static void
+nk_raylib_font_build_widths(NuklearFont* font)
+{
+    for (int c = 0; c < 128; c++) {
+        font->ascii[c] = nk_raylib_glyph_advance(font->font, GetGlyphIndex(font->font, c));
+    }
+    font->fallback = font->ascii['?'];
+
+    int size = 16;
+    while (size < font->font.glyphCount * 2) {
+        size *= 2;
+    }
+    font->wideMask = size - 1;
+    font->wideCodepoints = (int*)MemAlloc(sizeof(int) * size);
+    font->wideAdvances = (float*)MemAlloc(sizeof(float) * size);
+    if (font->wideCodepoints == NULL || font->wideAdvances == NULL) {
+        MemFree(font->wideCodepoints);
+        MemFree(font->wideAdvances);
+        font->wideCodepoints = NULL;
+        font->wideAdvances = NULL;
+        return;
+    }
+    for (int i = 0; i < font->font.glyphCount; i++) {
+        const int codepoint = font->font.glyphs[i].value;
+        if (codepoint < 128) {
+            continue;
+        }
+        int slot = (codepoint * 2654435761u) & font->wideMask;
+        while (font->wideCodepoints[slot] != 0 && font->wideCodepoints[slot] != codepoint) {
+            slot = (slot + 1) & font->wideMask;
+        }
+        font->wideCodepoints[slot] = codepoint;
+        font->wideAdvances[slot] = nk_raylib_glyph_advance(font->font, i);
+    }
+}
+
+/**
+ * Look for the white rectangle raylib reserves in the bottom-right corner of the font atlases it generates.
+ * When present, the shapes can be drawn from the font texture, so that text and shapes share the same draw call.
+ *
+ * @internal
+ */
+static void
+nk_raylib_font_find_white(NuklearFont* font)
+{
+    font->hasWhiteRec = false;
+    if (font->font.texture.id == 0 || font->font.texture.width < 3 || font->font.texture.height < 3) {
+        return;
+    }
+    Image atlas = LoadImageFromTexture(font->font.texture);
+    if (atlas.data == NULL) {
+        return;
+    }
+    // Sample the center of the 3x3 rectangle, so that a filtered texture still reads plain white.
+    const int x = atlas.width - 2;
+    const int y = atlas.height - 2;
+    bool white = true;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            const Color color = GetImageColor(atlas, x + dx, y + dy);
+            white = white && color.r == 255 && color.g == 255 && color.b == 255 && color.a == 255;
+        }
+    }
+    UnloadImage(atlas);
+    if (white) {
+        font->whiteRec = CLITERAL(Rectangle) {(float)x, (float)y, 1, 1};
+        font->hasWhiteRec = true;
+    }
+}
+
+/**
+ * Get the advance of a codepoint beyond ASCII, in font units.
+ *
+ * @internal
+ */
+static float
+nk_raylib_font_wide_advance(const NuklearFont* font, int codepoint)
+{
+    if (font->wideCodepoints == NULL) {
+        return nk_raylib_glyph_advance(font->font, GetGlyphIndex(font->font, codepoint));
+    }
+    int slot = (codepoint * 2654435761u) & font->wideMask;
+    while (font->wideCodepoints[slot] != 0) {
+        if (font->wideCodepoints[slot] == codepoint) {
+            return font->wideAdvances[slot];
+        }
+        slot = (slot + 1) & font->wideMask;
+    }
+    return font->fallback;
+}
+
 /**
  * Nuklear callback; Get the width of the given text.
  *
@@ -187,17 +341,29 @@ nk_raylib_font_get_text_width(nk_handle handle, float height, const char *text,
 NK_API float
 nk_raylib_font_get_text_width_user_font(nk_handle handle, float height, const char *text, int len)
 {
-    if (len > 0) {
-        // Grab the text with the cropped length so that it only measures the desired string length.
-        const char* subtext = TextSubtext(text, 0, len);
-
-        // Spacing is determined by the font size multiplied by RAYLIB_NUKLEAR_FONT_SPACING_RATIO.
-        // Raylib only counts the spacing between characters, but Nuklear expects one spacing to be
-        // counter for every character in the string:
-        return MeasureTextEx(*(Font*)handle.ptr, subtext, height, height * RAYLIB_NUKLEAR_FONT_SPACING_RATIO).x + height * RAYLIB_NUKLEAR_FONT_SPACING_RATIO;
+    const NuklearFont* font = (const NuklearFont*)handle.ptr;
+    float width = 0;
+    int count = 0;
+
+    // Sum the advances from the tables instead of copying the text and looking each glyph up in the font.
+    // Nuklear only measures single lines, so new lines are not treated specially.
+    for (int i = 0; i < len; count++) {
+        const unsigned char c = (unsigned char)text[i];
+        if (c < 128) {
+            width += font->ascii[c];
+            i++;
+        } else {
+            nk_rune codepoint;
+            const int bytes = nk_utf_decode(text + i, &codepoint, len - i);
+            width += bytes > 0 ? nk_raylib_font_wide_advance(font, (int)codepoint) : font->fallback;
+            i += bytes > 0 ? bytes : 1;
+        }
     }
 
-    return 0;
+    // Spacing is determined by the font size multiplied by RAYLIB_NUKLEAR_FONT_SPACING_RATIO.
+    // Raylib only counts the spacing between characters, but Nuklear expects one spacing to be
+    // counter for every character in the string:
+    return width * height / (float)font->font.baseSize + (float)count * height * RAYLIB_NUKLEAR_FONT_SPACING_RATIO;
 }
 
 /**
@@ -265,6 +431,22 @@ nk_raylib_mfree(nk_handle unused, void *ptr)
  */
 NK_API struct nk_context*
 InitNuklearContext(struct nk_user_font* userFont)
+{
+    return InitNuklearContextFixed(userFont, 0);
+}
+
+/**
+ * Initialize the Nuklear context for use with Raylib, with the given Nuklear user font and memory.
+ *
+ * @param userFont The Nuklear user font to initialize the Nuklear context with.
+ * @param memorySize Size of the arena allocated once for Nuklear's commands and windows, or 0 to let Nuklear
+ * grow its buffers from the heap as needed. With an arena, the commands that don't fit are dropped, but Nuklear
+ * can't open a window, popup or tooltip that doesn't fit: keep a margin over the measured peak.
+ *
+ * @internal
+ */
+NK_API struct nk_context*
+InitNuklearContextFixed(struct nk_user_font* userFont, nk_size memorySize)
 {
     struct nk_context* ctx = (struct nk_context*)MemAlloc(sizeof(struct nk_context));
     if (ctx == NULL) {
@@ -285,9 +467,18 @@ InitNuklearContext(struct nk_user_font* userFont)
     alloc.alloc = nk_raylib_malloc;
     alloc.free = nk_raylib_mfree;
 
-    // Initialize the context.
-    if (!nk_init(ctx, &alloc, userFont)) {
+    // Initialize the context, the arena holds the commands at the front and the windows at the back.
+    nk_bool initialized;
+    if (memorySize > 0) {
+        userData->arena = MemAlloc((unsigned int)memorySize);
+        userData->arenaSize = memorySize;
+        initialized = userData->arena != NULL && nk_init_fixed(ctx, userData->arena, memorySize, userFont);
+    } else {
+        initialized = nk_init(ctx, &alloc, userFont);
+    }
+    if (!initialized) {
         TraceLog(LOG_ERROR, "NUKLEAR: Failed to initialize nuklear");
+        MemFree(userData->arena);
         MemFree(ctx);
         MemFree(userData);
         return NULL;
@@ -347,19 +538,37 @@ InitNuklear(int fontSize)
 NK_API struct nk_context*
 InitNuklearEx(Font font, float fontSize)
 {
-    // Copy the font to a new raylib font pointer.
-    struct Font* newFont = (struct Font*)MemAlloc(sizeof(struct Font));
+    return InitNuklearFixed(font, fontSize, 0);
+}
+
+/**
+ * Initialize the Nuklear context for use with Raylib, with a supplied custom font and a fixed memory arena,
+ * so that no frame allocates memory. Size the arena from GetNuklearMemoryPeak.
+ *
+ * @param font The custom raylib font to use with Nuklear.
+ * @param fontSize The desired size of the font. Use 0 to set the default size of 10.
+ * @param memorySize The size of the arena, or 0 to allocate from the heap as InitNuklearEx does.
+ *
+ * @return The nuklear context, or NULL on error.
+ */
+NK_API struct nk_context*
+InitNuklearFixed(Font font, float fontSize, nk_size memorySize)
+{
+    // Copy the font to a new raylib font pointer, along with its glyph advances.
+    NuklearFont* newFont = (NuklearFont*)MemAlloc(sizeof(NuklearFont));
 
     // Use the default font size if desired.
     if (fontSize <= 0.0f) {
         fontSize = (float)RAYLIB_NUKLEAR_DEFAULT_FONTSIZE;
     }
-    newFont->baseSize = font.baseSize;
-    newFont->glyphCount = font.glyphCount;
-    newFont->glyphPadding = font.glyphPadding;
-    newFont->glyphs = font.glyphs;
-    newFont->recs = font.recs;
-    newFont->texture = font.texture;
+    newFont->font.baseSize = font.baseSize;
+    newFont->font.glyphCount = font.glyphCount;
+    newFont->font.glyphPadding = font.glyphPadding;
+    newFont->font.glyphs = font.glyphs;
+    newFont->font.recs = font.recs;
+    newFont->font.texture = font.texture;
+    nk_raylib_font_build_widths(newFont);
+    nk_raylib_font_find_white(newFont);
 
     // Create the nuklear user font.
     struct nk_user_font* userFont = (struct nk_user_font*)MemAlloc(sizeof(struct nk_user_font));
@@ -368,7 +577,7 @@ InitNuklearEx(Font font, float fontSize)
     userFont->width = nk_raylib_font_get_text_width_user_font;
 
     // Nuklear context.
-    return InitNuklearContext(userFont);
+    return InitNuklearContextFixed(userFont, memorySize);
 }
 
 /**
@@ -451,32 +660,211 @@ ColorToNuklearF(Color color)
     return nk_color_cf(ColorToNuklear(color));
 }
 
+/**
+ * Submit the vertices accumulated in the batch of the context, counting the draw calls it takes.
+ *
+ * @internal
+ */
+static void
+nk_raylib_batch_flush(NuklearUserData* userData)
+{
+    for (int i = 0; i < userData->batch.drawCounter; i++) {
+        if (userData->batch.draws[i].vertexCount > 0) {
+            userData->drawCalls++;
+        }
+    }
+    rlDrawRenderBatchActive();
+}
+
+/**
+ * Estimate the vertices raylib adds to the batch to draw a command, never less than it actually adds.
+ *
+ * @internal
+ */
+static int
+nk_raylib_command_vertices(const struct nk_command* cmd)
+{
+    switch (cmd->type) {
+        case NK_COMMAND_NOP:
+        case NK_COMMAND_SCISSOR:
+            return 0;
+        case NK_COMMAND_TEXT:
+            // One quad per glyph, there are never more glyphs than bytes
+            return 4 * ((const struct nk_command_text*)cmd)->length;
+        case NK_COMMAND_POLYGON:
+            return 6 * (((const struct nk_command_polygon*)cmd)->point_count + 1);
+        case NK_COMMAND_POLYGON_FILLED:
+            return 6 * (((const struct nk_command_polygon_filled*)cmd)->point_count + 1);
+        case NK_COMMAND_POLYLINE:
+            return 6 * (((const struct nk_command_polyline*)cmd)->point_count + 1);
+        default:
+            return RAYLIB_NUKLEAR_SHAPE_VERTICES;
+    }
+}
+
+/**
+ * Submit the batch, counting its draw calls, when the next command may not fit in it. raylib would submit it
+ * by itself in the middle of the command otherwise, and these draw calls would not be counted.
+ *
+ * @internal
+ */
+static void
+nk_raylib_batch_reserve(NuklearUserData* userData, int vertices)
+{
+    const rlRenderBatch* batch = &userData->batch;
+    if (vertices == 0) {
+        return;
+    }
+    // raylib pads each draw with its alignment, the current draw's is only known once it's over
+    int used = 0;
+    for (int i = 0; i < batch->drawCounter; i++) {
+        used += batch->draws[i].vertexCount + batch->draws[i].vertexAlignment;
+    }
+    // A command changes the texture and the mode at most once each, both add a draw
+    if (used + vertices + 4 >= batch->vertexBuffer[batch->currentBuffer].elementCount * 4 ||
+        batch->drawCounter + 2 >= RL_DEFAULT_BATCH_DRAWCALLS) {
+        nk_raylib_batch_flush(userData);
+    }
+}
+
+/**
+ * Add a rectangle to the active batch, textured with the shapes texture as raylib's shapes are.
+ *
+ * @internal
+ */
+static void
+nk_raylib_batch_rect(Rectangle rect, Color color)
+{
+    const Texture2D texture = GetShapesTexture();
+    const Rectangle source = GetShapesTextureRectangle();
+    const float u0 = source.x / (float)texture.width;
+    const float v0 = source.y / (float)texture.height;
+    const float u1 = (source.x + source.width) / (float)texture.width;
+    const float v1 = (source.y + source.height) / (float)texture.height;
+
+    rlSetTexture(texture.id);
+    rlBegin(RL_QUADS);
+        rlNormal3f(0.0f, 0.0f, 1.0f);
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        rlTexCoord2f(u0, v0);
+        rlVertex2f(rect.x, rect.y);
+        rlTexCoord2f(u0, v1);
+        rlVertex2f(rect.x, rect.y + rect.height);
+        rlTexCoord2f(u1, v1);
+        rlVertex2f(rect.x + rect.width, rect.y + rect.height);
+        rlTexCoord2f(u1, v0);
+        rlVertex2f(rect.x + rect.width, rect.y);
+    rlEnd();
+    rlSetTexture(0);
+}
+
+/**
+ * Add the outline of a rectangle to the active batch, as DrawRectangleLinesEx draws it.
+ *
+ * @internal
+ */
+static void
+nk_raylib_batch_rect_lines(Rectangle rect, float thickness, Color color)
+{
+    if (thickness > rect.width || thickness > rect.height) {
+        thickness = (rect.width >= rect.height) ? rect.height / 2.0f : rect.width / 2.0f;
+    }
+    nk_raylib_batch_rect(CLITERAL(Rectangle) {rect.x, rect.y, rect.width, thickness}, color);
+    nk_raylib_batch_rect(CLITERAL(Rectangle) {rect.x, rect.y + rect.height - thickness, rect.width, thickness}, color);
+    nk_raylib_batch_rect(CLITERAL(Rectangle) {rect.x, rect.y + thickness, thickness, rect.height - thickness * 2.0f}, color);
+    nk_raylib_batch_rect(CLITERAL(Rectangle) {rect.x + rect.width - thickness, rect.y + thickness, thickness, rect.height - thickness * 2.0f}, color);
+}
+
+/**
+ * Update the memory high-water mark with the frame about to be cleared.
+ *
+ * @internal
+ */
+static void
+nk_raylib_track_memory(struct nk_context * ctx, NuklearUserData* userData)
+{
+    nk_size needed = ctx->memory.needed;
+    if (userData->arena == NULL) {
+        // The windows come from a separate pool, count them as an arena would hold them.
+        for (const struct nk_page* page = ctx->pool.pages; page != NULL; page = page->next) {
+            needed += page->size * sizeof(struct nk_page_element);
+        }
+    } else {
+        // The windows stay at the back of the arena across frames. The buffer also counts the allocations
+        // that didn't fit, forget them once reported so that the next frames are measured on their own.
+        const nk_size used = ctx->memory.allocated + (userData->arenaSize - ctx->memory.size);
+        if (needed > used) {
+            if (!userData->arenaExhausted) {
+                TraceLog(LOG_WARNING, "NUKLEAR: Memory arena of %u bytes exhausted, %u bytes needed",
+                         (unsigned int)userData->arenaSize, (unsigned int)needed);
+            }
+            userData->arenaExhausted = true;
+            ctx->memory.needed = used;
+        }
+    }
+    if (needed > userData->memoryPeak) {
+        userData->memoryPeak = needed;
+    }
+}
+
 /**
  * Draw the given Nuklear context in raylib.
  *
+ * The commands are converted to the vertices of a batch owned by the context, which is only submitted when
+ * the scissor region changes. When the font atlas has a white rectangle, the shapes are textured with it so
+ * that text and shapes don't split the batch in several draw calls.
+ *
  * @param ctx The nuklear context.
  */
 NK_API void
 DrawNuklear(struct nk_context * ctx)
 {
     // Protect against drawing when there's nothing to draw.
-    if (ctx == NULL) {
+    if (ctx == NULL || ctx->userdata.ptr == NULL) {
         return;
     }
 
     const struct nk_command *cmd;
     const float scale = GetNuklearScaling(ctx);
+    NuklearUserData* userData = (NuklearUserData*)ctx->userdata.ptr;
+    int scissor[4] = {-1, -1, -1, -1};
+
+    if (!userData->batchLoaded) {
+        userData->batch = rlLoadRenderBatch(1, RAYLIB_NUKLEAR_BATCH_ELEMENTS);
+        userData->batchLoaded = true;
+    }
+    rlSetRenderBatchActive(&userData->batch);
+    userData->drawCalls = 0;
+
+    const Texture2D shapesTexture = GetShapesTexture();
+    const Rectangle shapesRec = GetShapesTextureRectangle();
+    const struct nk_user_font* userFont = ctx->style.font;
+    if (userFont != NULL && userFont->width == nk_raylib_font_get_text_width_user_font) {
+        const NuklearFont* font = (const NuklearFont*)userFont->userdata.ptr;
+        if (font->hasWhiteRec) {
+            SetShapesTexture(font->font.texture, font->whiteRec);
+        }
+    }
 
     nk_foreach(cmd, ctx) {
+        nk_raylib_batch_reserve(userData, nk_raylib_command_vertices(cmd));
         switch (cmd->type) {
             case NK_COMMAND_NOP: {
                 break;
             }
 
             case NK_COMMAND_SCISSOR: {
-                // TODO(RobLoach): Verify if NK_COMMAND_SCISSOR works.
+                // Nuklear repeats the scissor of a window for each of its panels, only submit the batch
+                // when the region actually changes.
                 const struct nk_command_scissor *s =(const struct nk_command_scissor*)cmd;
-                BeginScissorMode((int)(s->x * scale), (int)(s->y * scale), (int)(s->w * scale), (int)(s->h * scale));
+                if (s->x != scissor[0] || s->y != scissor[1] || s->w != scissor[2] || s->h != scissor[3]) {
+                    scissor[0] = s->x;
+                    scissor[1] = s->y;
+                    scissor[2] = s->w;
+                    scissor[3] = s->h;
+                    nk_raylib_batch_flush(userData);
+                    BeginScissorMode((int)(s->x * scale), (int)(s->y * scale), (int)(s->w * scale), (int)(s->h * scale));
+                }
             } break;
 
             case NK_COMMAND_LINE: {
@@ -519,7 +907,7 @@ DrawNuklear(struct nk_context * ctx)
 #endif
                 }
                 else {
-                    DrawRectangleLinesEx(rect, r->line_thickness * scale, color);
+                    nk_raylib_batch_rect_lines(rect, r->line_thickness * scale, color);
                 }
             } break;
 
@@ -534,7 +922,7 @@ DrawNuklear(struct nk_context * ctx)
                     DrawRectangleRounded(rect, roundness, RAYLIB_NUKLEAR_DEFAULT_ARC_SEGMENTS, color);
                 }
                 else {
-                    DrawRectangleRec(rect, color);
+                    nk_raylib_batch_rect(rect, color);
                 }
             } break;
 
@@ -673,6 +1061,14 @@ DrawNuklear(struct nk_context * ctx)
         }
     }
 
+    nk_raylib_batch_flush(userData);
+    if (scissor[0] != -1) {
+        EndScissorMode();
+    }
+    rlSetRenderBatchActive(NULL);
+    SetShapesTexture(shapesTexture, shapesRec);
+
+    nk_raylib_track_memory(ctx, userData);
     nk_clear(ctx);
 }
 
@@ -834,6 +1230,10 @@ UnloadNuklear(struct nk_context * ctx)
         // Clear the raylib Font object.
         void* fontPtr = userFont->userdata.ptr;
         if (fontPtr != NULL) {
+            if (userFont->width == nk_raylib_font_get_text_width_user_font) {
+                MemFree(((NuklearFont*)fontPtr)->wideCodepoints);
+                MemFree(((NuklearFont*)fontPtr)->wideAdvances);
+            }
             MemFree(fontPtr);
         }
 
@@ -844,11 +1244,18 @@ UnloadNuklear(struct nk_context * ctx)
 
     // Unload the custom user data.
     if (ctx->userdata.ptr != NULL) {
-        MemFree(ctx->userdata.ptr);
+        struct NuklearUserData* userData = (struct NuklearUserData*)ctx->userdata.ptr;
+        if (userData->batchLoaded) {
+            rlUnloadRenderBatch(userData->batch);
+        }
     }
 
-    // Unload the nuklear context.
+    // Unload the nuklear context, then its arena if any.
     nk_free(ctx);
+    if (ctx->userdata.ptr != NULL) {
+        MemFree(((struct NuklearUserData*)ctx->userdata.ptr)->arena);
+        MemFree(ctx->userdata.ptr);
+    }
     MemFree(ctx);
     TraceLog(LOG_INFO, "NUKLEAR: Unloaded GUI");
 }
@@ -1011,6 +1418,51 @@ GetNuklearScaling(struct nk_context * ctx)
     return 1.0f;
 }
 
+/**
+ * Retrieves the number of draw calls the last DrawNuklear submitted to the GPU. The batch is submitted before
+ * any command that may not fit in it, so that raylib never does it uncounted, unless a single command is
+ * bigger than the whole batch.
+ *
+ * @return The number of draw calls, 0 if nothing was drawn yet.
+ */
+NK_API int
+GetNuklearDrawCalls(struct nk_context * ctx)
+{
+    if (ctx == NULL || ctx->userdata.ptr == NULL) {
+        return 0;
+    }
+    return ((struct NuklearUserData*)ctx->userdata.ptr)->drawCalls;
+}
+
+/**
+ * Retrieves the most memory a frame drawn by DrawNuklear needed, for its commands and the windows. Give it
+ * to InitNuklearFixed, with some margin, to size the arena of the next runs.
+ *
+ * @return The high-water mark in bytes, it exceeds the arena when commands were dropped.
+ */
+NK_API nk_size
+GetNuklearMemoryPeak(struct nk_context * ctx)
+{
+    if (ctx == NULL || ctx->userdata.ptr == NULL) {
+        return 0;
+    }
+    return ((struct NuklearUserData*)ctx->userdata.ptr)->memoryPeak;
+}
+
+/**
+ * Retrieves the size of the memory arena given to InitNuklearFixed.
+ *
+ * @return The size of the arena in bytes, 0 when Nuklear allocates from the heap.
+ */
+NK_API nk_size
+GetNuklearMemorySize(struct nk_context * ctx)
+{
+    if (ctx == NULL || ctx->userdata.ptr == NULL) {
+        return 0;
+    }
+    return ((struct NuklearUserData*)ctx->userdata.ptr)->arenaSize;
+}
+
 #ifdef __cplusplus
 }
 #endif
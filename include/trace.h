@@ -0,0 +1,42 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "perf.h"
+
+/* Environment variable giving the trace file, the `--trace <file>` option does the same */
+#define TRACE_ENV_VAR   "ZEAL_DISK_TOOL_TRACE"
+
+/* Set by trace_init before any other thread starts, so that a disabled trace costs a single test */
+extern bool g_trace_enabled;
+
+bool trace_init(const char* path);
+
+void trace_record(const char* name, uint64_t start, uint64_t offset, uint32_t len);
+
+/**
+ * @brief Get the start time of an event, 0 when the trace is disabled.
+ */
+static inline uint64_t trace_begin(void)
+{
+    return g_trace_enabled ? perf_now() : 0;
+}
+
+/**
+ * @brief Record an event that started at `start` and ends now. `name` must be a string literal, it is only
+ * read when the trace is written. `offset` and `len` describe the disk access, if any, `len` is 0 else.
+ */
+static inline void trace_end(const char* name, uint64_t start, uint64_t offset, uint32_t len)
+{
+    if (g_trace_enabled) {
+        trace_record(name, start, offset, len);
+    }
+}
+
+#endif // TRACE_H
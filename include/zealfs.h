@@ -0,0 +1,234 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZEALFS_H
+#define ZEALFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "disk.h"
+#include "zealfs_v2.h"
+
+/* Default number of pages kept in a page cache */
+#define ZEALFS_CACHE_PAGES  64
+/* Modified pages are written back once they reach this size */
+#define ZEALFS_FLUSH_BYTES  (16*MB)
+
+typedef struct zealfs_cache_t zealfs_cache_t;
+
+/* Page modified in memory, not written to the disk yet */
+typedef struct {
+    uint16_t page;
+    uint8_t* data;
+} zealfs_pending_t;
+
+/* ZealFS v2 partition opened on a disk */
+typedef struct {
+    disk_handle_t*      handle;
+    const disk_info_t*  disk;
+    int                 partition;
+    /* Offset of the partition on the disk, in bytes */
+    uint64_t            offset;
+    uint32_t            page_bytes;
+    uint32_t            page_count;
+    uint32_t            fat_entries;
+    /* Copy of the first page: header, bitmap and root directory */
+    ZealFSHeader*       header;
+    /* Copy of the FAT, in host endianness */
+    uint16_t*           fat;
+    zealfs_cache_t*     cache;
+    bool                own_cache;
+    /* Write support: the header and the FAT are written back on flush, with the pending pages */
+    bool                meta_dirty;
+    uint32_t            alloc_hint;
+    zealfs_pending_t*   pending;
+    int32_t*            pending_idx;
+    uint32_t            pending_count;
+    uint32_t            pending_cap;
+    uint64_t            pending_bytes;
+} zealfs_t;
+
+typedef struct {
+    char     name[ZEALFS_NAME_MAX_LEN + 1];
+    bool     is_dir;
+    uint16_t start_page;
+    uint32_t size;
+    uint8_t  date[8];
+    /* Location of the entry itself, the root directory has none */
+    uint16_t dir_page;
+    uint32_t dir_offset;
+} zealfs_entry_t;
+
+/* Result of a consistency check */
+typedef struct {
+    uint32_t files;
+    uint32_t dirs;
+    /* Pages marked as used in the bitmap but not referenced by any entry */
+    uint32_t leaked_pages;
+    /* Pages referenced by an entry but marked as free in the bitmap */
+    uint32_t unmarked_pages;
+    /* Chains that run into a page already referenced, by another chain or by themselves */
+    uint32_t cross_linked;
+    /* Entries whose chain starts or continues out of the partition, or is shorter than their size */
+    uint32_t dangling;
+    /* Free pages according to the header and according to the bitmap rebuilt from the entries */
+    uint32_t free_pages;
+    uint32_t expected_free_pages;
+    /* Number of entries modified by the repair */
+    uint32_t repaired;
+} zealfs_fsck_t;
+
+/* Result of a synchronization */
+typedef struct {
+    uint32_t unchanged;
+    uint32_t updated;
+    uint32_t created;
+    uint32_t removed;
+    uint32_t pages_written;
+} zealfs_sync_t;
+
+/* Fragmentation of a partition */
+typedef struct {
+    /* Files and directories */
+    uint32_t entries;
+    /* Entries whose chain is made of more than one run of consecutive pages */
+    uint32_t fragmented;
+    /* Runs of consecutive pages of all the chains */
+    uint32_t extents;
+    uint32_t free_extents;
+    uint32_t largest_free;
+} zealfs_frag_t;
+
+/* Result of a defragmentation */
+typedef struct {
+    zealfs_frag_t before;
+    zealfs_frag_t after;
+    uint32_t      pages_moved;
+} zealfs_defrag_t;
+
+/* Files of a given size, in a workload */
+typedef struct {
+    uint32_t size;
+    uint32_t count;
+} zealfs_size_bin_t;
+
+/* Files and directories to store on a partition, used to simulate the page sizes */
+typedef struct {
+    zealfs_size_bin_t*  bins;
+    uint32_t            bin_count;
+    uint32_t            bin_cap;
+    /* Number of entries of each directory, except the root */
+    uint32_t*           dirs;
+    uint32_t            dir_count;
+    uint32_t            dir_cap;
+    uint32_t            root_entries;
+    uint64_t            files;
+    uint64_t            bytes;
+} zealfs_workload_t;
+
+/* Result of the simulation of a workload on a partition size and a page size */
+typedef struct {
+    uint64_t part_size;
+    uint32_t page_bytes;
+    /* Page size chosen by the format for this partition size, the other ones are only given for comparison */
+    bool     standard;
+    bool     fits;
+    uint32_t page_count;
+    /* Pages that can be allocated, the FAT only covers the first ones on the biggest partitions */
+    uint32_t usable_pages;
+    uint32_t used_pages;
+    uint32_t root_max;
+    /* Unused bytes at the end of the last page of the files */
+    uint64_t slack;
+    /* Header, FAT, directory pages and pages out of the FAT, in bytes */
+    uint64_t overhead;
+} zealfs_advice_t;
+
+/**
+ * @brief Callback invoked for each entry of a directory, return non-zero to stop the iteration.
+ */
+typedef int (*zealfs_dir_cb_t)(zealfs_t* fs, const zealfs_entry_t* entry, void* arg);
+
+zealfs_cache_t* zealfs_cache_create(uint32_t pages);
+
+void zealfs_cache_destroy(zealfs_cache_t* cache);
+
+void zealfs_cache_stats(const zealfs_cache_t* cache, uint64_t* hits, uint64_t* misses);
+
+void zealfs_cache_forget(zealfs_t* fs);
+
+void zealfs_cache_clear(zealfs_cache_t* cache);
+
+const char* zealfs_mount(zealfs_t* fs, disk_handle_t* handle, const disk_info_t* disk, int partition, zealfs_cache_t* cache);
+
+void zealfs_unmount(zealfs_t* fs);
+
+const char* zealfs_read_page(zealfs_t* fs, uint16_t page, const uint8_t** data);
+
+uint16_t zealfs_next_page(const zealfs_t* fs, uint16_t page);
+
+void zealfs_root(const zealfs_t* fs, zealfs_entry_t* root);
+
+const char* zealfs_foreach(zealfs_t* fs, const zealfs_entry_t* dir, zealfs_dir_cb_t cb, void* arg);
+
+const char* zealfs_lookup(zealfs_t* fs, const char* path, zealfs_entry_t* entry);
+
+const char* zealfs_read(zealfs_t* fs, const zealfs_entry_t* file, uint32_t offset, void* buffer, uint32_t len, uint32_t* read);
+
+/* Write support, the partition must have been mounted with a handle opened for writing */
+const char* zealfs_alloc(zealfs_t* fs, uint32_t count, uint16_t* first);
+
+void zealfs_free_chain(zealfs_t* fs, uint16_t first);
+
+const char* zealfs_resize(zealfs_t* fs, zealfs_entry_t* entry, uint32_t size);
+
+const char* zealfs_write_page(zealfs_t* fs, uint16_t page, const void* data, uint32_t len);
+
+const char* zealfs_create(zealfs_t* fs, const zealfs_entry_t* dir, const char* name, bool is_dir,
+                          uint32_t size, const uint8_t date[8], zealfs_entry_t* entry);
+
+const char* zealfs_update_entry(zealfs_t* fs, const zealfs_entry_t* entry);
+
+const char* zealfs_remove(zealfs_t* fs, const zealfs_entry_t* entry);
+
+const char* zealfs_flush(zealfs_t* fs);
+
+const char* zealfs_fsck(zealfs_t* fs, bool repair, zealfs_fsck_t* report);
+
+/* Host directories */
+const char* zealfs_import(zealfs_t* fs, const char* host_dir, const char* dest_path, const uint8_t date[8]);
+
+const char* zealfs_export(zealfs_t* fs, const char* src_path, const char* host_dir);
+
+const char* zealfs_sync(zealfs_t* fs, const char* host_dir, const char* dest_path, bool compare, zealfs_sync_t* stats);
+
+const char* zealfs_build_image(const char* host_dir, uint64_t size, const char* cache_dir,
+                               char* image_path, size_t path_len, bool* cached);
+
+const char* zealfs_resize_partition(zealfs_t* fs, uint64_t size, uint32_t* relocated);
+
+const char* zealfs_fragmentation(zealfs_t* fs, zealfs_frag_t* report);
+
+const char* zealfs_defrag(zealfs_t* fs, zealfs_defrag_t* report);
+
+/* Page size advisor */
+const char* zealfs_workload_add_files(zealfs_workload_t* workload, uint32_t size, uint32_t count);
+
+const char* zealfs_workload_add_dir(zealfs_workload_t* workload, uint32_t entries);
+
+const char* zealfs_workload_from_dir(zealfs_workload_t* workload, const char* host_dir);
+
+const char* zealfs_workload_from_histogram(zealfs_workload_t* workload, const char* path);
+
+void zealfs_workload_free(zealfs_workload_t* workload);
+
+int zealfs_advise(const zealfs_workload_t* workload, zealfs_advice_t* rows, int max_rows, int* recommended);
+
+/* Backups */
+const char* zealfs_backup(zealfs_t* fs, const char* path);
+
+const char* zealfs_restore(disk_handle_t* handle, const disk_info_t* disk, int partition, const char* path);
+
+#endif // ZEALFS_H
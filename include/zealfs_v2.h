@@ -7,7 +7,9 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include "log.h"
 
 #ifndef BIT
 #define BIT(X)  (1ULL << (X))
@@ -50,6 +52,121 @@ typedef struct {
 } __attribute__((packed)) ZealFSHeader;
 
 
+#define ZEALFS_NAME_MAX_LEN 16
+#define ZEALFS_IS_DIR       (1 << 0)
+#define ZEALFS_IS_OCCUPIED  (1 << 7)
+
+/* Type for the entries of a directory */
+typedef struct {
+  uint8_t  flags;
+  /* Not NULL-terminated if the name is ZEALFS_NAME_MAX_LEN characters long */
+  char     name[ZEALFS_NAME_MAX_LEN];
+  uint16_t start_page;
+  /* Size of the file in bytes, unused for directories */
+  uint32_t size;
+  /* Date of creation, in BCD: year (2 bytes), month, day, day of week, hours, minutes, seconds */
+  uint8_t  date[8];
+  uint8_t  reserved;
+} __attribute__((packed)) ZealFileEntry;
+
+
+/**
+ * @brief Get the size of the pages, in bytes, from the header.
+ */
+static inline uint32_t zealfsv2_page_bytes(const ZealFSHeader* header)
+{
+    return 256U << header->page_size;
+}
+
+
+/**
+ * @brief Get the number of pages tracked by the bitmap of the header.
+ */
+static inline uint32_t zealfsv2_page_count(const ZealFSHeader* header)
+{
+    return header->bitmap_size * 8U;
+}
+
+
+/**
+ * @brief Get the number of pages the FAT occupies, right after the first page.
+ */
+static inline uint32_t zealfsv2_fat_pages(const ZealFSHeader* header)
+{
+    return header->page_size == 0 ? 1 : 2;
+}
+
+
+/**
+ * @brief Get the number of entries in the FAT, each page that can be part of a chain has one.
+ */
+static inline uint32_t zealfsv2_fat_entries(const ZealFSHeader* header)
+{
+    const uint32_t entries = zealfsv2_fat_pages(header) * zealfsv2_page_bytes(header) / sizeof(uint16_t);
+    return entries < zealfsv2_page_count(header) ? entries : zealfsv2_page_count(header);
+}
+
+
+/**
+ * @brief Get the size of the header and the bitmap, the root directory entries follow them in the first page.
+ */
+static inline uint32_t zealfsv2_header_size(const ZealFSHeader* header)
+{
+    const uint32_t size = sizeof(ZealFSHeader) + header->bitmap_size;
+    return (size + sizeof(ZealFileEntry) - 1) / sizeof(ZealFileEntry) * sizeof(ZealFileEntry);
+}
+
+
+static inline uint32_t zealfsv2_root_max_entries(const ZealFSHeader* header)
+{
+    return (zealfsv2_page_bytes(header) - zealfsv2_header_size(header)) / sizeof(ZealFileEntry);
+}
+
+
+static inline uint32_t zealfsv2_dir_max_entries(const ZealFSHeader* header)
+{
+    return zealfsv2_page_bytes(header) / sizeof(ZealFileEntry);
+}
+
+
+/**
+ * @brief Find the first page, starting at `from`, which is used (or free if `used` is 0) in the bitmap.
+ * The bitmap is scanned 64 bits at a time.
+ *
+ * @return Index of the page found, `pages` if none.
+ */
+static inline uint32_t zealfsv2_bitmap_find(const uint8_t* bitmap, uint32_t pages, uint32_t from, int used)
+{
+    const uint32_t nbytes = (pages + 7) / 8;
+
+    while (from < pages) {
+        const uint32_t byte = from / 8;
+        const uint32_t len = (nbytes - byte) < 8 ? (nbytes - byte) : 8;
+        uint64_t word = 0;
+        memcpy(&word, bitmap + byte, len);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        if (!used) {
+            word = ~word;
+        }
+        word >>= from % 8;
+        /* Discard the bits that were not loaded from the bitmap */
+        const uint32_t valid = len * 8 - from % 8;
+        if (valid < 64) {
+            word &= (1ULL << valid) - 1;
+        }
+        if (word != 0) {
+            const uint32_t found = from + __builtin_ctzll(word);
+            return found < pages ? found : pages;
+        }
+        from += valid;
+    }
+
+    return pages;
+}
+
+
 /**
  * @brief Helper to get the recommended page size from a disk size.
  *
@@ -78,6 +195,36 @@ static inline int zealfsv2_page_size(long long part_size)
 }
 
 
+/**
+ * @brief Check whether the given header looks like a valid ZealFS v2 header, as created by `zealfsv2_format`.
+ *
+ * @param size When not NULL, populated with the size of the partition inferred from the header.
+ *
+ * @return 0 if the header is plausible, -1 else.
+ */
+static inline int zealfsv2_check_header(const ZealFSHeader* header, uint64_t* size)
+{
+    if (header->magic != 'Z' || header->version != 2 || header->page_size > 8 || header->bitmap_size == 0) {
+        return -1;
+    }
+    /* The partition sizes are powers of two, from 64KB to 4GB */
+    const uint64_t part_size = (uint64_t) zealfsv2_page_count(header) * zealfsv2_page_bytes(header);
+    if (part_size < 64*KB || part_size > 4*GB || (part_size & (part_size - 1)) != 0) {
+        return -1;
+    }
+    /* The page size is derived from the partition size, the header and the FAT are always allocated */
+    if (zealfsv2_page_size(part_size) != (int) zealfsv2_page_bytes(header) ||
+        header->free_pages >= zealfsv2_page_count(header) ||
+        (header->pages_bitmap[0] & 3) != 3) {
+        return -1;
+    }
+    if (size) {
+        *size = part_size;
+    }
+    return 0;
+}
+
+
 /**
  * @brief Format the partition.
  *
@@ -86,7 +233,7 @@ static inline int zealfsv2_page_size(long long part_size)
  *
  * @return 0 on success, error else
  */
-static int zealfsv2_format(uint8_t* partition, uint64_t size) {
+static inline int zealfsv2_format(uint8_t* partition, uint64_t size) {
     /* Initialize image header */
     ZealFSHeader* header = (ZealFSHeader*) partition;
     header->magic = 'Z';
@@ -103,12 +250,12 @@ static int zealfsv2_format(uint8_t* partition, uint64_t size) {
     /* All the pages are free (0), mark the first one as occupied */
     header->pages_bitmap[0] = 3 | ((fat_pages_count > 1) ? 4 : 0);
 
-    printf("[ZEALFS] Bitmap size: %d bytes\n", header->bitmap_size);
-    printf("[ZEALFS] Pages size: %d bytes (code %d)\n", page_size_bytes, ((page_size_bytes >> 8) - 1));
+    LOG_D("ZEALFS", "Bitmap size: %d bytes", header->bitmap_size);
+    LOG_D("ZEALFS", "Pages size: %d bytes (code %d)", page_size_bytes, ((page_size_bytes >> 8) - 1));
 #if 0
-    printf("[ZEALFS] Maximum root entries: %d\n", getRootDirMaxEntries(header));
-    printf("[ZEALFS] Maximum dir entries: %d\n", getDirMaxEntries(header));
-    printf("[ZEALFS] Header size/Root entries: %d (0x%x)\n", getFSHeaderSize(header), getFSHeaderSize(header));
+    LOG_D("ZEALFS", "Maximum root entries: %d", getRootDirMaxEntries(header));
+    LOG_D("ZEALFS", "Maximum dir entries: %d", getDirMaxEntries(header));
+    LOG_D("ZEALFS", "Header size/Root entries: %d (0x%x)", getFSHeaderSize(header), getFSHeaderSize(header));
 #endif
 
     return 0;
@@ -8,7 +8,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "disk.h"
+#include "disk_io.h"
+#include "job.h"
 #include "zealfs_v2.h"
+#include "log.h"
 
 static int disk_find_free_partition(disk_info_t* disk)
 {
@@ -21,6 +24,16 @@ static int disk_find_free_partition(disk_info_t* disk)
     return -1;
 }
 
+/**
+ * @brief Mark the partitions of the disk as changed. The counter is shared by all the disks so that a disk
+ * listed again in the same slot never gets the generation of the previous one.
+ */
+static void disk_bump_generation(disk_info_t* disk)
+{
+    static uint32_t generation = 0;
+    disk->generation = ++generation;
+}
+
 static void disk_write_mbr_entry(uint8_t *entry, const partition_t *part)
 {
     entry[0] = 0x00;
@@ -57,8 +70,9 @@ void disk_allocate_partition(disk_info_t *disk, uint32_t lba, int size_idx)
 
     partition_t* part = &disk->staged_partitions[disk->free_part_idx];
     assert(!part->active);
-    printf("[DISK] Allocating ZealFS in partition %d\n", disk->free_part_idx);
+    LOG_I("DISK", "Allocating ZealFS in partition %d", disk->free_part_idx);
     disk->has_staged_changes = true;
+    disk_bump_generation(disk);
     part->active = true;
     part->start_lba = lba;
     part->type = 0x5a;
@@ -77,19 +91,32 @@ void disk_allocate_partition(disk_info_t *disk, uint32_t lba, int size_idx)
     part->data_len = page_size * 3;
     part->data = calloc(3, page_size);
     if (part->data == NULL) {
-        printf("Could not allocate memory!\n");
+        LOG_E("DISK", "Could not allocate memory!");
         exit(1);
     } else {
-        printf("[DISK] Allocated %d bytes (3 pages)\n", 3*page_size);
+        LOG_D("DISK", "Allocated %d bytes (3 pages)", 3*page_size);
     }
     zealfsv2_format(part->data, part_size_bytes);
-    printf("[DISK] Partition %d data: %p, length: %d\n", disk->free_part_idx, part->data, part->data_len);
+    LOG_D("DISK", "Partition %d data: %p, length: %d", disk->free_part_idx, part->data, part->data_len);
 
     /* Reuse the free partition index */
     disk->free_part_idx = disk_find_free_partition(disk);
 }
 
 
+/**
+ * @brief Forget the source of a staged clone, freeing it when the partition owns it.
+ */
+static void disk_clear_clone_src(partition_t* part)
+{
+    if (part->clone_src_owned) {
+        free((void*) part->clone_src);
+        part->clone_src_owned = false;
+    }
+    part->clone_src = NULL;
+}
+
+
 void disk_delete_partition(disk_info_t* disk, int partition)
 {
     if (partition < 0 || partition >= MAX_PART_COUNT) {
@@ -99,11 +126,13 @@ void disk_delete_partition(disk_info_t* disk, int partition)
     partition_t* part = &disk->staged_partitions[partition];
     if (part->active) {
         disk->has_staged_changes = true;
-        printf("[DISK] Deleting partition %d\n", partition);
+        disk_bump_generation(disk);
+        LOG_I("DISK", "Deleting partition %d", partition);
         part->active = false;
         part->data_len = 0;
         free(part->data);
         part->data = NULL;
+        disk_clear_clone_src(part);
         /* If the disk has no free partition, the current one is free now! */
         if (disk->free_part_idx == -1) {
             disk->free_part_idx = partition;
@@ -119,6 +148,7 @@ static void disk_free_staged_partitions_data(disk_info_t* disk)
         free(disk->staged_partitions[i].data);
         disk->staged_partitions[i].data = NULL;
         disk->staged_partitions[i].data_len = 0;
+        disk_clear_clone_src(&disk->staged_partitions[i]);
     }
 }
 
@@ -136,6 +166,7 @@ void disk_revert_changes(disk_info_t* disk)
 
     /* Create a mirror for the RAM changes */
     disk->has_staged_changes = false;
+    disk_bump_generation(disk);
     memcpy(disk->staged_mbr, disk->mbr, sizeof(disk->mbr));
     memcpy(disk->staged_partitions, disk->partitions, sizeof(disk->partitions));
     /* Make sure to call the function AFTER restoring the stages partitions */
@@ -146,6 +177,7 @@ void disk_revert_changes(disk_info_t* disk)
 void disk_apply_changes(disk_info_t* disk)
 {
     disk->has_staged_changes = false;
+    disk_bump_generation(disk);
     /* Before copying the staged partitions as the real partitions, make sure to
      * free the pointers and sizes (since they have been copied to the disk) */
     disk_free_staged_partitions_data(disk);
@@ -217,6 +249,7 @@ void disk_parse_mbr_partitions(disk_info_t *disk)
     }
     /* Create a mirror for the RAM changes */
     disk->has_staged_changes = false;
+    disk_bump_generation(disk);
     disk->free_part_idx = free_part_idx;
     memcpy(disk->staged_mbr, disk->mbr, sizeof(disk->mbr));
     memcpy(disk->staged_partitions, disk->partitions, sizeof(disk->partitions));
@@ -312,9 +345,9 @@ const char* const *disk_get_partition_size_list(void)
 
 
 /**
- * @brief Get the number of valid entries for a new partition
+ * @brief Get the largest free space on the disk, in sectors, once its start address is aligned.
  */
-int disk_valid_partition_size(disk_info_t *disk, uint32_t *largest_free_lba)
+uint32_t disk_aligned_free_space(disk_info_t *disk, uint32_t *largest_free_lba)
 {
     const uint32_t free_sectors = disk_largest_free_space(disk, largest_free_lba);
     if (free_sectors == 0) {
@@ -334,6 +367,19 @@ int disk_valid_partition_size(disk_info_t *disk, uint32_t *largest_free_lba)
         }
     }
     *largest_free_lba = aligned_lba_address;
+    return aligned_lba_sectors;
+}
+
+
+/**
+ * @brief Get the number of valid entries for a new partition
+ */
+int disk_valid_partition_size(disk_info_t *disk, uint32_t *largest_free_lba)
+{
+    const uint32_t aligned_lba_sectors = disk_aligned_free_space(disk, largest_free_lba);
+    if (aligned_lba_sectors == 0) {
+        return 0;
+    }
 
     const uint64_t free_space = aligned_lba_sectors * DISK_SECTOR_SIZE;
     const uint64_t sizes[] = {
@@ -351,3 +397,389 @@ int disk_valid_partition_size(disk_info_t *disk, uint32_t *largest_free_lba)
     return -1;
 }
 
+
+/**
+ * @brief Stage a copy of the ZealFS partition `src_part` from the disk `src` into a new partition
+ * of `disk`, at address `lba`. The content is only copied when the changes are written.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_clone_partition(disk_info_t *disk, uint32_t lba, const disk_info_t *src, int src_part)
+{
+    if (src_part < 0 || src_part >= MAX_PART_COUNT) {
+        return "Invalid source partition";
+    }
+
+    /* Only committed partitions can be cloned, the staged ones are not on the disk yet */
+    const partition_t* src_p = &src->partitions[src_part];
+    if (!src_p->active || src_p->type != 0x5a) {
+        return "Source partition is not a ZealFS partition";
+    }
+    if (disk->free_part_idx == -1) {
+        return "No free partition found on this disk";
+    }
+    /* When cloning within the same disk, the source must not be deleted or replaced by the staged changes */
+    if (src == disk) {
+        const partition_t* staged = &disk->staged_partitions[src_part];
+        if (!staged->active || staged->start_lba != src_p->start_lba || staged->data != NULL || staged->clone_src != NULL) {
+            return "Source partition has pending changes";
+        }
+    }
+    uint32_t free_lba = 0;
+    const uint32_t free_sectors = disk_aligned_free_space(disk, &free_lba);
+    if (free_lba != lba || free_sectors < src_p->size_sectors) {
+        return "Not enough free space on the disk";
+    }
+
+    partition_t* part = &disk->staged_partitions[disk->free_part_idx];
+    assert(!part->active && part->data == NULL);
+    LOG_I("DISK", "Cloning %s partition %d in partition %d", src->name, src_part, disk->free_part_idx);
+    disk->has_staged_changes = true;
+    disk_bump_generation(disk);
+    part->active = true;
+    part->start_lba = lba;
+    part->type = src_p->type;
+    part->size_sectors = src_p->size_sectors;
+    part->clone_src = src;
+    part->clone_src_part = src_part;
+    part->clone_src_lba = src_p->start_lba;
+    part->clone_src_sectors = src_p->size_sectors;
+
+    uint8_t *entry = &disk->staged_mbr[MBR_PART_ENTRY_BEGIN + disk->free_part_idx * MBR_PART_ENTRY_SIZE];
+    disk_write_mbr_entry(entry, part);
+
+    disk->free_part_idx = disk_find_free_partition(disk);
+    return NULL;
+}
+
+
+/**
+ * @brief Stage a new size for the committed partition `partition`, which keeps its start address.
+ * Only the MBR entry changes, the content of the partition must be resized separately.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_resize_partition(disk_info_t* disk, int partition, uint32_t size_sectors)
+{
+    if (partition < 0 || partition >= MAX_PART_COUNT || !disk->partitions[partition].active) {
+        return "Invalid partition";
+    }
+    if (!disk->has_mbr) {
+        return "The disk has no partition table";
+    }
+    if (disk->has_staged_changes) {
+        return "Apply or cancel the pending changes first";
+    }
+
+    partition_t* part = &disk->staged_partitions[partition];
+    const uint64_t new_end = (uint64_t) part->start_lba + size_sectors;
+    if (new_end * DISK_SECTOR_SIZE > disk->size_bytes) {
+        return "Not enough space after the partition";
+    }
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* other = &disk->staged_partitions[i];
+        if (i != partition && other->active && other->start_lba < new_end &&
+            part->start_lba < (uint64_t) other->start_lba + other->size_sectors) {
+            return "Not enough space after the partition";
+        }
+    }
+
+    LOG_I("DISK", "Resizing partition %d to %u sectors", partition, size_sectors);
+    disk->has_staged_changes = true;
+    disk_bump_generation(disk);
+    part->size_sectors = size_sectors;
+    uint8_t *entry = &disk->staged_mbr[MBR_PART_ENTRY_BEGIN + partition * MBR_PART_ENTRY_SIZE];
+    disk_write_mbr_entry(entry, part);
+    return NULL;
+}
+
+
+/**
+ * @brief Stage a copy of the ZealFS partition image file at `path` into a new partition of `disk`,
+ * at address `lba`. The description of the image belongs to the new partition, so several images
+ * can be pending on any disks at the same time.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_clone_image(disk_info_t *disk, uint32_t lba, const char* path, uint64_t size)
+{
+    disk_info_t* image = malloc(sizeof(disk_info_t));
+    if (image == NULL) {
+        return "Could not allocate memory for the image";
+    }
+    disk_image_info(image, path, size);
+
+    const int partition = disk->free_part_idx;
+    const char* err = disk_clone_partition(disk, lba, image, 0);
+    if (err) {
+        free(image);
+        return err;
+    }
+    disk->staged_partitions[partition].clone_src_owned = true;
+    return NULL;
+}
+
+
+/**
+ * @brief Describe a raw ZealFS partition image file as a disk holding a single committed partition at LBA 0.
+ * The backends access image files like any disk, so such an image can be mounted or cloned to a disk.
+ */
+void disk_image_info(disk_info_t* info, const char* path, uint64_t size)
+{
+    memset(info, 0, sizeof(disk_info_t));
+    const char* name = strrchr(path, '/');
+    snprintf(info->name, sizeof(info->name), "%s", name ? name + 1 : path);
+    snprintf(info->path, sizeof(info->path), "%s", path);
+    info->size_bytes = size;
+    info->partitions[0] = (partition_t) {
+        .active       = true,
+        .type         = 0x5a,
+        .start_lba    = 0,
+        .size_sectors = (uint32_t) (size / DISK_SECTOR_SIZE),
+    };
+    memcpy(info->staged_partitions, info->partitions, sizeof(info->partitions));
+    info->free_part_idx = -1;
+}
+
+
+/**
+ * @brief Stage an MBR entry for a partition found by the recovery scan. The content of the
+ * partition is left untouched.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_recover_partition(disk_info_t* disk, const recovered_part_t* found)
+{
+    if (disk->free_part_idx == -1) {
+        return "No free partition found on this disk";
+    }
+
+    const uint64_t found_end = (uint64_t) found->start_lba + found->size_sectors;
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* part = &disk->staged_partitions[i];
+        const uint64_t part_end = (uint64_t) part->start_lba + part->size_sectors;
+        if (part->active && found->start_lba < part_end && part->start_lba < found_end) {
+            return "Partition overlaps an existing partition";
+        }
+    }
+
+    const int idx = disk->free_part_idx;
+    partition_t* part = &disk->staged_partitions[idx];
+    assert(!part->active && part->data == NULL);
+    LOG_I("DISK", "Recovering ZealFS @ LBA %u in partition %d", found->start_lba, idx);
+    disk->has_staged_changes = true;
+    disk_bump_generation(disk);
+    part->active = true;
+    part->type = 0x5a;
+    part->start_lba = found->start_lba;
+    part->size_sectors = found->size_sectors;
+
+    uint8_t *entry = &disk->staged_mbr[MBR_PART_ENTRY_BEGIN + idx * MBR_PART_ENTRY_SIZE];
+    disk_write_mbr_entry(entry, part);
+
+    disk->free_part_idx = disk_find_free_partition(disk);
+    return NULL;
+}
+
+/**
+ * @brief Copy the used pages of the source ZealFS partition to the staged partition `part`.
+ */
+static const char* disk_write_clone(disk_handle_t* dst, const partition_t* part)
+{
+    static _Thread_local char error_msg[1024];
+    const disk_info_t* src_disk = part->clone_src;
+    const partition_t* src = &src_disk->partitions[part->clone_src_part];
+    const uint64_t src_base = (uint64_t) part->clone_src_lba * DISK_SECTOR_SIZE;
+    const uint64_t dst_base = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+    const uint64_t part_size = (uint64_t) part->clone_src_sectors * DISK_SECTOR_SIZE;
+    disk_handle_t* handle = NULL;
+    uint8_t* header_page = NULL;
+    disk_copy_t* extents = NULL;
+
+    /* The source disk may have been modified and applied since the clone was staged */
+    if (!src->active || src->start_lba != part->clone_src_lba || src->size_sectors != part->clone_src_sectors) {
+        snprintf(error_msg, sizeof(error_msg), "%s partition %d changed since the clone was staged\n",
+                 src_disk->name, part->clone_src_part);
+        return error_msg;
+    }
+
+    const char* err = disk_open(src_disk, false, &handle);
+    if (err) {
+        return err;
+    }
+
+    /* The header and the bitmap are both in the first page, check the page size first */
+    uint8_t sector[DISK_SECTOR_SIZE];
+    err = disk_read(handle, src_base, sector, sizeof(sector));
+    if (err) {
+        goto end;
+    }
+    const ZealFSHeader* header = (const ZealFSHeader*) sector;
+    if (header->magic != 'Z' || header->version != 2 || header->page_size > 8) {
+        snprintf(error_msg, sizeof(error_msg), "%s partition %d is not a valid ZealFSv2 partition\n",
+                 src_disk->name, part->clone_src_part);
+        err = error_msg;
+        goto end;
+    }
+    const uint32_t page_bytes = zealfsv2_page_bytes(header);
+    header_page = malloc(page_bytes);
+    if (header_page == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory!\n");
+        err = error_msg;
+        goto end;
+    }
+    err = disk_read(handle, src_base, header_page, page_bytes);
+    if (err) {
+        goto end;
+    }
+    header = (const ZealFSHeader*) header_page;
+
+    /* Only copy the runs of used pages, the other ones are free, their content doesn't matter */
+    const uint32_t pages = MIN(zealfsv2_page_count(header), part_size / page_bytes);
+    extents = malloc(sizeof(disk_copy_t) * (pages / 2 + 1));
+    if (extents == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory!\n");
+        err = error_msg;
+        goto end;
+    }
+    int count = 0;
+    uint64_t total = 0;
+    uint32_t page = zealfsv2_bitmap_find(header->pages_bitmap, pages, 0, 1);
+    while (page < pages) {
+        const uint32_t end = zealfsv2_bitmap_find(header->pages_bitmap, pages, page, 0);
+        extents[count++] = (disk_copy_t) {
+            .src_offset = src_base + (uint64_t) page * page_bytes,
+            .dst_offset = dst_base + (uint64_t) page * page_bytes,
+            .len        = (uint64_t) (end - page) * page_bytes,
+        };
+        total += (uint64_t) (end - page) * page_bytes;
+        page = zealfsv2_bitmap_find(header->pages_bitmap, pages, end, 1);
+    }
+
+    LOG_I("DISK", "Cloning %d extents, %llu bytes out of %llu", count,
+          (unsigned long long) total, (unsigned long long) part_size);
+    job_add_total(total);
+    /* Only rewrite the pages that differ, re-cloning a partition on the same card is then almost free */
+    err = disk_io_copy(handle, dst, extents, count, MAX(page_bytes, DISK_SECTOR_SIZE));
+
+end:
+    free(extents);
+    free(header_page);
+    disk_close(handle);
+    return err;
+}
+
+
+/**
+ * @brief Read the current content of the MBR and of the formatted partitions in a single batch.
+ * The buffers are laid out in `current` in this order: MBR first, then each formatted partition.
+ *
+ * @return Buffer containing the current content, NULL if it could not be read. Must be freed by the caller.
+ */
+static uint8_t* disk_read_current(disk_handle_t* handle, const disk_info_t* disk)
+{
+    disk_io_req_t reqs[MAX_PART_COUNT + 1];
+    uint32_t total = DISK_SECTOR_SIZE;
+    int count = 0;
+
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* part = &disk->staged_partitions[i];
+        if (part->data != NULL && part->data_len != 0) {
+            total += part->data_len;
+        }
+    }
+
+    uint8_t* current = malloc(total);
+    if (current == NULL) {
+        /* Not fatal, everything will be written */
+        return NULL;
+    }
+
+    reqs[count++] = (disk_io_req_t) { .offset = 0, .len = DISK_SECTOR_SIZE, .data = current };
+    uint8_t* next = current + DISK_SECTOR_SIZE;
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* part = &disk->staged_partitions[i];
+        if (part->data != NULL && part->data_len != 0) {
+            reqs[count++] = (disk_io_req_t) {
+                .offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE,
+                .len    = part->data_len,
+                .data   = next,
+            };
+            next += part->data_len;
+        }
+    }
+
+    if (disk_io_read_batch(handle, reqs, count) != NULL) {
+        free(current);
+        return NULL;
+    }
+    return current;
+}
+
+
+/**
+ * @brief Write the staged changes to the disk. On success, the caller must call
+ * `disk_apply_changes` to make the staged changes the current state of the disk.
+ * The current content of the disk is read first, only the pages that differ from it are written.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_write_changes(disk_info_t* disk)
+{
+    assert(disk);
+    assert(disk->has_mbr);
+    assert(disk->has_staged_changes);
+
+    disk_handle_t* handle = NULL;
+    const char* err = disk_open(disk, true, &handle);
+    if (err) {
+        return err;
+    }
+
+    uint8_t* current = disk_read_current(handle, disk);
+
+    /* Write MBR */
+    if (current != NULL && memcmp(current, disk->staged_mbr, DISK_SECTOR_SIZE) == 0) {
+        LOG_I("DISK", "MBR is already up to date");
+    } else {
+        err = disk_write(handle, 0, disk->staged_mbr, sizeof(disk->staged_mbr));
+        if (err) {
+            goto end;
+        }
+    }
+
+    /* Write any new partition */
+    const uint8_t* cur = current ? current + DISK_SECTOR_SIZE : NULL;
+    for (int i = 0; i < MAX_PART_COUNT && err == NULL; i++) {
+        const partition_t* part = &disk->staged_partitions[i];
+        const uint64_t part_offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+        if (part->data != NULL && part->data_len != 0) {
+            if (cur != NULL) {
+                /* Only write the pages that differ from the current content, nothing if they all match */
+                uint32_t written = 0;
+                const uint32_t block = MAX(zealfsv2_page_bytes((const ZealFSHeader*) part->data), DISK_SECTOR_SIZE);
+                err = disk_io_write_diff(handle, part_offset, part->data, cur, part->data_len, block, &written);
+                if (written == 0 && err == NULL) {
+                    LOG_I("DISK", "Partition %d is already up to date", i);
+                } else {
+                    LOG_I("DISK", "Writing partition %d @ %08llx, %d/%d bytes", i,
+                          (unsigned long long) part_offset, written, part->data_len);
+                }
+            } else {
+                LOG_I("DISK", "Writing partition %d @ %08llx, %d bytes", i, (unsigned long long) part_offset, part->data_len);
+                err = disk_write(handle, part_offset, part->data, part->data_len);
+            }
+            cur = cur ? cur + part->data_len : NULL;
+        } else if (part->active && part->clone_src != NULL) {
+            LOG_I("DISK", "Cloning partition %d @ %08llx", i, (unsigned long long) part_offset);
+            err = disk_write_clone(handle, part);
+        } else {
+            LOG_I("DISK", "Partition %d has no changes", i);
+        }
+    }
+
+end:
+    free(current);
+    disk_close(handle);
+    return err;
+}
@@ -0,0 +1,297 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "disk_cache.h"
+#include "log.h"
+
+#define NO_BLOCK    UINT64_MAX
+
+typedef struct {
+    uint64_t block;
+    /* Value of the cache tick when the block was last accessed, the smallest one is replaced first */
+    uint64_t last_use;
+    uint8_t* data;
+} cache_slot_t;
+
+struct disk_cache_t {
+    disk_handle_t*  handle;
+    uint64_t        size;
+    pthread_t       reader;
+    uint8_t*        buffers;
+    /* Protects everything below, never held during a disk access */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    bool            stop;
+    uint64_t        tick;
+    cache_slot_t    slots[DISK_CACHE_BLOCKS];
+    /* Buffer the reader fills, swapped with the buffer of the slot it replaces */
+    uint8_t*        spare;
+    /* The first block is read first, the readahead requests are queued at the end */
+    uint64_t        queue[DISK_CACHE_QUEUE];
+    int             queued;
+    uint64_t        reading;
+    /* Only the first failed read is reported, the failed blocks are not requested again.
+     * When the array is full, the oldest failure is forgotten */
+    uint64_t        failed[DISK_CACHE_FAILED];
+    int             failed_count;
+    int             failed_next;
+    char            error[256];
+};
+
+
+static cache_slot_t* cache_find(disk_cache_t* cache, uint64_t block)
+{
+    for (int i = 0; i < DISK_CACHE_BLOCKS; i++) {
+        if (cache->slots[i].block == block) {
+            return &cache->slots[i];
+        }
+    }
+    return NULL;
+}
+
+
+static bool cache_wanted(disk_cache_t* cache, uint64_t block)
+{
+    if (block == cache->reading || cache_find(cache, block) != NULL) {
+        return false;
+    }
+    for (int i = 0; i < cache->queued; i++) {
+        if (cache->queue[i] == block) {
+            return false;
+        }
+    }
+    for (int i = 0; i < cache->failed_count; i++) {
+        if (cache->failed[i] == block) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Queue the read of a block that is neither cached nor queued. Urgent blocks are read before all the
+ * others, the other ones are dropped when the queue is full.
+ */
+static void cache_request(disk_cache_t* cache, uint64_t block, bool urgent)
+{
+    if (block * DISK_CACHE_BLOCK_SIZE >= cache->size || !cache_wanted(cache, block)) {
+        return;
+    }
+    if (urgent) {
+        /* The last request is dropped if the queue is full, it's the oldest readahead if any */
+        const int count = MIN(cache->queued, DISK_CACHE_QUEUE - 1);
+        memmove(&cache->queue[1], &cache->queue[0], sizeof(uint64_t) * count);
+        cache->queue[0] = block;
+        cache->queued = count + 1;
+    } else if (cache->queued < DISK_CACHE_QUEUE) {
+        cache->queue[cache->queued++] = block;
+    } else {
+        return;
+    }
+    pthread_cond_signal(&cache->cond);
+}
+
+
+static void* cache_reader(void* arg)
+{
+    disk_cache_t* cache = (disk_cache_t*) arg;
+
+    pthread_mutex_lock(&cache->lock);
+    while (!cache->stop) {
+        if (cache->queued == 0) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+            continue;
+        }
+        const uint64_t block = cache->queue[0];
+        cache->queued--;
+        memmove(&cache->queue[0], &cache->queue[1], sizeof(uint64_t) * cache->queued);
+        cache->reading = block;
+        pthread_mutex_unlock(&cache->lock);
+
+        const uint64_t offset = block * DISK_CACHE_BLOCK_SIZE;
+        const uint32_t len = (uint32_t) MIN(DISK_CACHE_BLOCK_SIZE, cache->size - offset);
+        const char* err = disk_read(cache->handle, offset, cache->spare, len);
+
+        pthread_mutex_lock(&cache->lock);
+        cache->reading = NO_BLOCK;
+        if (err) {
+            /* The message belongs to this thread, keep a copy for the UI */
+            if (cache->error[0] == 0) {
+                snprintf(cache->error, sizeof(cache->error), "%s", err);
+            }
+            cache->failed[cache->failed_next] = block;
+            cache->failed_next = (cache->failed_next + 1) % DISK_CACHE_FAILED;
+            cache->failed_count = MIN(cache->failed_count + 1, DISK_CACHE_FAILED);
+            LOG_W("DISK", "%s", err);
+            continue;
+        }
+        cache_slot_t* victim = &cache->slots[0];
+        for (int i = 1; i < DISK_CACHE_BLOCKS; i++) {
+            if (cache->slots[i].last_use < victim->last_use) {
+                victim = &cache->slots[i];
+            }
+        }
+        uint8_t* data = victim->data;
+        victim->data = cache->spare;
+        victim->block = block;
+        victim->last_use = ++cache->tick;
+        cache->spare = data;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+}
+
+
+/**
+ * @brief Open a disk for reading through a cache of aligned blocks, filled by a background thread.
+ */
+const char* disk_cache_open(const disk_info_t* disk, disk_cache_t** out_cache)
+{
+    static _Thread_local char error_msg[256];
+
+    disk_cache_t* cache = calloc(1, sizeof(disk_cache_t));
+    uint8_t* buffers = malloc((size_t) (DISK_CACHE_BLOCKS + 1) * DISK_CACHE_BLOCK_SIZE);
+    if (cache == NULL || buffers == NULL) {
+        free(buffers);
+        free(cache);
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the sector cache\n");
+        return error_msg;
+    }
+    const char* err = disk_open(disk, false, &cache->handle);
+    if (err) {
+        free(buffers);
+        free(cache);
+        return err;
+    }
+
+    cache->size = disk->size_bytes;
+    cache->buffers = buffers;
+    cache->reading = NO_BLOCK;
+    for (int i = 0; i < DISK_CACHE_BLOCKS; i++) {
+        cache->slots[i] = (cache_slot_t) {
+            .block = NO_BLOCK,
+            .data  = buffers + (size_t) i * DISK_CACHE_BLOCK_SIZE,
+        };
+    }
+    cache->spare = buffers + (size_t) DISK_CACHE_BLOCKS * DISK_CACHE_BLOCK_SIZE;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->cond, NULL);
+
+    if (pthread_create(&cache->reader, NULL, cache_reader, cache) != 0) {
+        disk_close(cache->handle);
+        free(buffers);
+        free(cache);
+        snprintf(error_msg, sizeof(error_msg), "Could not create the sector cache thread\n");
+        return error_msg;
+    }
+    *out_cache = cache;
+    return NULL;
+}
+
+
+/**
+ * @brief Stop the reader, once its current access is over, and close the disk.
+ */
+void disk_cache_close(disk_cache_t* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    cache->stop = true;
+    pthread_cond_signal(&cache->cond);
+    pthread_mutex_unlock(&cache->lock);
+    pthread_join(cache->reader, NULL);
+
+    free(cache->buffers);
+    disk_close(cache->handle);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->cond);
+    free(cache);
+}
+
+
+/**
+ * @brief Copy bytes of the disk from the cache without ever waiting for the disk. The blocks that are not
+ * cached are queued to be read before any other block.
+ *
+ * @return true if all the bytes were cached and copied to `buffer`, false if any is missing.
+ */
+bool disk_cache_read(disk_cache_t* cache, uint64_t offset, void* buffer, uint32_t len)
+{
+    uint8_t* dst = buffer;
+    bool complete = true;
+
+    pthread_mutex_lock(&cache->lock);
+    while (len > 0) {
+        const uint64_t block = offset / DISK_CACHE_BLOCK_SIZE;
+        const uint32_t in_block = (uint32_t) (offset % DISK_CACHE_BLOCK_SIZE);
+        const uint32_t count = MIN(len, DISK_CACHE_BLOCK_SIZE - in_block);
+        cache_slot_t* slot = cache_find(cache, block);
+        if (slot != NULL) {
+            slot->last_use = ++cache->tick;
+            memcpy(dst, slot->data + in_block, count);
+        } else {
+            cache_request(cache, block, true);
+            complete = false;
+        }
+        dst += count;
+        offset += count;
+        len -= count;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return complete;
+}
+
+
+/**
+ * @brief Queue the blocks following the one at `offset`, when going forward, or preceding it, when going
+ * backward, so that they are cached before they are shown.
+ *
+ * @param direction Positive to read the next blocks, negative to read the previous ones.
+ */
+void disk_cache_readahead(disk_cache_t* cache, uint64_t offset, int direction)
+{
+    const uint64_t block = offset / DISK_CACHE_BLOCK_SIZE;
+
+    pthread_mutex_lock(&cache->lock);
+    for (uint64_t i = 1; i <= DISK_CACHE_READAHEAD; i++) {
+        if (direction >= 0) {
+            cache_request(cache, block + i, false);
+        } else if (block >= i) {
+            cache_request(cache, block - i, false);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+
+/**
+ * @brief Check whether blocks are being read or waiting to be read.
+ */
+bool disk_cache_busy(disk_cache_t* cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    const bool busy = cache->queued > 0 || cache->reading != NO_BLOCK;
+    pthread_mutex_unlock(&cache->lock);
+    return busy;
+}
+
+
+/**
+ * @brief Get the error of the first read that failed, NULL if none did. The message is never modified once set.
+ */
+const char* disk_cache_error(disk_cache_t* cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    const char* err = cache->error[0] ? cache->error : NULL;
+    pthread_mutex_unlock(&cache->lock);
+    return err;
+}
@@ -0,0 +1,348 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "disk_io.h"
+#include "job.h"
+#include "log.h"
+
+typedef struct {
+    uint64_t dst_offset;
+    uint32_t len;
+    uint8_t* data;
+} copy_slot_t;
+
+typedef struct {
+    disk_handle_t*      src;
+    const disk_copy_t*  extents;
+    int                 count;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    copy_slot_t         slots[DISK_IO_SLOTS];
+    /* Number of slots filled by the reader and emptied by the writer */
+    uint64_t            produced;
+    uint64_t            consumed;
+    bool                reader_done;
+    bool                abort;
+    const char*         error;
+    /* The reader's own error messages don't outlive its thread, keep a copy */
+    char                reader_error[256];
+} copy_pipeline_t;
+
+
+static int disk_io_req_cmp(const void* a, const void* b)
+{
+    const disk_io_req_t* ra = (const disk_io_req_t*) a;
+    const disk_io_req_t* rb = (const disk_io_req_t*) b;
+    return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+
+/**
+ * @brief Read all the requests of a batch. The requests are sorted by offset and the ones that are
+ * close to each other are merged into a single read, up to DISK_IO_CHUNK_SIZE bytes.
+ * Note that `reqs` is sorted in place.
+ */
+const char* disk_io_read_batch(disk_handle_t* handle, disk_io_req_t* reqs, int count)
+{
+    static _Thread_local char error_msg[256];
+    const char* err = NULL;
+    uint8_t* bounce = NULL;
+
+    qsort(reqs, count, sizeof(disk_io_req_t), disk_io_req_cmp);
+
+    for (int i = 0; i < count && err == NULL; ) {
+        const uint64_t start = reqs[i].offset;
+        uint64_t end = start + reqs[i].len;
+        int j = i + 1;
+        while (j < count && reqs[j].offset <= end + DISK_IO_MERGE_GAP &&
+               MAX(end, reqs[j].offset + reqs[j].len) - start <= DISK_IO_CHUNK_SIZE) {
+            end = MAX(end, reqs[j].offset + reqs[j].len);
+            j++;
+        }
+
+        if (j == i + 1) {
+            err = disk_read(handle, start, reqs[i].data, reqs[i].len);
+        } else {
+            if (bounce == NULL) {
+                bounce = malloc(DISK_IO_CHUNK_SIZE);
+                if (bounce == NULL) {
+                    snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the batch\n");
+                    return error_msg;
+                }
+            }
+            err = disk_read(handle, start, bounce, (uint32_t) (end - start));
+            for (int k = i; k < j && err == NULL; k++) {
+                memcpy(reqs[k].data, bounce + (reqs[k].offset - start), reqs[k].len);
+            }
+        }
+        i = j;
+    }
+
+    free(bounce);
+    return err;
+}
+
+
+/**
+ * @brief Write all the requests of a batch, in LBA order. Contiguous requests are merged into a single
+ * write, up to DISK_IO_CHUNK_SIZE bytes. The requests must not overlap, `reqs` is sorted in place.
+ */
+const char* disk_io_write_batch(disk_handle_t* handle, disk_io_req_t* reqs, int count)
+{
+    static _Thread_local char error_msg[256];
+    const char* err = NULL;
+    uint8_t* bounce = NULL;
+
+    qsort(reqs, count, sizeof(disk_io_req_t), disk_io_req_cmp);
+
+    for (int i = 0; i < count && err == NULL; ) {
+        const uint64_t start = reqs[i].offset;
+        uint64_t end = start + reqs[i].len;
+        int j = i + 1;
+        while (j < count && reqs[j].offset == end && end + reqs[j].len - start <= DISK_IO_CHUNK_SIZE) {
+            end += reqs[j].len;
+            j++;
+        }
+
+        if (j == i + 1) {
+            err = disk_write(handle, start, reqs[i].data, reqs[i].len);
+        } else {
+            if (bounce == NULL) {
+                bounce = malloc(DISK_IO_CHUNK_SIZE);
+                if (bounce == NULL) {
+                    snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the batch\n");
+                    return error_msg;
+                }
+            }
+            for (int k = i; k < j; k++) {
+                memcpy(bounce + (reqs[k].offset - start), reqs[k].data, reqs[k].len);
+            }
+            err = disk_write(handle, start, bounce, (uint32_t) (end - start));
+        }
+        i = j;
+    }
+
+    free(bounce);
+    return err;
+}
+
+
+/**
+ * @brief Hash the given data (64-bit FNV-1a), used to detect whether a region needs to be written.
+ */
+uint64_t disk_io_hash(const void* data, uint64_t len)
+{
+    return disk_io_hash_update(DISK_IO_HASH_INIT, data, len);
+}
+
+
+/**
+ * @brief Continue a hash started with DISK_IO_HASH_INIT, to hash data that isn't contiguous in memory.
+ */
+uint64_t disk_io_hash_update(uint64_t hash, const void* data, uint64_t len)
+{
+    const uint8_t* bytes = (const uint8_t*) data;
+    for (uint64_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+
+/**
+ * @brief Write `data` at `offset`, knowing that the disk currently contains `current`.
+ * Both are compared `block` bytes at a time and only the blocks that differ are written, neighbouring
+ * dirty blocks are merged into a single write. `block` must be a multiple of DISK_SECTOR_SIZE.
+ *
+ * @param written When not NULL, populated with the number of bytes actually written.
+ */
+const char* disk_io_write_diff(disk_handle_t* handle, uint64_t offset, const uint8_t* data,
+                               const uint8_t* current, uint32_t len, uint32_t block, uint32_t* written)
+{
+    uint32_t total = 0;
+    uint32_t pos = 0;
+
+    assert(block != 0);
+    while (pos < len) {
+        /* Skip the clean blocks */
+        while (pos < len && memcmp(data + pos, current + pos, MIN(block, len - pos)) == 0) {
+            pos += MIN(block, len - pos);
+        }
+        if (pos == len) {
+            break;
+        }
+        /* Extend the run as long as the blocks are dirty */
+        uint32_t end = pos + MIN(block, len - pos);
+        while (end < len && memcmp(data + end, current + end, MIN(block, len - end)) != 0) {
+            end += MIN(block, len - end);
+        }
+        const char* err = disk_write(handle, offset + pos, data + pos, end - pos);
+        if (err) {
+            return err;
+        }
+        total += end - pos;
+        pos = end;
+    }
+
+    if (written) {
+        *written = total;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Reader side of the pipeline: fill the free slots with the source data, chunk by chunk.
+ */
+static void* disk_io_reader(void* arg)
+{
+    copy_pipeline_t* pipe = (copy_pipeline_t*) arg;
+    const char* err = NULL;
+
+    for (int i = 0; i < pipe->count && err == NULL; i++) {
+        const disk_copy_t* ext = &pipe->extents[i];
+
+        for (uint64_t done = 0; done < ext->len; ) {
+            const uint32_t len = (uint32_t) MIN(ext->len - done, DISK_IO_CHUNK_SIZE);
+
+            /* Wait for a free slot */
+            pthread_mutex_lock(&pipe->lock);
+            while (!pipe->abort && pipe->produced - pipe->consumed == DISK_IO_SLOTS) {
+                pthread_cond_wait(&pipe->cond, &pipe->lock);
+            }
+            const bool abort = pipe->abort;
+            pthread_mutex_unlock(&pipe->lock);
+            if (abort) {
+                goto end;
+            }
+
+            /* The slot is owned by the reader until `produced` is incremented */
+            copy_slot_t* slot = &pipe->slots[pipe->produced % DISK_IO_SLOTS];
+            err = disk_read(pipe->src, ext->src_offset + done, slot->data, len);
+            if (err) {
+                break;
+            }
+            slot->dst_offset = ext->dst_offset + done;
+            slot->len = len;
+            done += len;
+
+            pthread_mutex_lock(&pipe->lock);
+            pipe->produced++;
+            pthread_cond_broadcast(&pipe->cond);
+            pthread_mutex_unlock(&pipe->lock);
+        }
+    }
+
+end:
+    pthread_mutex_lock(&pipe->lock);
+    if (err && pipe->error == NULL) {
+        snprintf(pipe->reader_error, sizeof(pipe->reader_error), "%s", err);
+        pipe->error = pipe->reader_error;
+    }
+    pipe->reader_done = true;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+
+/**
+ * @brief Copy the given extents from `src` to `dst`. Reading and writing are overlapped:
+ * a reader thread fills up to DISK_IO_SLOTS buffers while the calling thread writes them back.
+ * The job progress is updated with the number of bytes processed.
+ *
+ * @param delta_block When not 0, the destination is read first and only the blocks of this size
+ *                    that differ from the source are written.
+ */
+const char* disk_io_copy(disk_handle_t* src, disk_handle_t* dst, const disk_copy_t* extents, int count,
+                         uint32_t delta_block)
+{
+    static _Thread_local char error_msg[256];
+    uint64_t written = 0;
+    uint64_t processed = 0;
+    copy_pipeline_t pipe = {
+        .src     = src,
+        .extents = extents,
+        .count   = count,
+    };
+    /* One more buffer to hold the current content of the destination in delta mode */
+    uint8_t* buffers = malloc((size_t) (DISK_IO_SLOTS + 1) * DISK_IO_CHUNK_SIZE);
+    if (buffers == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the copy\n");
+        return error_msg;
+    }
+    uint8_t* current = buffers + (size_t) DISK_IO_SLOTS * DISK_IO_CHUNK_SIZE;
+    for (int i = 0; i < DISK_IO_SLOTS; i++) {
+        pipe.slots[i].data = buffers + (size_t) i * DISK_IO_CHUNK_SIZE;
+    }
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.cond, NULL);
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, disk_io_reader, &pipe) != 0) {
+        snprintf(error_msg, sizeof(error_msg), "Could not create the reader thread\n");
+        pipe.error = error_msg;
+        goto cleanup;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pipe.lock);
+        while (pipe.produced == pipe.consumed && !pipe.reader_done) {
+            pthread_cond_wait(&pipe.cond, &pipe.lock);
+        }
+        const bool empty = pipe.produced == pipe.consumed;
+        pthread_mutex_unlock(&pipe.lock);
+        if (empty) {
+            /* Reader is done and all its slots have been written */
+            break;
+        }
+
+        copy_slot_t* slot = &pipe.slots[pipe.consumed % DISK_IO_SLOTS];
+        const char* err = NULL;
+        if (delta_block != 0) {
+            uint32_t slot_written = 0;
+            err = disk_read(dst, slot->dst_offset, current, slot->len);
+            if (err == NULL) {
+                err = disk_io_write_diff(dst, slot->dst_offset, slot->data, current, slot->len, delta_block, &slot_written);
+            }
+            written += slot_written;
+        } else {
+            err = disk_write(dst, slot->dst_offset, slot->data, slot->len);
+            written += slot->len;
+        }
+        processed += slot->len;
+        job_add_progress(slot->len);
+
+        pthread_mutex_lock(&pipe.lock);
+        pipe.consumed++;
+        if (err) {
+            pipe.error = err;
+            pipe.abort = true;
+        }
+        pthread_cond_broadcast(&pipe.cond);
+        pthread_mutex_unlock(&pipe.lock);
+        if (err) {
+            break;
+        }
+    }
+
+    pthread_join(reader, NULL);
+    LOG_I("DISK", "Copied %llu bytes, %llu written", (unsigned long long) processed, (unsigned long long) written);
+cleanup:
+    pthread_cond_destroy(&pipe.cond);
+    pthread_mutex_destroy(&pipe.lock);
+    free(buffers);
+    if (pipe.error && pipe.error != error_msg) {
+        snprintf(error_msg, sizeof(error_msg), "%s", pipe.error);
+        return error_msg;
+    }
+    return pipe.error;
+}
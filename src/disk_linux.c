@@ -4,7 +4,11 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "disk.h"
+#include "perf.h"
+#include "trace.h"
+#include "log.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -40,14 +44,16 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
         char path[256];
         snprintf(path, sizeof(path), "/dev/sd%c", c);
 
+        uint64_t start = trace_begin();
         int fd = open(path, O_RDONLY);
+        trace_end("list open", start, 0, 0);
         if (fd < 0) {
             if (errno == EACCES) {
                 return ERR_NOT_ADMIN;
             } else if (errno == ENOENT) {
                 continue;
             }
-            perror("Could not open the disk");
+            LOG_W("DISK", "Could not open %s: %s", path, strerror(errno));
             continue;
         }
 
@@ -56,8 +62,11 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
         strcpy(info->path, path);
 
         /* Get the size of the disk, make sure it is not bigger than expected */
-        if (ioctl(fd, BLKGETSIZE64, &info->size_bytes) != 0) {
-            fprintf(stderr, "Could not get disk %s size: %s\n", path, strerror(errno));
+        start = trace_begin();
+        const int ret = ioctl(fd, BLKGETSIZE64, &info->size_bytes);
+        trace_end("list ioctl", start, 0, 0);
+        if (ret != 0) {
+            LOG_E("DISK", "Could not get disk %s size: %s", path, strerror(errno));
             close(fd);
             return 1;
         }
@@ -65,12 +74,14 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
 
         if (info->size_bytes > MAX_DISK_SIZE) {
             close(fd);
-            fprintf(stderr, "%s exceeds max disk size of %lluGB with %lluGB bytes\n", path, MAX_DISK_SIZE/GB, info->size_bytes/GB);
+            LOG_W("DISK", "%s exceeds max disk size of %lluGB with %lluGB bytes", path, MAX_DISK_SIZE/GB, info->size_bytes/GB);
             continue;
         }
 
         /* Read MBR */
+        start = trace_begin();
         ssize_t r = read(fd, info->mbr, DISK_SECTOR_SIZE);
+        trace_end("list read", start, 0, DISK_SECTOR_SIZE);
         if (r == DISK_SECTOR_SIZE) {
             info->has_mbr = (info->mbr[DISK_SECTOR_SIZE - 2] == 0x55 &&
                              info->mbr[DISK_SECTOR_SIZE - 1] == 0xAA);
@@ -86,57 +97,98 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
 }
 
 
-const char* disk_write_changes(disk_info_t* disk)
+struct disk_handle_t {
+    int  fd;
+    char name[256];
+};
+
+
+const char* disk_open(const disk_info_t* disk, bool write, disk_handle_t** out_handle)
 {
-#if DEBUG_DISKS
-    return NULL;
-#endif
-    static char error_msg[1024];
-    assert(disk);
-    assert(disk->has_mbr);
-    assert(disk->has_staged_changes);
-    /* Reopen the disk to write it back */
+    static _Thread_local char error_msg[1024];
+    assert(disk && out_handle);
 
-    int fd = open(disk->name, O_WRONLY);
+    const uint64_t start = trace_begin();
+    int fd = open(disk->path, write ? O_RDWR : O_RDONLY);
+    trace_end("open", start, 0, 0);
     if (fd < 0) {
-        sprintf(error_msg, "Could not open disk %s: %s\n", disk->name, strerror(errno));
+        snprintf(error_msg, sizeof(error_msg), "Could not open disk %s: %s\n", disk->name, strerror(errno));
         return error_msg;
     }
 
-    /* Write MBR */
-    ssize_t wr = write(fd, disk->staged_mbr, sizeof(disk->staged_mbr));
-    if (wr != DISK_SECTOR_SIZE) {
-        sprintf(error_msg, "Could not write disk %s: %s\n", disk->name, strerror(errno));
-        goto error;
+    disk_handle_t* handle = calloc(1, sizeof(disk_handle_t));
+    if (handle == NULL) {
+        close(fd);
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for disk %s\n", disk->name);
+        return error_msg;
     }
+    handle->fd = fd;
+    strncpy(handle->name, disk->name, sizeof(handle->name) - 1);
+    *out_handle = handle;
+    return NULL;
+}
 
-    /* Write any new partition */
-    for (int i = 0; i < MAX_PART_COUNT; i++) {
-        const partition_t* part = &disk->staged_partitions[i];
-        if (part->data != NULL && part->data_len != 0) {
-            /* Data need to be written back to the disk */
-            off_t part_offset = part->start_lba * DISK_SECTOR_SIZE;
-            const off_t offset = lseek(fd, part_offset, SEEK_SET);
-            printf("[DISK] Writing partition %d @ %08lx, %d bytes\n", i, offset, part->data_len);
-            if (offset != part_offset){
-                sprintf(error_msg, "Could not offset in the disk %s: %s\n", disk->name, strerror(errno));
-                goto error;
-            }
-            wr = write(fd, part->data, part->data_len);
-            if (wr != part->data_len) {
-                sprintf(error_msg, "Could not write partition to disk %s: %s\n", disk->name, strerror(errno));
-                goto error;
-            }
-        } else {
-            printf("[DISK] Partition %d has no changes\n", i);
+
+const char* disk_read(disk_handle_t* handle, uint64_t offset, void* buffer, uint32_t len)
+{
+    static _Thread_local char error_msg[1024];
+    const uint64_t start = perf_io_begin();
+    const uint64_t from = offset;
+    const uint32_t size = len;
+    const char* err = NULL;
+    uint8_t* dst = buffer;
+
+    while (len > 0) {
+        const ssize_t rd = pread(handle->fd, dst, len, (off_t) offset);
+        if (rd <= 0) {
+            snprintf(error_msg, sizeof(error_msg), "Could not read disk %s @ %08llx: %s\n",
+                     handle->name, (unsigned long long) offset, rd == 0 ? "end of disk" : strerror(errno));
+            err = error_msg;
+            break;
         }
+        dst += rd;
+        offset += rd;
+        len -= rd;
     }
+    perf_io_end(start, size - len, false);
+    trace_end("read", start, from, size);
+    return err;
+}
 
-    /* Apply the changes in RAM too */
-    disk_apply_changes(disk);
-    close(fd);
-    return NULL;
-error:
-    close(fd);
-    return error_msg;
-}
\ No newline at end of file
+
+const char* disk_write(disk_handle_t* handle, uint64_t offset, const void* buffer, uint32_t len)
+{
+    static _Thread_local char error_msg[1024];
+    const uint64_t start = perf_io_begin();
+    const uint64_t from = offset;
+    const uint32_t size = len;
+    const char* err = NULL;
+    const uint8_t* src = buffer;
+
+    while (len > 0) {
+        const ssize_t wr = pwrite(handle->fd, src, len, (off_t) offset);
+        if (wr <= 0) {
+            snprintf(error_msg, sizeof(error_msg), "Could not write disk %s @ %08llx: %s\n",
+                     handle->name, (unsigned long long) offset, wr == 0 ? "end of disk" : strerror(errno));
+            err = error_msg;
+            break;
+        }
+        src += wr;
+        offset += wr;
+        len -= wr;
+    }
+    perf_io_end(start, size - len, true);
+    trace_end("write", start, from, size);
+    return err;
+}
+
+
+void disk_close(disk_handle_t* handle)
+{
+    if (handle) {
+        const uint64_t start = trace_begin();
+        close(handle->fd);
+        trace_end("close", start, 0, 0);
+        free(handle);
+    }
+}
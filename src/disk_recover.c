@@ -0,0 +1,173 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "disk.h"
+#include "job.h"
+#include "zealfs_v2.h"
+#include "log.h"
+
+/* Number of threads reading the disk concurrently */
+#define RECOVER_THREADS     4
+/* Size of each read, must be a multiple of RECOVER_ALIGNMENT */
+#define RECOVER_CHUNK_SIZE  (4*MB)
+/* Partitions created by this tool are aligned on 1MB, or 4KB when there is not enough space */
+#define RECOVER_ALIGNMENT   (4*KB)
+
+typedef struct {
+    disk_handle_t*      handle;
+    uint64_t            disk_size;
+    uint32_t            chunk_count;
+    atomic_uint         next_chunk;
+    pthread_mutex_t     lock;
+    recovered_part_t*   out;
+    int                 max;
+    int                 count;
+    const char*         error;
+    char                error_buf[256];
+} recover_scan_t;
+
+
+static void disk_recover_check(recover_scan_t* scan, const uint8_t* data, uint64_t offset)
+{
+    const ZealFSHeader* header = (const ZealFSHeader*) data;
+    uint64_t part_size = 0;
+
+    if (zealfsv2_check_header(header, &part_size) != 0 || offset + part_size > scan->disk_size) {
+        return;
+    }
+
+    const uint32_t total_pages = zealfsv2_page_count(header);
+    const recovered_part_t found = {
+        .start_lba    = (uint32_t) (offset / DISK_SECTOR_SIZE),
+        .size_sectors = (uint32_t) (part_size / DISK_SECTOR_SIZE),
+        .page_bytes   = zealfsv2_page_bytes(header),
+        .used_pages   = total_pages - header->free_pages,
+        .total_pages  = total_pages,
+    };
+
+    pthread_mutex_lock(&scan->lock);
+    if (scan->count < scan->max) {
+        scan->out[scan->count++] = found;
+    }
+    pthread_mutex_unlock(&scan->lock);
+}
+
+
+static void* disk_recover_thread(void* arg)
+{
+    recover_scan_t* scan = (recover_scan_t*) arg;
+    uint8_t* buffer = malloc(RECOVER_CHUNK_SIZE);
+    const char* err = NULL;
+
+    if (buffer == NULL) {
+        err = "Could not allocate memory for the scan\n";
+        goto end;
+    }
+
+    /* Each thread takes the next chunk to read, so the disk is still read almost sequentially */
+    uint32_t chunk;
+    while (err == NULL && (chunk = atomic_fetch_add(&scan->next_chunk, 1)) < scan->chunk_count) {
+        const uint64_t offset = (uint64_t) chunk * RECOVER_CHUNK_SIZE;
+        const uint32_t len = (uint32_t) MIN(RECOVER_CHUNK_SIZE, scan->disk_size - offset);
+        err = disk_read(scan->handle, offset, buffer, len);
+        if (err) {
+            break;
+        }
+
+        /* The MBR sector can't be a partition */
+        for (uint32_t pos = (chunk == 0) ? RECOVER_ALIGNMENT : 0; pos + DISK_SECTOR_SIZE <= len; pos += RECOVER_ALIGNMENT) {
+            /* Quick filter on the magic and version before doing the full check */
+            if (buffer[pos] == 'Z' && buffer[pos + 1] == 2) {
+                disk_recover_check(scan, buffer + pos, offset + pos);
+            }
+        }
+        job_add_progress(len);
+    }
+
+end:
+    if (err) {
+        pthread_mutex_lock(&scan->lock);
+        if (scan->error == NULL) {
+            snprintf(scan->error_buf, sizeof(scan->error_buf), "%s", err);
+            scan->error = scan->error_buf;
+        }
+        /* Make the other threads stop */
+        atomic_store(&scan->next_chunk, scan->chunk_count);
+        pthread_mutex_unlock(&scan->lock);
+    }
+    free(buffer);
+    return NULL;
+}
+
+
+static int disk_recover_cmp(const void* a, const void* b)
+{
+    const recovered_part_t* pa = (const recovered_part_t*) a;
+    const recovered_part_t* pb = (const recovered_part_t*) b;
+    return (pa->start_lba > pb->start_lba) - (pa->start_lba < pb->start_lba);
+}
+
+
+/**
+ * @brief Scan the whole disk, with several threads, looking for ZealFS v2 headers on each 4KB boundary.
+ * This can be used to find partitions that are not referenced by the MBR anymore.
+ *
+ * @param out Array populated with the partitions found, sorted by address.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_recover_scan(const disk_info_t* disk, recovered_part_t* out, int max, int* out_count)
+{
+    static _Thread_local char error_msg[256];
+    recover_scan_t scan = {
+        .disk_size   = disk->size_bytes - (disk->size_bytes % DISK_SECTOR_SIZE),
+        .out         = out,
+        .max         = max,
+    };
+    scan.chunk_count = (uint32_t) ((scan.disk_size + RECOVER_CHUNK_SIZE - 1) / RECOVER_CHUNK_SIZE);
+    *out_count = 0;
+
+    const char* err = disk_open(disk, false, &scan.handle);
+    if (err) {
+        return err;
+    }
+
+    job_add_total(scan.disk_size);
+    pthread_mutex_init(&scan.lock, NULL);
+    atomic_init(&scan.next_chunk, 0);
+
+    pthread_t threads[RECOVER_THREADS];
+    int started = 0;
+    for (; started < RECOVER_THREADS; started++) {
+        if (pthread_create(&threads[started], NULL, disk_recover_thread, &scan) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        /* Scan from this thread then */
+        disk_recover_thread(&scan);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&scan.lock);
+    disk_close(scan.handle);
+
+    if (scan.error) {
+        snprintf(error_msg, sizeof(error_msg), "%s", scan.error);
+        return error_msg;
+    }
+
+    qsort(out, scan.count, sizeof(recovered_part_t), disk_recover_cmp);
+    *out_count = scan.count;
+    LOG_I("DISK", "Recovery scan found %d ZealFS partition(s)", scan.count);
+    return NULL;
+}
+
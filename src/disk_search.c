@@ -0,0 +1,314 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "disk_search.h"
+#include "log.h"
+
+struct disk_search_t {
+    disk_handle_t*      handle;
+    uint64_t            start;
+    uint64_t            size;
+    uint8_t             pattern[DISK_SEARCH_MAX_PATTERN];
+    uint32_t            len;
+    uint32_t            chunk_count;
+    atomic_uint         next_chunk;
+    atomic_uint_fast64_t done;
+    atomic_int          running;
+    /* Largest result once the results are full, the matches after it are not needed anymore */
+    atomic_uint_fast64_t limit;
+    pthread_t           threads[DISK_SEARCH_THREADS];
+    int                 started;
+    /* Set when matches were dropped or chunks skipped because the results were full */
+    atomic_bool         truncated;
+    /* Protects the results and the error, the workers and the UI access them concurrently */
+    pthread_mutex_t     lock;
+    uint64_t            results[DISK_SEARCH_MAX_RESULTS];
+    int                 count;
+    char                error[256];
+};
+
+
+/**
+ * @brief Insert a match in the results, kept sorted so that the UI can show them as they are found.
+ * Once the results are full, only the first matches of the disk are kept: a match replaces the
+ * largest result if it comes before it.
+ *
+ * @return false if the match comes after all the results kept, so do the next ones of the chunk.
+ */
+static bool disk_search_add(disk_search_t* search, uint64_t offset)
+{
+    /* Checked without the lock first, most matches are after the limit once the results are full */
+    if (offset >= atomic_load(&search->limit)) {
+        atomic_store(&search->truncated, true);
+        return false;
+    }
+    pthread_mutex_lock(&search->lock);
+    if (search->count == DISK_SEARCH_MAX_RESULTS) {
+        atomic_store(&search->truncated, true);
+        if (offset >= search->results[search->count - 1]) {
+            pthread_mutex_unlock(&search->lock);
+            return false;
+        }
+        /* Drop the largest result to make room for this one */
+        search->count--;
+    }
+    int i = search->count;
+    while (i > 0 && search->results[i - 1] > offset) {
+        i--;
+    }
+    memmove(&search->results[i + 1], &search->results[i], sizeof(uint64_t) * (search->count - i));
+    search->results[i] = offset;
+    search->count++;
+    if (search->count == DISK_SEARCH_MAX_RESULTS) {
+        atomic_store(&search->limit, search->results[search->count - 1]);
+    }
+    pthread_mutex_unlock(&search->lock);
+    return true;
+}
+
+
+/**
+ * @brief Look for the pattern in a chunk, only the matches starting in its first `starts` bytes are
+ * reported, the bytes after them only complete the matches crossing the end of the chunk.
+ *
+ * @param avail Bytes in `data`.
+ * @param offset Offset of `data` on the disk.
+ */
+static void disk_search_chunk(disk_search_t* search, const uint8_t* data, uint32_t starts, uint32_t avail,
+                              uint64_t offset)
+{
+    const uint8_t* pattern = search->pattern;
+    const uint32_t len = search->len;
+    if (avail < len) {
+        return;
+    }
+    const uint32_t end = MIN(starts, avail - len + 1);
+    uint32_t pos = 0;
+
+#if defined(__SSE2__)
+    /* Filter 16 positions at once on the first two bytes, the full compare is only done on the candidates */
+    if (len >= 2) {
+        const __m128i first = _mm_set1_epi8((char) pattern[0]);
+        const __m128i second = _mm_set1_epi8((char) pattern[1]);
+        for (; pos + 16 <= end && pos + 17 <= avail; pos += 16) {
+            const __m128i a = _mm_loadu_si128((const __m128i*) (data + pos));
+            const __m128i b = _mm_loadu_si128((const __m128i*) (data + pos + 1));
+            uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, second)));
+            while (mask != 0) {
+                const uint32_t candidate = pos + __builtin_ctz(mask);
+                mask &= mask - 1;
+                if (memcmp(data + candidate, pattern, len) == 0 && !disk_search_add(search, offset + candidate)) {
+                    return;
+                }
+            }
+        }
+    }
+#endif
+
+    /* Remaining positions, or all of them without SSE2, memchr is vectorized by the C libraries */
+    while (pos < end) {
+        const uint8_t* found = memchr(data + pos, pattern[0], end - pos);
+        if (found == NULL) {
+            break;
+        }
+        pos = (uint32_t) (found - data);
+        if (memcmp(found, pattern, len) == 0 && !disk_search_add(search, offset + pos)) {
+            return;
+        }
+        pos++;
+    }
+}
+
+
+static void* disk_search_thread(void* arg)
+{
+    disk_search_t* search = (disk_search_t*) arg;
+    uint8_t* buffer = malloc(DISK_SEARCH_CHUNK_SIZE + DISK_SECTOR_SIZE);
+    const char* err = NULL;
+
+    if (buffer == NULL) {
+        err = "Could not allocate memory for the search\n";
+        goto end;
+    }
+
+    /* Each thread takes the next chunk to read, so the disk is still read almost sequentially */
+    uint32_t chunk;
+    while ((chunk = atomic_fetch_add(&search->next_chunk, 1)) < search->chunk_count) {
+        const uint64_t rel = (uint64_t) chunk * DISK_SEARCH_CHUNK_SIZE;
+        const uint32_t len = (uint32_t) MIN(DISK_SEARCH_CHUNK_SIZE, search->size - rel);
+        /* No match of a chunk after the limit would be kept, skip it without reading it */
+        if (search->start + rel >= atomic_load(&search->limit)) {
+            atomic_store(&search->truncated, true);
+            atomic_fetch_add(&search->done, len);
+            continue;
+        }
+        /* The following sector holds the end of the matches starting in this chunk */
+        const uint32_t read_len = (uint32_t) MIN(len + DISK_SECTOR_SIZE, search->size - rel);
+        err = disk_read(search->handle, search->start + rel, buffer, read_len);
+        if (err) {
+            break;
+        }
+        disk_search_chunk(search, buffer, len, read_len, search->start + rel);
+        atomic_fetch_add(&search->done, len);
+    }
+
+end:
+    if (err) {
+        pthread_mutex_lock(&search->lock);
+        if (search->error[0] == 0) {
+            snprintf(search->error, sizeof(search->error), "%s", err);
+        }
+        /* Make the other threads stop */
+        atomic_store(&search->next_chunk, search->chunk_count);
+        pthread_mutex_unlock(&search->lock);
+        LOG_W("DISK", "%s", err);
+    }
+    free(buffer);
+    if (atomic_fetch_sub(&search->running, 1) == 1) {
+        LOG_I("DISK", "Search found %d match(es)", search->count);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Start looking for a pattern in `size` bytes of the disk from `start`, with several threads.
+ * The matches can be read while the search runs, they are sorted by offset.
+ *
+ * @param start Offset of the first byte to search, must be a multiple of the sector size.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* disk_search_start(const disk_info_t* disk, uint64_t start, uint64_t size,
+                              const uint8_t* pattern, uint32_t len, disk_search_t** out_search)
+{
+    static _Thread_local char error_msg[256];
+
+    if (len == 0 || len > DISK_SEARCH_MAX_PATTERN) {
+        snprintf(error_msg, sizeof(error_msg), "The pattern must be 1 to %d bytes long\n", DISK_SEARCH_MAX_PATTERN);
+        return error_msg;
+    }
+    disk_search_t* search = calloc(1, sizeof(disk_search_t));
+    if (search == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the search\n");
+        return error_msg;
+    }
+    const char* err = disk_open(disk, false, &search->handle);
+    if (err) {
+        free(search);
+        return err;
+    }
+
+    search->start = start;
+    search->size = size - (size % DISK_SECTOR_SIZE);
+    memcpy(search->pattern, pattern, len);
+    search->len = len;
+    search->chunk_count = (uint32_t) ((search->size + DISK_SEARCH_CHUNK_SIZE - 1) / DISK_SEARCH_CHUNK_SIZE);
+    atomic_init(&search->next_chunk, 0);
+    atomic_init(&search->done, 0);
+    atomic_init(&search->running, DISK_SEARCH_THREADS);
+    atomic_init(&search->limit, UINT64_MAX);
+    atomic_init(&search->truncated, false);
+    pthread_mutex_init(&search->lock, NULL);
+
+    for (; search->started < DISK_SEARCH_THREADS; search->started++) {
+        if (pthread_create(&search->threads[search->started], NULL, disk_search_thread, search) != 0) {
+            break;
+        }
+    }
+    /* The threads that could not be created will never finish */
+    atomic_fetch_sub(&search->running, DISK_SEARCH_THREADS - search->started);
+    if (search->started == 0) {
+        disk_close(search->handle);
+        pthread_mutex_destroy(&search->lock);
+        free(search);
+        snprintf(error_msg, sizeof(error_msg), "Could not create the search threads\n");
+        return error_msg;
+    }
+    *out_search = search;
+    return NULL;
+}
+
+
+/**
+ * @brief Stop the search, once the chunks being read are done, and free it.
+ */
+void disk_search_close(disk_search_t* search)
+{
+    if (search == NULL) {
+        return;
+    }
+    atomic_store(&search->next_chunk, search->chunk_count);
+    for (int i = 0; i < search->started; i++) {
+        pthread_join(search->threads[i], NULL);
+    }
+    disk_close(search->handle);
+    pthread_mutex_destroy(&search->lock);
+    free(search);
+}
+
+
+bool disk_search_running(disk_search_t* search)
+{
+    return atomic_load(&search->running) > 0;
+}
+
+
+/**
+ * @brief Get the ratio of the bytes searched, between 0 and 1.
+ */
+float disk_search_progress(disk_search_t* search)
+{
+    return search->size ? (float) ((double) atomic_load(&search->done) / search->size) : 1.0f;
+}
+
+
+/**
+ * @brief Get the number of matches found so far.
+ *
+ * @param truncated Set to true if the results were full and the search skipped the matches after them, can be NULL.
+ */
+int disk_search_count(disk_search_t* search, bool* truncated)
+{
+    pthread_mutex_lock(&search->lock);
+    const int count = search->count;
+    pthread_mutex_unlock(&search->lock);
+    if (truncated) {
+        *truncated = atomic_load(&search->truncated);
+    }
+    return count;
+}
+
+
+/**
+ * @brief Get the offset of a match on the disk. A match found meanwhile may shift the indexes by one.
+ */
+uint64_t disk_search_result(disk_search_t* search, int index)
+{
+    pthread_mutex_lock(&search->lock);
+    const uint64_t offset = search->results[index];
+    pthread_mutex_unlock(&search->lock);
+    return offset;
+}
+
+
+/**
+ * @brief Get the error that stopped the search, NULL if there was none. The message is never modified once set.
+ */
+const char* disk_search_error(disk_search_t* search)
+{
+    pthread_mutex_lock(&search->lock);
+    const char* err = search->error[0] ? search->error : NULL;
+    pthread_mutex_unlock(&search->lock);
+    return err;
+}
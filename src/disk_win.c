@@ -6,7 +6,11 @@
 #include <windows.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "disk.h"
+#include "perf.h"
+#include "trace.h"
+#include "log.h"
 
 disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
     *out_count = 0;
@@ -14,11 +18,14 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
         char path[256];
         snprintf(path, sizeof(path), "\\\\.\\PhysicalDrive%d", i);
 
+        uint64_t start = trace_begin();
         HANDLE hDisk = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+        /* Recording the event may overwrite the last error */
+        const DWORD error = GetLastError();
+        trace_end("list open", start, 0, 0);
         if (hDisk == INVALID_HANDLE_VALUE) {
-            DWORD error = GetLastError();
             if (error == ERROR_ACCESS_DENIED) {
-                printf("Program must be run as Administrator!\n");
+                LOG_E("DISK", "Program must be run as Administrator!");
                 return ERR_NOT_ADMIN;
             }
             continue;
@@ -31,7 +38,10 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
         /* Get the size of the disk, exclude any disk bigger than 32GB to prevent mistakes */
         GET_LENGTH_INFORMATION lenInfo;
         DWORD bytesReturned;
-        if (DeviceIoControl(hDisk, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &lenInfo, sizeof(lenInfo), &bytesReturned, NULL)) {
+        start = trace_begin();
+        const BOOL got_length = DeviceIoControl(hDisk, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0, &lenInfo, sizeof(lenInfo), &bytesReturned, NULL);
+        trace_end("list ioctl", start, 0, 0);
+        if (got_length) {
             info->size_bytes = lenInfo.Length.QuadPart;
         } else {
             info->size_bytes = 0;
@@ -39,14 +49,17 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
 
         if (info->size_bytes > MAX_DISK_SIZE) {
             CloseHandle(hDisk);
-            fprintf(stderr, "%s exceeds max disk size of %lluGB with %lluGB bytes\n", path, MAX_DISK_SIZE/GB, info->size_bytes/GB);
+            LOG_W("DISK", "%s exceeds max disk size of %lluGB with %lluGB bytes", path, MAX_DISK_SIZE/GB, info->size_bytes/GB);
             continue;
         }
 
         /* Read MBR */
         DWORD bytesRead;
         SetFilePointer(hDisk, 0, NULL, FILE_BEGIN);
-        if (ReadFile(hDisk, info->mbr, sizeof(info->mbr), &bytesRead, NULL) && bytesRead == DISK_SECTOR_SIZE) {
+        start = trace_begin();
+        const BOOL got_mbr = ReadFile(hDisk, info->mbr, sizeof(info->mbr), &bytesRead, NULL);
+        trace_end("list read", start, 0, DISK_SECTOR_SIZE);
+        if (got_mbr && bytesRead == DISK_SECTOR_SIZE) {
             info->has_mbr = (info->mbr[DISK_SECTOR_SIZE - 2] == 0x55 &&
                              info->mbr[DISK_SECTOR_SIZE - 1] == 0xAA);
         } else {
@@ -61,66 +74,92 @@ disk_err_t disk_list(disk_info_t* out_disks, int max_disks, int* out_count) {
 }
 
 
-const char* disk_write_changes(disk_info_t* disk)
-{
-#if DEBUG_DISKS
-    return NULL;
-#endif
-    static char error_msg[1024];
-    assert(disk);
-    assert(disk->has_mbr);
-    assert(disk->has_staged_changes);
+struct disk_handle_t {
+    HANDLE fd;
+    char   name[256];
+};
 
 
-    HANDLE fd = CreateFileA(disk->path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+const char* disk_open(const disk_info_t* disk, bool write, disk_handle_t** out_handle)
+{
+    static _Thread_local char error_msg[1024];
+    assert(disk && out_handle);
+
+    const DWORD access = write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+    const uint64_t start = trace_begin();
+    HANDLE fd = CreateFileA(disk->path, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+    const DWORD error = GetLastError();
+    trace_end("open", start, 0, 0);
     if (fd == INVALID_HANDLE_VALUE) {
         snprintf(error_msg, sizeof(error_msg),
-            "Could not open disk %s: %lu\n", disk->path, GetLastError());
+            "Could not open disk %s: %lu\n", disk->path, error);
         return error_msg;
     }
 
-    /* Let's be safe and set the pointer */
-    SetFilePointer(fd, 0, NULL, FILE_BEGIN);
-    DWORD wr = 0;
-    BOOL success = WriteFile(fd, disk->staged_mbr, 512, &wr, NULL);
-    if (!success || wr != DISK_SECTOR_SIZE) {
-        snprintf(error_msg, sizeof(error_msg),
-            "Could not write disk %s: %lu\n", disk->name, GetLastError());
-        goto error;
+    disk_handle_t* handle = calloc(1, sizeof(disk_handle_t));
+    if (handle == NULL) {
+        CloseHandle(fd);
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for disk %s\n", disk->name);
+        return error_msg;
     }
+    handle->fd = fd;
+    strncpy(handle->name, disk->name, sizeof(handle->name) - 1);
+    *out_handle = handle;
+    return NULL;
+}
 
-    /* Write any new partition */
-    for (int i = 0; i < MAX_PART_COUNT; i++) {
-        const partition_t* part = &disk->staged_partitions[i];
-        if (part->data != NULL && part->data_len != 0) {
-            /* Data need to be written back to the disk */
-            LARGE_INTEGER offset = {
-                .QuadPart = 0
-            };
-            LARGE_INTEGER part_offset = {
-                .QuadPart = part->start_lba * DISK_SECTOR_SIZE
-            };
-            success = SetFilePointerEx(fd, part_offset, &offset, FILE_BEGIN);
-            printf("[DISK] Writing partition %d @ %08llx, %d bytes\n", i, offset.QuadPart, part->data_len);
-            if (offset.QuadPart != part_offset.QuadPart){
-                sprintf(error_msg, "Could not offset in the disk %s: %lu\n", disk->name, GetLastError());
-                goto error;
-            }
-            success = WriteFile(fd, part->data, part->data_len, &wr, NULL);
-            if (!success || wr != part->data_len) {
-                sprintf(error_msg, "Could not write partition to disk %s: %lu\n", disk->name, GetLastError());
-                goto error;
-            }
-        } else {
-            printf("[DISK] Partition %d has no changes\n", i);
-        }
+
+const char* disk_read(disk_handle_t* handle, uint64_t offset, void* buffer, uint32_t len)
+{
+    static _Thread_local char error_msg[1024];
+    /* Use the offset from the OVERLAPPED structure so that several threads can share the handle */
+    OVERLAPPED ov = {
+        .Offset     = (DWORD) offset,
+        .OffsetHigh = (DWORD) (offset >> 32),
+    };
+    DWORD rd = 0;
+    const uint64_t start = perf_io_begin();
+    const BOOL success = ReadFile(handle->fd, buffer, len, &rd, &ov);
+    const DWORD error = GetLastError();
+    perf_io_end(start, rd, false);
+    trace_end("read", start, offset, len);
+    if (!success || rd != len) {
+        snprintf(error_msg, sizeof(error_msg), "Could not read disk %s @ %08llx: %lu\n",
+            handle->name, (unsigned long long) offset, error);
+        return error_msg;
     }
+    return NULL;
+}
 
-    /* Apply the changes in RAM too */
-    disk_apply_changes(disk);
-    CloseHandle(fd);
+
+const char* disk_write(disk_handle_t* handle, uint64_t offset, const void* buffer, uint32_t len)
+{
+    static _Thread_local char error_msg[1024];
+    OVERLAPPED ov = {
+        .Offset     = (DWORD) offset,
+        .OffsetHigh = (DWORD) (offset >> 32),
+    };
+    DWORD wr = 0;
+    const uint64_t start = perf_io_begin();
+    const BOOL success = WriteFile(handle->fd, buffer, len, &wr, &ov);
+    const DWORD error = GetLastError();
+    perf_io_end(start, wr, true);
+    trace_end("write", start, offset, len);
+    if (!success || wr != len) {
+        snprintf(error_msg, sizeof(error_msg), "Could not write disk %s @ %08llx: %lu\n",
+            handle->name, (unsigned long long) offset, error);
+        return error_msg;
+    }
     return NULL;
-error:
-    CloseHandle(fd);
-    return error_msg;
+}
+
+
+void disk_close(disk_handle_t* handle)
+{
+    if (handle) {
+        const uint64_t start = trace_begin();
+        CloseHandle(handle->fd);
+        trace_end("close", start, 0, 0);
+        free(handle);
+    }
 }
@@ -0,0 +1,117 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "job.h"
+#include "trace.h"
+#include "log.h"
+
+/* Only a single job can run at a time, the UI waits for it to finish before allowing another one */
+static struct {
+    const char*     name;
+    job_fn_t        fn;
+    void*           arg;
+    pthread_t       thread;
+    atomic_bool     running;
+    atomic_bool     finished;
+    const char*     result;
+    atomic_uint_fast64_t done;
+    atomic_uint_fast64_t total;
+} s_job;
+
+
+static void* job_thread(void* arg)
+{
+    (void) arg;
+    const uint64_t start = trace_begin();
+    s_job.result = s_job.fn(s_job.arg);
+    trace_end(s_job.name, start, 0, 0);
+    /* Publish the result before marking the job as finished */
+    atomic_store(&s_job.finished, true);
+    return NULL;
+}
+
+
+bool job_start(const char* name, job_fn_t fn, void* arg)
+{
+    if (atomic_load(&s_job.running)) {
+        return false;
+    }
+
+    s_job.name = name;
+    s_job.fn = fn;
+    s_job.arg = arg;
+    s_job.result = NULL;
+    atomic_store(&s_job.done, 0);
+    atomic_store(&s_job.total, 0);
+    atomic_store(&s_job.finished, false);
+    atomic_store(&s_job.running, true);
+
+    if (pthread_create(&s_job.thread, NULL, job_thread, NULL) != 0) {
+        LOG_E("JOB", "Could not create a thread for %s", name);
+        atomic_store(&s_job.running, false);
+        return false;
+    }
+    return true;
+}
+
+
+bool job_running(void)
+{
+    return atomic_load(&s_job.running);
+}
+
+
+const char* job_name(void)
+{
+    return job_running() ? s_job.name : NULL;
+}
+
+
+/**
+ * @brief Check whether the current job is over, must be called from the UI thread.
+ * Returns true only once per job, `result` is populated with the value returned by the job.
+ */
+bool job_finished(const char** result)
+{
+    if (!atomic_load(&s_job.running) || !atomic_load(&s_job.finished)) {
+        return false;
+    }
+
+    pthread_join(s_job.thread, NULL);
+    atomic_store(&s_job.running, false);
+    if (result) {
+        *result = s_job.result;
+    }
+    return true;
+}
+
+
+void job_add_total(uint64_t total)
+{
+    atomic_fetch_add(&s_job.total, total);
+}
+
+
+void job_add_progress(uint64_t done)
+{
+    atomic_fetch_add(&s_job.done, done);
+}
+
+
+/**
+ * @brief Get the progress of the current job, between 0.0 and 1.0
+ */
+float job_get_progress(void)
+{
+    const uint64_t total = atomic_load(&s_job.total);
+    if (total == 0) {
+        return 0.0f;
+    }
+    const uint64_t done = atomic_load(&s_job.done);
+    return done >= total ? 1.0f : (float) done / (float) total;
+}
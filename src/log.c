@@ -0,0 +1,263 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "log.h"
+#include "perf.h"
+
+/* Lines kept per thread until the background thread writes them, a full ring drops the new lines */
+#define LOG_RING_LINES      512
+#define LOG_LINE_LEN        240
+/* The background thread is woken up by new lines, this is only a bound in case a wake-up is missed */
+#define LOG_FLUSH_MS        250
+
+typedef struct {
+    uint64_t time;
+    int      level;
+    char     text[LOG_LINE_LEN];
+} log_line_t;
+
+/* Single producer, the thread owning it, and single consumer, the thread writing the lines out */
+typedef struct log_ring_t {
+    struct log_ring_t*   next;
+    struct log_ring_t*   next_free;
+    atomic_uint_fast64_t head;
+    atomic_uint_fast64_t tail;
+    log_line_t           lines[LOG_RING_LINES];
+} log_ring_t;
+
+static struct {
+    uint64_t             origin;
+    pthread_t            thread;
+    atomic_bool          started;
+    atomic_bool          stop;
+    atomic_bool          pending;
+    atomic_uint_fast64_t dropped;
+    pthread_key_t        key;
+    /* Protects the lists of rings and the wait of the background thread, never taken to log a line */
+    pthread_mutex_t      lock;
+    pthread_cond_t       cond;
+    /* Rings are never freed and only added at the head, so the list can be walked without the lock */
+    log_ring_t*          rings;
+    log_ring_t*          free_rings;
+} s_log = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static _Thread_local log_ring_t* s_ring;
+
+static const char s_level_chars[] = { 'D', 'I', 'W', 'E' };
+
+
+static void log_output(int level, uint64_t time, const char* text)
+{
+    FILE* out = level >= LOG_LEVEL_WARN ? stderr : stdout;
+    fprintf(out, "%10.3f %c %s\n", (time - s_log.origin) / 1e9, s_level_chars[level], text);
+}
+
+
+/**
+ * @brief Format a line: the tag, then the message, without the trailing newline the error messages have.
+ */
+static void log_format(char* text, const char* tag, const char* fmt, va_list args)
+{
+    int len = snprintf(text, LOG_LINE_LEN, "[%s] ", tag);
+    if (len >= 0 && len < LOG_LINE_LEN) {
+        vsnprintf(text + len, LOG_LINE_LEN - len, fmt, args);
+    }
+    len = strlen(text);
+    while (len > 0 && text[len - 1] == '\n') {
+        text[--len] = 0;
+    }
+}
+
+
+static void log_release_ring(void* arg)
+{
+    log_ring_t* ring = (log_ring_t*) arg;
+    pthread_mutex_lock(&s_log.lock);
+    ring->next_free = s_log.free_rings;
+    s_log.free_rings = ring;
+    pthread_mutex_unlock(&s_log.lock);
+}
+
+
+/**
+ * @brief Give a ring to the calling thread, a ring released by an exited thread still holding lines
+ * keeps them, they are written before the new ones.
+ */
+static log_ring_t* log_acquire_ring(void)
+{
+    pthread_mutex_lock(&s_log.lock);
+    log_ring_t* ring = s_log.free_rings;
+    if (ring != NULL) {
+        s_log.free_rings = ring->next_free;
+    } else {
+        ring = calloc(1, sizeof(log_ring_t));
+        if (ring != NULL) {
+            ring->next = s_log.rings;
+            s_log.rings = ring;
+        }
+    }
+    pthread_mutex_unlock(&s_log.lock);
+
+    if (ring != NULL) {
+        pthread_setspecific(s_log.key, ring);
+    }
+    return ring;
+}
+
+
+/**
+ * @brief Log a message from any thread. Once `log_init` succeeded, the message is formatted in the ring
+ * of the calling thread and written out by the background thread, the caller never waits on the output.
+ * Before that, or if the ring is full, the message is respectively written directly or dropped.
+ */
+void log_write(int level, const char* tag, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+
+    if (!atomic_load_explicit(&s_log.started, memory_order_acquire)) {
+        char text[LOG_LINE_LEN];
+        if (s_log.origin == 0) {
+            s_log.origin = perf_now();
+        }
+        log_format(text, tag, fmt, args);
+        log_output(level, perf_now(), text);
+        va_end(args);
+        return;
+    }
+
+    log_ring_t* ring = s_ring;
+    if (ring == NULL) {
+        ring = s_ring = log_acquire_ring();
+    }
+    const uint64_t head = ring ? atomic_load_explicit(&ring->head, memory_order_relaxed) : 0;
+    if (ring == NULL || head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_LINES) {
+        atomic_fetch_add(&s_log.dropped, 1);
+        va_end(args);
+        return;
+    }
+    log_line_t* line = &ring->lines[head % LOG_RING_LINES];
+    line->time = perf_now();
+    line->level = level;
+    log_format(line->text, tag, fmt, args);
+    va_end(args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    /* Only the first line of a batch wakes the background thread up */
+    if (!atomic_exchange(&s_log.pending, true)) {
+        pthread_cond_signal(&s_log.cond);
+    }
+}
+
+
+/**
+ * @brief Write all the pending lines, the lines of the different threads are merged by time.
+ * Only called by the background thread, or once it's over.
+ */
+static void log_drain(void)
+{
+    pthread_mutex_lock(&s_log.lock);
+    log_ring_t* rings = s_log.rings;
+    pthread_mutex_unlock(&s_log.lock);
+
+    while (true) {
+        log_ring_t* oldest = NULL;
+        const log_line_t* line = NULL;
+        for (log_ring_t* ring = rings; ring != NULL; ring = ring->next) {
+            const uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+                continue;
+            }
+            const log_line_t* candidate = &ring->lines[tail % LOG_RING_LINES];
+            if (line == NULL || candidate->time < line->time) {
+                oldest = ring;
+                line = candidate;
+            }
+        }
+        if (oldest == NULL) {
+            break;
+        }
+        log_output(line->level, line->time, line->text);
+        atomic_fetch_add_explicit(&oldest->tail, 1, memory_order_release);
+    }
+
+    const uint64_t dropped = atomic_exchange(&s_log.dropped, 0);
+    if (dropped > 0) {
+        fprintf(stderr, "%10.3f W [LOG] %llu lines dropped\n", (perf_now() - s_log.origin) / 1e9,
+                (unsigned long long) dropped);
+    }
+    fflush(stdout);
+}
+
+
+static void* log_thread(void* arg)
+{
+    (void) arg;
+    while (!atomic_load(&s_log.stop)) {
+        pthread_mutex_lock(&s_log.lock);
+        if (!atomic_load(&s_log.pending) && !atomic_load(&s_log.stop)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_FLUSH_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&s_log.cond, &s_log.lock, &deadline);
+        }
+        atomic_store(&s_log.pending, false);
+        pthread_mutex_unlock(&s_log.lock);
+        log_drain();
+    }
+    return NULL;
+}
+
+
+static void log_shutdown(void)
+{
+    pthread_mutex_lock(&s_log.lock);
+    atomic_store(&s_log.stop, true);
+    pthread_cond_signal(&s_log.cond);
+    pthread_mutex_unlock(&s_log.lock);
+    pthread_join(s_log.thread, NULL);
+    /* Lines logged from now on are written directly, write the ones still in the rings first */
+    atomic_store(&s_log.started, false);
+    log_drain();
+}
+
+
+/**
+ * @brief Start the background thread writing the log lines, they are all written when the program exits.
+ * Must be called once, before any other thread is started.
+ *
+ * @return true on success, the messages are written by the calling threads else.
+ */
+bool log_init(void)
+{
+    if (s_log.origin == 0) {
+        s_log.origin = perf_now();
+    }
+    if (pthread_key_create(&s_log.key, log_release_ring) != 0) {
+        LOG_W("LOG", "Could not create the thread key, logging synchronously");
+        return false;
+    }
+    if (pthread_create(&s_log.thread, NULL, log_thread, NULL) != 0) {
+        LOG_W("LOG", "Could not create the log thread, logging synchronously");
+        return false;
+    }
+    atexit(log_shutdown);
+    atomic_store(&s_log.started, true);
+    return true;
+}
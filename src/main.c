@@ -4,15 +4,26 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include "app_version.h"
 #include "app_icon.h"
 #include "raylib.h"
+#include "rlgl.h"
 #include "nuklear.h"
 #include "raylib-nuklear.h"
 #include "disk.h"
+#include "disk_cache.h"
+#include "disk_search.h"
 #include "popup.h"
+#include "job.h"
+#include "perf.h"
+#include "trace.h"
+#include "log.h"
+#include "zealfs.h"
 
 
 #define MIN_WIN_WIDTH   800
@@ -35,9 +46,141 @@
 
 static struct nk_context *ctx;
 static disk_info_t disks[MAX_DISKS];
+static int disk_count = 0;
+
+/* Called from the UI thread when the current background job is over */
+typedef void (*job_done_fn_t)(disk_info_t* disk, const char* error);
+static job_done_fn_t s_job_done;
+static disk_info_t* s_job_disk;
+
+/* Pages of the partitions read by the jobs, kept from one job to the next. Only the job thread uses it. */
+static zealfs_cache_t* s_page_cache;
+
+/* Result of the last recovery scan */
+static recovered_part_t s_recovered[MAX_RECOVERED_PARTS];
+static int s_recovered_count;
+
+/* Parameters of the transfers between a host folder and a partition */
+typedef struct {
+    popup_t         mode;
+    int             selected;
+    int             partition;
+    char            host_path[512];
+    char            zealfs_path[256];
+    nk_bool         compare;
+    zealfs_sync_t   sync;
+    char            message[256];
+} ui_transfer_t;
+static ui_transfer_t s_transfer = { .zealfs_path = "/" };
 
 int winWidth, winHeight;
 
+/* Set when a texture shown by the UI changed while the Nuklear commands stayed the same */
+static bool s_texture_changed;
+
+/* Set while the sector viewer waits for blocks, the frames must be drawn when they arrive */
+static bool s_io_pending;
+
+/* Bounds of the fixed arena `--nk-arena <KB>` gives to Nuklear, instead of letting it grow its buffers from
+ * the heap. The commands that don't fit are dropped, size it a few times the peak the debug overlay shows */
+#define UI_NK_ARENA_MIN     (64*KB)
+#define UI_NK_ARENA_MAX     (64*MB)
+
+/* Frame rate of the UI when it is drawn */
+#define UI_FRAME_NS     (1000000000ULL / 60)
+
+/* Debug overlay, toggled with F3, and the statistics of the last frame it shows */
+static bool s_overlay;
+static struct {
+    uint32_t commands;
+    nk_size  bytes;
+    int      draw_calls;
+} s_frame_stats;
+
+
+/**
+ * @brief Draw the frame only when the Nuklear commands differ from the previous frame's, and block until the
+ * next input event when nothing changed and no job is running, so that an idle window doesn't use any CPU.
+ */
+static void ui_render_frame(struct nk_context *ctx)
+{
+    static void* last_cmds = NULL;
+    static nk_size last_size = 0;
+    static nk_size last_capacity = 0;
+    /* Frames left to draw: one more after a change lets Nuklear settle (popups opened by a click show up
+     * on the next frame) and makes sure both buffers of the swap chain hold the new content */
+    static int pending = 0;
+    static uint64_t last_present = 0;
+
+    const void* cmds = nk_buffer_memory_const(&ctx->memory);
+    const nk_size size = ctx->memory.allocated;
+    if (s_overlay) {
+        const struct nk_command* cmd;
+        s_frame_stats.commands = 0;
+        nk_foreach(cmd, ctx) {
+            s_frame_stats.commands++;
+        }
+        s_frame_stats.bytes = size;
+    }
+    if (size != last_size || (size > 0 && memcmp(cmds, last_cmds, size) != 0)) {
+        /* The copy only grows, an empty frame must not make realloc free it */
+        if (size > last_capacity) {
+            void* copy = realloc(last_cmds, size);
+            if (copy != NULL) {
+                last_cmds = copy;
+                last_capacity = size;
+            }
+        }
+        if (size <= last_capacity) {
+            if (size > 0) {
+                memcpy(last_cmds, cmds, size);
+            }
+            last_size = size;
+        } else {
+            /* Compare again next frame */
+            last_size = 0;
+        }
+        pending = 2;
+    }
+    if (IsWindowResized() || s_texture_changed) {
+        s_texture_changed = false;
+        pending = 2;
+    }
+
+    if (pending > 0) {
+        pending--;
+        DisableEventWaiting();
+        const uint64_t draw_start = perf_now();
+        BeginDrawing();
+            ClearBackground(WHITE);
+            DrawNuklear(ctx);
+        perf_section_add(PERF_DRAW, draw_start);
+        const uint64_t swap_start = perf_now();
+        EndDrawing();
+        perf_section_add(PERF_SWAP, swap_start);
+        s_frame_stats.draw_calls = GetNuklearDrawCalls(ctx);
+
+        /* The frame rate is limited here rather than by raylib, so that the swap can be timed alone */
+        const uint64_t elapsed = perf_now() - last_present;
+        if (elapsed < UI_FRAME_NS) {
+            WaitTime((UI_FRAME_NS - elapsed) / 1e9);
+        }
+        last_present = perf_now();
+    } else if (job_running() || s_io_pending) {
+        /* Keep polling the job or the reads at the usual frame rate, their progress is not an input event */
+        nk_clear(ctx);
+        DisableEventWaiting();
+        WaitTime(1.0 / 60);
+        PollInputEvents();
+    } else {
+        nk_clear(ctx);
+        EnableEventWaiting();
+        PollInputEvents();
+    }
+    perf_frame_end();
+}
+
+
 /* This should only be the case for windows, but keep the code just in case */
 static int message_box(const char* message)
 {
@@ -57,12 +200,7 @@ static int message_box(const char* message)
         }
         nk_end(ctx);
 
-
-        BeginDrawing(); {
-            ClearBackground(WHITE);
-            DrawNuklear(ctx);
-        }
-        EndDrawing();
+        ui_render_frame(ctx);
     }
 
     UnloadNuklear(ctx);
@@ -83,55 +221,150 @@ static struct nk_color get_partition_color(int i)
 }
 
 
-static void ui_draw_disk(struct nk_context *ctx, const disk_info_t *disk, int* selected_part) {
+/* Preformatted content of a partition row and of its box in the disk bar */
+typedef struct {
+    bool            active;
+    struct nk_color color;
+    float           start_frac;
+    float           size_frac;
+    char            bar_label[16];
+    float           bar_label_width;
+    char            number[8];
+    const char*     fs_type;
+    char            start[16];
+    char            size[32];
+} ui_part_view_t;
+
+/* View of a disk, rebuilt only when the generation of the disk changes */
+typedef struct {
+    bool            valid;
+    uint32_t        generation;
+    ui_part_view_t  parts[MAX_PART_COUNT];
+    /* Partition bar rendered once, along with the state it was rendered for */
+    RenderTexture2D bar;
+    struct nk_image bar_image;
+    uint32_t        bar_generation;
+    int             bar_selected;
+} ui_disk_view_t;
+
+static ui_disk_view_t s_disk_views[MAX_DISKS];
+
+
+/**
+ * @brief Get the view of the given disk, formatting the strings of its rows only if its partitions changed
+ * since the last call.
+ */
+static ui_disk_view_t* ui_disk_view(struct nk_context *ctx, const disk_info_t *disk)
+{
+    ui_disk_view_t* view = &s_disk_views[disk - disks];
+    if (view->valid && view->generation == disk->generation) {
+        return view;
+    }
+
     const uint64_t total_sectors = disk->size_bytes / DISK_SECTOR_SIZE;
+    const struct nk_user_font* font = ctx->style.font;
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* part = &disk->staged_partitions[i];
+        ui_part_view_t* row = &view->parts[i];
+        row->active = part->active && part->size_sectors != 0;
+        if (!row->active) {
+            continue;
+        }
+        row->color = get_partition_color(i);
+        row->start_frac = (float)part->start_lba / (float)total_sectors;
+        row->size_frac = (float)part->size_sectors / (float)total_sectors;
+        snprintf(row->bar_label, sizeof(row->bar_label), "Part. %d", i);
+        row->bar_label_width = font->width(font->userdata, font->height, row->bar_label, strlen(row->bar_label));
+        snprintf(row->number, sizeof(row->number), "%d", i);
+        row->fs_type = disk_get_fs_type(part->type);
+        snprintf(row->start, sizeof(row->start), "0x%08x", part->start_lba * DISK_SECTOR_SIZE);
+        disk_get_size_str(part->size_sectors * DISK_SECTOR_SIZE, row->size, sizeof(row->size));
+    }
+    view->generation = disk->generation;
+    view->valid = true;
+    return view;
+}
 
-    nk_layout_row_dynamic(ctx, 100, 1);
-    struct nk_rect bounds = nk_widget_bounds(ctx);
-    float full_width = bounds.w;
-    struct nk_command_buffer *canvas = nk_window_get_canvas(ctx);
 
-    nk_fill_rect(canvas, bounds, 0, nk_rgb(220, 220, 220));
+/**
+ * @brief Render the partition bar of a disk view in its texture, `width` and `height` are in pixels.
+ */
+static void ui_render_disk_bar(struct nk_context *ctx, ui_disk_view_t* view, int selected, int width, int height)
+{
+    if (view->bar.id != 0 && (view->bar.texture.width != width || view->bar.texture.height != height)) {
+        UnloadRenderTexture(view->bar);
+        view->bar.id = 0;
+    }
+    if (view->bar.id == 0) {
+        view->bar = LoadRenderTexture(width, height);
+        view->bar_image = nk_subimage_ptr(&view->bar.texture, width, height, nk_rect(0, 0, width, height));
+    }
+
+    const float scale = GetNuklearScaling(ctx);
+    const Font font = *(const Font*) ctx->style.font->userdata.ptr;
+    const float font_size = ctx->style.font->height * scale;
+
+    BeginTextureMode(view->bar);
+    /* Render textures are stored bottom-up, flip the projection so that the bar can be drawn as a regular
+     * image. The flip reverses the winding of the triangles, the culling must be disabled meanwhile. */
+    rlMatrixMode(RL_PROJECTION);
+    rlLoadIdentity();
+    rlOrtho(0, width, 0, height, 0, 1);
+    rlMatrixMode(RL_MODELVIEW);
+    rlDisableBackfaceCulling();
 
+    ClearBackground(ColorFromNuklear(nk_rgb(220, 220, 220)));
     for (int i = 0; i < MAX_PART_COUNT; ++i) {
-        const partition_t *p = &disk->staged_partitions[i];
-        if (!p->active || p->size_sectors == 0)
+        const ui_part_view_t *row = &view->parts[i];
+        if (!row->active)
             continue;
 
-        float start_frac = (float)p->start_lba / (float)total_sectors;
-        float size_frac = (float)p->size_sectors / (float)total_sectors;
+        const Rectangle part_rect = {
+            .x = width * row->start_frac,
+            .y = 0,
+            .width = MAX(width * row->size_frac, 10 * scale),
+            .height = height,
+        };
+        DrawRectangleRec(part_rect, ColorFromNuklear(selected == i ? NK_SELECTED : NK_WHITE));
+        DrawRectangleLinesEx(part_rect, 5.0f * scale, ColorFromNuklear(row->color));
 
-        struct nk_rect part_rect = nk_rect(
-            bounds.x + full_width * start_frac,
-            bounds.y,
-            MAX(full_width * size_frac, 10),
-            bounds.h
-        );
+        /* Draw text centered if there is enough space (not counting the borders) */
+        const float text_width = row->bar_label_width * scale;
+        if (text_width < part_rect.width - 10 * scale) {
+            const Vector2 position = {
+                .x = part_rect.x + (part_rect.width - text_width) / 2.0f,
+                .y = (height - font_size) / 2.0f,
+            };
+            DrawTextEx(font, row->bar_label, position, font_size, font_size * RAYLIB_NUKLEAR_FONT_SPACING_RATIO,
+                       ColorFromNuklear(NK_BLACK));
+        }
+    }
 
-        struct nk_color part_color = get_partition_color(i);
+    rlEnableBackfaceCulling();
+    EndTextureMode();
+    s_texture_changed = true;
+}
 
-        if (*selected_part == i) {
-            nk_fill_rect(canvas, part_rect, 0, NK_SELECTED);
-        } else {
-            nk_fill_rect(canvas, part_rect, 0, NK_WHITE);
-        }
-        nk_stroke_rect(canvas, part_rect, 0, 5.0f, part_color);
 
-        char label[128];
-        snprintf(label, sizeof(label), "Part. %d", i);
+static void ui_draw_disk(struct nk_context *ctx, const disk_info_t *disk, int* selected_part) {
+    ui_disk_view_t* view = ui_disk_view(ctx, disk);
 
-        /* Measure text size */
-        float text_width = ctx->style.font->width(ctx->style.font->userdata, ctx->style.font->height, label, strlen(label));
-        float text_height = ctx->style.font->height;
+    nk_layout_row_dynamic(ctx, 100, 1);
+    struct nk_rect bounds = nk_widget_bounds(ctx);
+    struct nk_command_buffer *canvas = nk_window_get_canvas(ctx);
 
-        /* Draw text centered if there is enough space (not counting the borders) */
-        if (text_width < part_rect.w - 10) {
-            /* Compute centered position */
-            const float label_x = part_rect.x + (part_rect.w - text_width) / 2.0f;
-            const float label_y = part_rect.y + (part_rect.h - text_height) / 2.0f;
-            nk_draw_text(canvas, nk_rect(label_x, label_y, text_width, text_height),
-                label, strlen(label), ctx->style.font, NK_BLACK, NK_BLACK);
+    /* The bar is only rendered again when the partitions, the selection or its size change */
+    const float scale = GetNuklearScaling(ctx);
+    const int width = (int) (bounds.w * scale);
+    const int height = (int) (bounds.h * scale);
+    if (width > 0 && height > 0) {
+        if (view->bar.id == 0 || view->bar_generation != view->generation || view->bar_selected != *selected_part ||
+            view->bar.texture.width != width || view->bar.texture.height != height) {
+            ui_render_disk_bar(ctx, view, *selected_part, width, height);
+            view->bar_generation = view->generation;
+            view->bar_selected = *selected_part;
         }
+        nk_draw_image(canvas, bounds, &view->bar_image, NK_WHITE);
     }
 
     // Draw table header
@@ -164,9 +397,8 @@ static void ui_draw_disk(struct nk_context *ctx, const disk_info_t *disk, int* s
     nk_style_push_color(ctx, &ctx->style.selectable.pressed_active.data.color,  NK_TRANSPARENT);
 
     for (int i = 0; i < MAX_PART_COUNT; i++) {
-        char buffer[256];
-        const partition_t* part = &disk->staged_partitions[i];
-        if (!part->active || part->size_sectors == 0) {
+        const ui_part_view_t* row = &view->parts[i];
+        if (!row->active) {
             continue;
         }
 
@@ -186,25 +418,22 @@ static void ui_draw_disk(struct nk_context *ctx, const disk_info_t *disk, int* s
         bounds.w -= 10;
         bounds.y += 5;
         bounds.x += 5;
-        nk_fill_rect(canvas, bounds, 2.f, get_partition_color(i));
+        nk_fill_rect(canvas, bounds, 2.f, row->color);
         nk_bool select = false;
         nk_selectable_label(ctx, " ", NK_TEXT_LEFT, &select);
         nk_selectable_label(ctx, " ", NK_TEXT_LEFT, &select);
 
         /* Partition number */
-        sprintf(buffer, "%d", i);
-        nk_selectable_label(ctx, buffer, NK_TEXT_LEFT, &select);
+        nk_selectable_label(ctx, row->number, NK_TEXT_LEFT, &select);
 
         /* Partition file system */
-        nk_selectable_label(ctx, disk_get_fs_type(part->type), NK_TEXT_LEFT, &select);
+        nk_selectable_label(ctx, row->fs_type, NK_TEXT_LEFT, &select);
 
         /* Partition start address */
-        sprintf(buffer, "0x%08x", part->start_lba * DISK_SECTOR_SIZE);
-        nk_selectable_label(ctx, buffer, NK_TEXT_LEFT, &select);
+        nk_selectable_label(ctx, row->start, NK_TEXT_LEFT, &select);
 
         /* Partition size */
-        disk_get_size_str(part->size_sectors * DISK_SECTOR_SIZE, buffer, sizeof(buffer));
-        nk_selectable_label(ctx, buffer, NK_TEXT_RIGHT, &select);
+        nk_selectable_label(ctx, row->size, NK_TEXT_RIGHT, &select);
         nk_selectable_label(ctx, " ", NK_TEXT_LEFT, &select);
 
         if (select) {
@@ -243,6 +472,89 @@ static void ui_mbr_handle(struct nk_context *ctx, disk_info_t* disk)
 }
 
 
+/**
+ * @brief Get the page cache shared by the jobs that only read the partitions. A job writing to a disk
+ * drops all the cached pages first, and gets NULL so that its partition is mounted with a cache of its own.
+ */
+static zealfs_cache_t* ui_page_cache(bool write)
+{
+    if (write && s_page_cache != NULL) {
+        zealfs_cache_clear(s_page_cache);
+        return NULL;
+    }
+    return s_page_cache;
+}
+
+
+static const char* ui_apply_job(void* arg)
+{
+    ui_page_cache(true);
+    return disk_write_changes((disk_info_t*) arg);
+}
+
+
+static void ui_apply_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t result_info = {
+        .title = "Apply changes",
+    };
+    if (error_str) {
+        result_info.msg = error_str;
+        LOG_E("UI", "%s", error_str);
+    } else {
+        /* Success! Make the staged changes the current state and remove the pending changes mark */
+        disk_apply_changes(disk);
+        disk->label[0] = ' ';
+        result_info.msg = "Success!";
+    }
+    popup_open(POPUP_MBR, 300, 140, &result_info);
+}
+
+
+static void ui_start_job(const char* name, job_fn_t fn, disk_info_t* disk, job_done_fn_t done)
+{
+    static popup_info_t info = {
+        .title = "Busy",
+        .msg = "Another operation is still in progress",
+    };
+    if (job_start(name, fn, disk)) {
+        s_job_done = done;
+        s_job_disk = disk;
+    } else {
+        popup_open(POPUP_MBR, 300, 140, &info);
+    }
+}
+
+
+/**
+ * @brief Show the progress of the background job, if any, and notify its owner once it's over
+ */
+static void ui_job_handle(struct nk_context *ctx)
+{
+    const char* error_str = NULL;
+    if (job_finished(&error_str)) {
+        if (s_job_done) {
+            s_job_done(s_job_disk, error_str);
+        }
+        return;
+    }
+
+    const char* name = job_name();
+    if (name == NULL) {
+        return;
+    }
+
+    const float w = 300, h = 100;
+    const struct nk_rect position = nk_rect(winWidth / 2 - w / 2, winHeight / 2 - h / 2, w, h);
+    if (nk_begin(ctx, name, position, NK_WINDOW_TITLE | NK_WINDOW_BORDER)) {
+        nk_layout_row_dynamic(ctx, 30, 1);
+        nk_size progress = (nk_size) (job_get_progress() * 1000);
+        nk_progress(ctx, &progress, 1000, NK_FIXED);
+    }
+    nk_end(ctx);
+}
+
+
 static void ui_apply_handle(struct nk_context *ctx, disk_info_t* disk)
 {
     struct nk_rect position;
@@ -253,28 +565,15 @@ static void ui_apply_handle(struct nk_context *ctx, disk_info_t* disk)
             nk_label_wrap(ctx, "Apply changes to disk? This action is permanent and cannot be undone.");
             nk_layout_row_dynamic(ctx, 30, 2);
             if (nk_button_label(ctx, "Yes")) {
-                static popup_info_t result_info = {
-                    .title = "Apply changes",
-                    .msg = "Success!"
-                };
-                const char* error_str = disk_write_changes(disk);
-                if (error_str) {
-                    result_info.msg = error_str;
-                    printf("%s\n", error_str);
-                } else {
-                    /* Success! Remove the pending changes mark */
-                    disk->label[0] = ' ';
-                }
+                /* Writing may take a while when partitions are cloned, do it in the background */
                 popup_close(POPUP_APPLY);
-                popup_open(POPUP_MBR, 300, 140, &result_info);
+                ui_start_job("Applying changes", ui_apply_job, disk, ui_apply_done);
             } else if (nk_button_label(ctx, "No")) {
                 popup_close(POPUP_APPLY);
             }
         }
         nk_end(ctx);
     }
-
-    (void) disk;
 }
 
 
@@ -378,124 +677,1519 @@ static void ui_new_partition(struct nk_context *ctx, disk_info_t* disk)
     nk_end(ctx);
 }
 
-static void setup_window() {
-    InitWindow(0, 0, "Zeal Disk Tool " VERSION);
+/**
+ * @brief Render the popup to clone a ZealFS partition, from any disk, into the current disk
+ */
+static void ui_clone_partition(struct nk_context *ctx, disk_info_t* disk)
+{
+    struct nk_rect position;
+    void *arg;
+    if (!popup_is_opened(POPUP_CLONE, &position, &arg)) {
+        return;
+    }
+    if (nk_begin(ctx, "Clone a partition", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        /* List all the committed ZealFS partitions of all the disks */
+        static char labels[MAX_DISKS * MAX_PART_COUNT][128];
+        const char* items[MAX_DISKS * MAX_PART_COUNT];
+        const disk_info_t* sources[MAX_DISKS * MAX_PART_COUNT];
+        int source_parts[MAX_DISKS * MAX_PART_COUNT];
+        int count = 0;
+
+        for (int d = 0; d < disk_count; d++) {
+            for (int i = 0; i < MAX_PART_COUNT; i++) {
+                const partition_t* part = &disks[d].partitions[i];
+                if (!part->active || part->type != 0x5a) {
+                    continue;
+                }
+                char size_str[32];
+                disk_get_size_str((uint64_t) part->size_sectors * DISK_SECTOR_SIZE, size_str, sizeof(size_str));
+                snprintf(labels[count], sizeof(labels[count]), "%s - Part. %d (%s)", disks[d].name, i, size_str);
+                items[count] = labels[count];
+                sources[count] = &disks[d];
+                source_parts[count] = i;
+                count++;
+            }
+        }
 
-    // get current monitor details
-    int mw, mh;
-    int monitor = GetCurrentMonitor();
-    mw = GetMonitorWidth(monitor);
-    mh = GetMonitorHeight(monitor);
+        if (disk->free_part_idx == -1 || count == 0) {
+            nk_layout_row_dynamic(ctx, 30, 1);
+            nk_label(ctx, count == 0 ? "No ZealFS partition to clone" : "No free partition found on this disk",
+                     NK_TEXT_CENTERED);
+            if (nk_button_label(ctx, "Cancel")) {
+                popup_close(POPUP_CLONE);
+            }
+            nk_end(ctx);
+            return;
+        }
 
-    // clamp the window size to either WIN_SCALE or MIN
-    winWidth = NK_MAX(MIN_WIN_WIDTH, mw * WIN_SCALE);
-    winHeight = NK_MAX(MIN_WIN_HEIGHT, winWidth * WIN_ASPECT);
-    SetWindowSize(winWidth, winHeight);
+        const float ratio[] = { 0.3f, 0.6f };
+        nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 2, ratio);
 
-    // center the window on the current monitor
-    Vector2 mon_pos = GetMonitorPosition(monitor);
-    int pos_x = mon_pos.x, pos_y = mon_pos.y;
-    pos_x += (mw - winWidth) / 2;
-    pos_y += (mh - winHeight) / 2;
-    SetWindowPosition(pos_x, pos_y);
+        int *selected = (int*) arg;
+        *selected = NK_MIN(*selected, count - 1);
+        nk_label(ctx, "Source:", NK_TEXT_CENTERED);
+        const float width = nk_widget_width(ctx);
+        *selected = nk_combo(ctx, items, count, *selected, COMBO_HEIGHT, nk_vec2(width, 150));
 
-#ifndef __APPLE__
-    /* Set an icon for the application */
-    Image icon = LoadImageFromMemory(".png", s_app_icon_png, sizeof(s_app_icon_png));
-    SetWindowIcon(icon);
-#endif
-}
+        /* The clone has the same size as its source */
+        uint32_t largest_free_lba_addr = 0;
+        const uint32_t free_sectors = disk_aligned_free_space(disk, &largest_free_lba_addr);
+        const bool fits = free_sectors >= sources[*selected]->partitions[source_parts[*selected]].size_sectors;
 
-int main(void) {
-    SetTraceLogLevel(LOG_WARNING);
-    setup_window();
+        char address[16];
+        const long unsigned largest_free_addr = largest_free_lba_addr * DISK_SECTOR_SIZE;
+        nk_label(ctx, "Address:", NK_TEXT_CENTERED);
+        if (fits) {
+            snprintf(address, sizeof(address), "0x%08lx", largest_free_addr);
+            nk_label(ctx, address, NK_TEXT_LEFT);
+        } else {
+            nk_label(ctx, "Not enough free space", NK_TEXT_LEFT);
+        }
 
-    SetTargetFPS(60);
-    popup_init(winWidth, winHeight);
+        nk_layout_row_dynamic(ctx, 30, 2);
 
-    int disk_count = 0;
-    disk_err_t err = disk_list(disks, MAX_DISKS, &disk_count);
+        /* One line padding */
+        nk_label(ctx, "", NK_TEXT_CENTERED);
+        nk_label(ctx, "", NK_TEXT_CENTERED);
 
-    /* Mac/Linux targets only */
-    if (err == ERR_NOT_ROOT) {
-        printf("You must run this program as root\n");
-        return 1;
-    } else if (err == ERR_NOT_ADMIN) {
-        return message_box("You must run this program as Administrator!\n");
+        if (fits && nk_button_label(ctx, "Clone")) {
+            static popup_info_t info = { .title = "Clone a partition" };
+            info.msg = disk_clone_partition(disk, largest_free_lba_addr, sources[*selected], source_parts[*selected]);
+            popup_close(POPUP_CLONE);
+            if (info.msg) {
+                popup_open(POPUP_MBR, 300, 140, &info);
+            } else {
+                /* Show in the disk list that some changes are pending for the disk */
+                disk->label[0] = '*';
+            }
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(POPUP_CLONE);
+        }
     }
+    nk_end(ctx);
+}
 
-    const int fontSize = 13;
-    Font font = LoadFontFromNuklear(fontSize);
-    ctx = InitNuklearEx(font, fontSize);
+static const char* ui_recover_job(void* arg)
+{
+    return disk_recover_scan((disk_info_t*) arg, s_recovered, MAX_RECOVERED_PARTS, &s_recovered_count);
+}
 
-    /* Construct the labels for the disks */
-    static const char* disk_labels[MAX_DISKS] = { 0 };
-    int selected_disk = 0;
-    for (int i = 0; i < disk_count; ++i) {
-        char size_str[128];
-        disk_get_size_str(disks[i].size_bytes, size_str, sizeof(size_str));
-        /* Keep the first character empty, it will be a `*` in case there is any pending change */
-        snprintf(disks[i].label, DISK_LABEL_LEN, " %.*s (%s)", (int) sizeof(disks[i].name), disks[i].name, size_str);
-        disk_labels[i] = disks[i].label;
-        disk_parse_mbr_partitions(&disks[i]);
-    }
 
-    if (disk_count == 0) {
-        disk_labels[0] = "No disk found";
+static void ui_recover_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Recover partitions",
+    };
+    if (error_str) {
+        info.msg = error_str;
+        popup_open(POPUP_MBR, 300, 140, &info);
+    } else {
+        popup_open(POPUP_RECOVER, 500, 300, NULL);
     }
+}
 
-    int selected_partition = 0;
-
-    while (!WindowShouldClose()) {
-        UpdateNuklear(ctx);
-
-        /* If any popup is opened, the main window must not be focusable */
-        const int flags = popup_any_opened() ? NK_WINDOW_NO_INPUT : 0;
-        disk_info_t* current_disk = &disks[selected_disk];
-
-        if (nk_begin(ctx, "Disks", nk_rect(0, 0, winWidth, winHeight), flags)) {
 
-            /* Create the top row with the buttons and the disk selection */
-            const float ratio[] = { 0.10f, 0.15f, 0.15f, 0.07f, 0.07f, 0.15f, 0.4f };
-            nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 7, ratio);
+/**
+ * @brief Render the list of ZealFS partitions found by the recovery scan
+ */
+static void ui_recover_partition(struct nk_context *ctx, disk_info_t* disk)
+{
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_RECOVER, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, "Recover partitions", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        nk_layout_row_dynamic(ctx, 30, 1);
+        if (s_recovered_count == 0) {
+            nk_label(ctx, "No ZealFS partition found on this disk", NK_TEXT_CENTERED);
+        } else {
+            nk_label(ctx, "ZealFS partitions found on the disk:", NK_TEXT_LEFT);
+        }
 
-            /* Create the button with label "MBR" */
-            if (nk_widget_is_hovered(ctx)) {
-                nk_tooltip(ctx, "Create an MBR on the disk");
+        const float ratios[] = { 0.25f, 0.2f, 0.35f, 0.2f };
+        for (int i = 0; i < s_recovered_count; i++) {
+            const recovered_part_t* found = &s_recovered[i];
+            char buffer[64];
+            nk_layout_row(ctx, NK_DYNAMIC, 25, 4, ratios);
+
+            snprintf(buffer, sizeof(buffer), "0x%08llx", (unsigned long long) found->start_lba * DISK_SECTOR_SIZE);
+            nk_label(ctx, buffer, NK_TEXT_LEFT);
+            disk_get_size_str((uint64_t) found->size_sectors * DISK_SECTOR_SIZE, buffer, sizeof(buffer));
+            nk_label(ctx, buffer, NK_TEXT_LEFT);
+            snprintf(buffer, sizeof(buffer), "%u/%u pages used", found->used_pages, found->total_pages);
+            nk_label(ctx, buffer, NK_TEXT_LEFT);
+
+            /* Do not propose the partitions that are already in the MBR */
+            bool present = false;
+            for (int p = 0; p < MAX_PART_COUNT; p++) {
+                present |= disk->staged_partitions[p].active && disk->staged_partitions[p].start_lba == found->start_lba;
             }
-            /* Only enable the buttons if we have at least one disk */
-            if (nk_button_label(ctx, "Create MBR") && disk_count > 0) {
-                static popup_info_t info;
-                info.title = "Create MBR table";
-                if (current_disk->has_mbr) {
-                    info.msg = "Selected disk already has an MBR";
+            if (present) {
+                nk_label(ctx, "In MBR", NK_TEXT_CENTERED);
+            } else if (nk_button_label(ctx, "Add")) {
+                static popup_info_t info = { .title = "Recover partitions" };
+                info.msg = disk_recover_partition(disk, found);
+                if (info.msg) {
+                    popup_close(POPUP_RECOVER);
+                    popup_open(POPUP_MBR, 300, 140, &info);
                 } else {
-                    info.msg = "Feature not supported yet";
-                    // mbr_last_msg = "MBR created successfully!";
+                    disk->label[0] = '*';
                 }
-                popup_open(POPUP_MBR, 300, 140, &info);
             }
+        }
 
-            /* Create the button to add a new partition */
-            if (nk_widget_is_hovered(ctx)) {
-                nk_tooltip(ctx, "Create a new partition on the disk");
-            }
-            if (nk_button_label(ctx, "New partition") && disk_count > 0) {
-                static int choosen_option = 0;
-                popup_open(POPUP_NEWPART, 300, 300, &choosen_option);
-            }
+        nk_layout_row_dynamic(ctx, 30, 1);
+        if (nk_button_label(ctx, "Close")) {
+            popup_close(POPUP_RECOVER);
+        }
+    }
+    nk_end(ctx);
+}
 
-            /* Create the button to delete a partition */
-            if (nk_widget_is_hovered(ctx)) {
-                nk_tooltip(ctx, "Delete the selected partition on the disk");
-            }
-            if ((nk_button_label(ctx, "Delete partition") || IsKeyPressed(KEY_DELETE)) && disk_count > 0) {
-                disk_delete_partition(current_disk, selected_partition);
-            }
 
-            /* Create the button to commit the changes */
-            if (nk_widget_is_hovered(ctx)) {
-                nk_tooltip(ctx, "Apply all the changes to the selected disk");
+/**
+ * @brief Render a combo box listing the committed ZealFS partitions of the disk, on a row of two columns.
+ * The partitions are accessed directly on the disk by the tools, so the disk must not have pending changes.
+ *
+ * @return Index of the selected partition, -1 if none can be selected, in which case a message is shown.
+ */
+static int ui_zealfs_combo(struct nk_context *ctx, const disk_info_t* disk, int* selected, const float ratio[2])
+{
+    static char labels[MAX_PART_COUNT][64];
+    const char* items[MAX_PART_COUNT];
+    int parts[MAX_PART_COUNT];
+    int count = 0;
+
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        const partition_t* part = &disk->partitions[i];
+        if (!part->active || part->type != 0x5a) {
+            continue;
+        }
+        char size_str[32];
+        disk_get_size_str((uint64_t) part->size_sectors * DISK_SECTOR_SIZE, size_str, sizeof(size_str));
+        snprintf(labels[count], sizeof(labels[count]), "Partition %d (%s)", i, size_str);
+        items[count] = labels[count];
+        parts[count] = i;
+        count++;
+    }
+
+    if (count == 0 || disk->has_staged_changes) {
+        nk_layout_row_dynamic(ctx, 30, 1);
+        nk_label(ctx, count == 0 ? "No ZealFS partition on this disk" : "Apply or cancel the pending changes first",
+                 NK_TEXT_CENTERED);
+        return -1;
+    }
+
+    nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 2, ratio);
+    *selected = NK_MIN(*selected, count - 1);
+    nk_label(ctx, "Partition:", NK_TEXT_CENTERED);
+    const float width = nk_widget_width(ctx);
+    *selected = nk_combo(ctx, items, count, *selected, COMBO_HEIGHT, nk_vec2(width, 150));
+    return parts[*selected];
+}
+
+
+static const char* ui_transfer_job(void* arg)
+{
+    disk_info_t* disk = (disk_info_t*) arg;
+    const bool write = s_transfer.mode != POPUP_EXPORT;
+    disk_handle_t* handle;
+    zealfs_t fs;
+
+    const char* err = disk_open(disk, write, &handle);
+    if (err) {
+        return err;
+    }
+    err = zealfs_mount(&fs, handle, disk, s_transfer.partition, ui_page_cache(write));
+    if (err == NULL) {
+        if (s_transfer.mode == POPUP_IMPORT) {
+            err = zealfs_import(&fs, s_transfer.host_path, s_transfer.zealfs_path, NULL);
+        } else if (s_transfer.mode == POPUP_SYNC) {
+            err = zealfs_sync(&fs, s_transfer.host_path, s_transfer.zealfs_path, s_transfer.compare, &s_transfer.sync);
+        } else {
+            err = zealfs_export(&fs, s_transfer.zealfs_path, s_transfer.host_path);
+        }
+    }
+    if (fs.header != NULL && write) {
+        /* Even on error, write what was done so far, the file that failed was removed */
+        const char* flush_err = zealfs_flush(&fs);
+        err = err ? err : flush_err;
+    }
+    zealfs_unmount(&fs);
+    disk_close(handle);
+    return err;
+}
+
+
+static void ui_transfer_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Transfer",
+    };
+    const zealfs_sync_t* sync = &s_transfer.sync;
+    (void) disk;
+    if (error_str) {
+        info.msg = error_str;
+    } else if (s_transfer.mode == POPUP_SYNC) {
+        snprintf(s_transfer.message, sizeof(s_transfer.message),
+                 "%u unchanged, %u updated, %u created, %u removed, %u pages written",
+                 sync->unchanged, sync->updated, sync->created, sync->removed, sync->pages_written);
+        info.msg = s_transfer.message;
+    } else {
+        info.msg = "Success!";
+    }
+    popup_open(POPUP_MBR, 300, 140, &info);
+}
+
+
+/**
+ * @brief Render the popup to transfer files between a host folder and a ZealFS partition of the current disk,
+ * `id` is POPUP_IMPORT, POPUP_SYNC or POPUP_EXPORT
+ */
+static void ui_transfer_folder(struct nk_context *ctx, disk_info_t* disk, popup_t id)
+{
+    static const char* const titles[] = {
+        [POPUP_IMPORT] = "Import folder",
+        [POPUP_SYNC]   = "Synchronize folder",
+        [POPUP_EXPORT] = "Export files",
+    };
+    const bool to_zealfs = id != POPUP_EXPORT;
+    struct nk_rect position;
+    if (!popup_is_opened(id, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, titles[id], position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        const int partition = ui_zealfs_combo(ctx, disk, &s_transfer.selected, ratio);
+        if (partition < 0) {
+            if (nk_button_label(ctx, "Cancel")) {
+                popup_close(id);
+            }
+            nk_end(ctx);
+            return;
+        }
+
+        /* The source is always on the first line */
+        char* const host = s_transfer.host_path;
+        char* const zealfs = s_transfer.zealfs_path;
+        nk_label(ctx, to_zealfs ? "Host folder:" : "Source:", NK_TEXT_CENTERED);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, to_zealfs ? host : zealfs,
+                                       to_zealfs ? sizeof(s_transfer.host_path) : sizeof(s_transfer.zealfs_path),
+                                       nk_filter_default);
+        nk_label(ctx, to_zealfs ? "Destination:" : "Host folder:", NK_TEXT_CENTERED);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, to_zealfs ? zealfs : host,
+                                       to_zealfs ? sizeof(s_transfer.zealfs_path) : sizeof(s_transfer.host_path),
+                                       nk_filter_default);
+        if (id == POPUP_SYNC) {
+            nk_layout_row_dynamic(ctx, 30, 1);
+            nk_checkbox_label(ctx, "Compare the content of all the files", &s_transfer.compare);
+        }
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (nk_button_label(ctx, "Start") && host[0] != 0) {
+            s_transfer.mode = id;
+            s_transfer.partition = partition;
+            popup_close(id);
+            ui_start_job(titles[id], ui_transfer_job, disk, ui_transfer_done);
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(id);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* Parameters and result of the consistency check */
+static struct {
+    int             selected;
+    int             partition;
+    nk_bool         repair;
+    zealfs_fsck_t   report;
+    char            message[256];
+} s_fsck;
+
+
+static const char* ui_fsck_job(void* arg)
+{
+    disk_info_t* disk = (disk_info_t*) arg;
+    disk_handle_t* handle;
+    zealfs_t fs;
+
+    const char* err = disk_open(disk, s_fsck.repair, &handle);
+    if (err) {
+        return err;
+    }
+    err = zealfs_mount(&fs, handle, disk, s_fsck.partition, ui_page_cache(s_fsck.repair));
+    if (err == NULL) {
+        err = zealfs_fsck(&fs, s_fsck.repair, &s_fsck.report);
+    }
+    if (err == NULL && s_fsck.repair) {
+        err = zealfs_flush(&fs);
+    }
+    zealfs_unmount(&fs);
+    disk_close(handle);
+    return err;
+}
+
+
+static void ui_fsck_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Check partition",
+    };
+    const zealfs_fsck_t* r = &s_fsck.report;
+    (void) disk;
+    if (error_str) {
+        info.msg = error_str;
+    } else {
+        snprintf(s_fsck.message, sizeof(s_fsck.message),
+                 "%u leaked, %u unmarked, %u cross-linked, %u dangling, %u/%u free pages%s",
+                 r->leaked_pages, r->unmarked_pages, r->cross_linked, r->dangling,
+                 r->free_pages, r->expected_free_pages, s_fsck.repair ? " (repaired)" : "");
+        info.msg = s_fsck.message;
+    }
+    popup_open(POPUP_MBR, 400, 140, &info);
+}
+
+
+/**
+ * @brief Render the popup to check, and optionally repair, a ZealFS partition of the current disk
+ */
+static void ui_check_partition(struct nk_context *ctx, disk_info_t* disk)
+{
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_FSCK, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, "Check partition", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        const int partition = ui_zealfs_combo(ctx, disk, &s_fsck.selected, ratio);
+        if (partition >= 0) {
+            nk_layout_row_dynamic(ctx, 30, 1);
+            nk_checkbox_label(ctx, "Repair the errors found", &s_fsck.repair);
+        }
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (partition >= 0 && nk_button_label(ctx, "Check")) {
+            s_fsck.partition = partition;
+            popup_close(POPUP_FSCK);
+            ui_start_job("Checking partition", ui_fsck_job, disk, ui_fsck_done);
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(POPUP_FSCK);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* Workload and result of the page size advisor */
+#define ADVISOR_MAX_ROWS    160
+static struct {
+    char                path[512];
+    nk_bool             all_pages;
+    bool                done;
+    zealfs_workload_t   workload;
+    zealfs_advice_t     rows[ADVISOR_MAX_ROWS];
+    int                 row_count;
+    int                 recommended;
+} s_advisor;
+
+
+static const char* ui_advisor_job(void* arg)
+{
+    struct stat st;
+    (void) arg;
+
+    zealfs_workload_free(&s_advisor.workload);
+    if (stat(s_advisor.path, &st) != 0) {
+        return "The folder or histogram file doesn't exist";
+    }
+    const char* err = S_ISDIR(st.st_mode) ? zealfs_workload_from_dir(&s_advisor.workload, s_advisor.path)
+                                          : zealfs_workload_from_histogram(&s_advisor.workload, s_advisor.path);
+    if (err == NULL) {
+        s_advisor.row_count = zealfs_advise(&s_advisor.workload, s_advisor.rows, ADVISOR_MAX_ROWS,
+                                            &s_advisor.recommended);
+    }
+    return err;
+}
+
+
+static void ui_advisor_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Page size advisor",
+    };
+    (void) disk;
+    s_advisor.done = error_str == NULL;
+    if (error_str) {
+        info.msg = error_str;
+        popup_open(POPUP_MBR, 300, 140, &info);
+    } else {
+        popup_open(POPUP_ADVISOR, 600, 420, NULL);
+    }
+}
+
+
+/**
+ * @brief Render the page size advisor: the workload, a host folder or a histogram of file sizes, is simulated
+ * on all the partition sizes to show the space lost to the slack and to the metadata for each of them.
+ */
+static void ui_page_advisor(struct nk_context *ctx, disk_info_t* disk)
+{
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_ADVISOR, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, "Page size advisor", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 2, ratio);
+        nk_label(ctx, "Folder or histogram:", NK_TEXT_CENTERED);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, s_advisor.path, sizeof(s_advisor.path), nk_filter_default);
+        nk_layout_row_dynamic(ctx, 30, 1);
+        nk_checkbox_label(ctx, "Show the page sizes the format doesn't use", &s_advisor.all_pages);
+
+        if (s_advisor.done) {
+            const zealfs_workload_t* wl = &s_advisor.workload;
+            char buffer[128];
+            char size_str[32];
+            disk_get_size_str(wl->bytes, size_str, sizeof(size_str));
+            snprintf(buffer, sizeof(buffer), "%llu files, %s, %u directories",
+                     (unsigned long long) wl->files, size_str, wl->dir_count);
+            nk_label(ctx, buffer, NK_TEXT_LEFT);
+
+            const float ratios[] = { 0.15f, 0.12f, 0.22f, 0.17f, 0.17f, 0.17f };
+            static const char* const headers[] = { "Partition", "Page", "Used pages", "Slack", "Metadata", "" };
+            nk_layout_row(ctx, NK_DYNAMIC, 20, 6, ratios);
+            for (int i = 0; i < 6; i++) {
+                nk_label(ctx, headers[i], NK_TEXT_LEFT);
+            }
+            for (int i = 0; i < s_advisor.row_count; i++) {
+                const zealfs_advice_t* row = &s_advisor.rows[i];
+                if (!row->standard && !s_advisor.all_pages) {
+                    continue;
+                }
+                nk_layout_row(ctx, NK_DYNAMIC, 20, 6, ratios);
+                disk_get_size_str(row->part_size, size_str, sizeof(size_str));
+                nk_label(ctx, size_str, NK_TEXT_LEFT);
+                disk_get_size_str(row->page_bytes, size_str, sizeof(size_str));
+                nk_label(ctx, size_str, NK_TEXT_LEFT);
+                snprintf(buffer, sizeof(buffer), "%u/%u", row->used_pages, row->usable_pages);
+                nk_label(ctx, buffer, NK_TEXT_LEFT);
+                disk_get_size_str(row->slack, size_str, sizeof(size_str));
+                nk_label(ctx, size_str, NK_TEXT_LEFT);
+                disk_get_size_str(row->overhead, size_str, sizeof(size_str));
+                nk_label(ctx, size_str, NK_TEXT_LEFT);
+                if (i == s_advisor.recommended) {
+                    nk_label(ctx, "Recommended", NK_TEXT_LEFT);
+                } else if (!row->standard) {
+                    nk_label(ctx, "Not supported", NK_TEXT_LEFT);
+                } else {
+                    nk_label(ctx, row->fits ? "Fits" : "Too small", NK_TEXT_LEFT);
+                }
+            }
+        }
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (nk_button_label(ctx, "Analyze") && s_advisor.path[0] != 0) {
+            /* The workload is rebuilt by the job, it must not be rendered meanwhile */
+            s_advisor.done = false;
+            popup_close(POPUP_ADVISOR);
+            ui_start_job("Analyzing files", ui_advisor_job, disk, ui_advisor_done);
+        }
+        if (nk_button_label(ctx, "Close")) {
+            popup_close(POPUP_ADVISOR);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* Parameters and result of the defragmentation */
+static struct {
+    int             selected;
+    int             partition;
+    zealfs_defrag_t report;
+    char            message[256];
+} s_defrag;
+
+
+static const char* ui_defrag_job(void* arg)
+{
+    disk_info_t* disk = (disk_info_t*) arg;
+    disk_handle_t* handle;
+    zealfs_t fs;
+
+    const char* err = disk_open(disk, true, &handle);
+    if (err) {
+        return err;
+    }
+    err = zealfs_mount(&fs, handle, disk, s_defrag.partition, ui_page_cache(true));
+    if (err == NULL) {
+        err = zealfs_defrag(&fs, &s_defrag.report);
+    }
+    zealfs_unmount(&fs);
+    disk_close(handle);
+    return err;
+}
+
+
+static void ui_defrag_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Defragment partition",
+    };
+    const zealfs_frag_t* before = &s_defrag.report.before;
+    const zealfs_frag_t* after = &s_defrag.report.after;
+    (void) disk;
+    if (error_str) {
+        info.msg = error_str;
+    } else {
+        snprintf(s_defrag.message, sizeof(s_defrag.message),
+                 "Fragmented entries: %u -> %u, extents: %u -> %u, free extents: %u -> %u, %u pages moved",
+                 before->fragmented, after->fragmented, before->extents, after->extents,
+                 before->free_extents, after->free_extents, s_defrag.report.pages_moved);
+        info.msg = s_defrag.message;
+    }
+    popup_open(POPUP_MBR, 400, 140, &info);
+}
+
+
+/**
+ * @brief Render the popup to defragment a ZealFS partition of the current disk
+ */
+static void ui_defrag_partition(struct nk_context *ctx, disk_info_t* disk)
+{
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_DEFRAG, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, "Defragment partition", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        const int partition = ui_zealfs_combo(ctx, disk, &s_defrag.selected, ratio);
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (partition >= 0 && nk_button_label(ctx, "Start")) {
+            s_defrag.partition = partition;
+            popup_close(POPUP_DEFRAG);
+            ui_start_job("Defragmenting partition", ui_defrag_job, disk, ui_defrag_done);
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(POPUP_DEFRAG);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* Parameters and result of the partition resize */
+static struct {
+    int             selected;
+    int             size_selected;
+    int             partition;
+    uint64_t        size;
+    bool            grow;
+    bool            mbr_written;
+    uint32_t        relocated;
+    char            message[256];
+} s_resize;
+
+
+static const char* ui_resize_job(void* arg)
+{
+    disk_info_t* disk = (disk_info_t*) arg;
+    disk_handle_t* handle;
+    zealfs_t fs;
+    const char* err = NULL;
+
+    /* The partition must cover the file system at all times: the MBR entry grows first and shrinks last */
+    s_resize.mbr_written = false;
+    if (s_resize.grow) {
+        err = disk_write_changes(disk);
+        if (err) {
+            return err;
+        }
+        s_resize.mbr_written = true;
+    }
+    err = disk_open(disk, true, &handle);
+    if (err) {
+        return err;
+    }
+    err = zealfs_mount(&fs, handle, disk, s_resize.partition, ui_page_cache(true));
+    if (err == NULL) {
+        err = zealfs_resize_partition(&fs, s_resize.size, &s_resize.relocated);
+    }
+    zealfs_unmount(&fs);
+    disk_close(handle);
+    if (err == NULL && !s_resize.grow) {
+        err = disk_write_changes(disk);
+        s_resize.mbr_written = err == NULL;
+    }
+    return err;
+}
+
+
+static void ui_resize_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Resize partition",
+    };
+    if (s_resize.mbr_written) {
+        disk_apply_changes(disk);
+    } else {
+        disk_revert_changes(disk);
+    }
+    if (error_str) {
+        info.msg = error_str;
+    } else {
+        char size_str[32];
+        disk_get_size_str(s_resize.size, size_str, sizeof(size_str));
+        snprintf(s_resize.message, sizeof(s_resize.message), "Partition %d resized to %s, %u pages relocated",
+                 s_resize.partition, size_str, s_resize.relocated);
+        info.msg = s_resize.message;
+    }
+    popup_open(POPUP_MBR, 400, 140, &info);
+}
+
+
+/**
+ * @brief Render the popup to grow or shrink a ZealFS partition of the current disk
+ */
+static void ui_resize_partition(struct nk_context *ctx, disk_info_t* disk)
+{
+    static char labels[16][32];
+    const char* items[16];
+    uint64_t sizes[16];
+    int count = 0;
+
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_RESIZE, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, "Resize partition", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        const int partition = ui_zealfs_combo(ctx, disk, &s_resize.selected, ratio);
+
+        /* The page size follows the partition size, only the sizes sharing the current page size are proposed */
+        if (partition >= 0) {
+            const uint64_t current = (uint64_t) disk->partitions[partition].size_sectors * DISK_SECTOR_SIZE;
+            for (uint64_t size = 64*KB; size <= 4*GB; size *= 2) {
+                if (size != current && zealfsv2_page_size(size) == zealfsv2_page_size(current)) {
+                    disk_get_size_str(size, labels[count], sizeof(labels[count]));
+                    items[count] = labels[count];
+                    sizes[count] = size;
+                    count++;
+                }
+            }
+            nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 2, ratio);
+            nk_label(ctx, "New size:", NK_TEXT_CENTERED);
+            if (count > 0) {
+                s_resize.size_selected = NK_MIN(s_resize.size_selected, count - 1);
+                const float width = nk_widget_width(ctx);
+                s_resize.size_selected = nk_combo(ctx, items, count, s_resize.size_selected, COMBO_HEIGHT,
+                                                  nk_vec2(width, 150));
+            } else {
+                nk_label(ctx, "None with the same page size", NK_TEXT_LEFT);
+            }
+        }
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (count > 0 && nk_button_label(ctx, "Start")) {
+            const uint64_t size = sizes[s_resize.size_selected];
+            const char* err = disk_resize_partition(disk, partition, (uint32_t) (size / DISK_SECTOR_SIZE));
+            popup_close(POPUP_RESIZE);
+            if (err) {
+                static popup_info_t info = {
+                    .title = "Resize partition",
+                };
+                info.msg = err;
+                popup_open(POPUP_MBR, 400, 140, &info);
+            } else {
+                s_resize.partition = partition;
+                s_resize.size = size;
+                s_resize.grow = size > (uint64_t) disk->partitions[partition].size_sectors * DISK_SECTOR_SIZE;
+                ui_start_job("Resizing partition", ui_resize_job, disk, ui_resize_done);
+            }
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(POPUP_RESIZE);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* Parameters of the backups and restores */
+static struct {
+    popup_t         mode;
+    int             selected;
+    int             partition;
+    char            path[512];
+} s_backup;
+
+
+static const char* ui_backup_job(void* arg)
+{
+    disk_info_t* disk = (disk_info_t*) arg;
+    const bool restore = s_backup.mode == POPUP_RESTORE;
+    disk_handle_t* handle;
+    zealfs_t fs;
+
+    const char* err = disk_open(disk, restore, &handle);
+    if (err) {
+        return err;
+    }
+    if (restore) {
+        ui_page_cache(true);
+        err = zealfs_restore(handle, disk, s_backup.partition, s_backup.path);
+    } else {
+        err = zealfs_mount(&fs, handle, disk, s_backup.partition, ui_page_cache(false));
+        if (err == NULL) {
+            err = zealfs_backup(&fs, s_backup.path);
+        }
+        zealfs_unmount(&fs);
+    }
+    disk_close(handle);
+    return err;
+}
+
+
+static void ui_backup_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info;
+    (void) disk;
+    info.title = s_backup.mode == POPUP_RESTORE ? "Restore partition" : "Backup partition";
+    info.msg = error_str ? error_str : "Success!";
+    popup_open(POPUP_MBR, 300, 140, &info);
+}
+
+
+/**
+ * @brief Render the popup to save a ZealFS partition of the current disk to a backup file, or to restore it,
+ * `id` is POPUP_BACKUP or POPUP_RESTORE
+ */
+static void ui_backup_partition(struct nk_context *ctx, disk_info_t* disk, popup_t id)
+{
+    const char* title = id == POPUP_RESTORE ? "Restore partition" : "Backup partition";
+    struct nk_rect position;
+    if (!popup_is_opened(id, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, title, position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        const int partition = ui_zealfs_combo(ctx, disk, &s_backup.selected, ratio);
+        if (partition >= 0) {
+            nk_label(ctx, "Backup file:", NK_TEXT_CENTERED);
+            nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, s_backup.path, sizeof(s_backup.path), nk_filter_default);
+        }
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (partition >= 0 && nk_button_label(ctx, "Start") && s_backup.path[0] != 0) {
+            s_backup.mode = id;
+            s_backup.partition = partition;
+            popup_close(id);
+            ui_start_job(title, ui_backup_job, disk, ui_backup_done);
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(id);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* Parameters of the image builder, the built image is staged as a clone on the current disk */
+static struct {
+    int             size_idx;
+    char            host_path[512];
+    char            cache_dir[256];
+    char            image_path[512];
+    bool            cached;
+    char            message[640];
+} s_image = { .size_idx = 4, .cache_dir = "zealfs-cache" };
+
+
+static const char* ui_image_job(void* arg)
+{
+    (void) arg;
+    return zealfs_build_image(s_image.host_path, 1ULL << (16 + s_image.size_idx), s_image.cache_dir,
+                              s_image.image_path, sizeof(s_image.image_path), &s_image.cached);
+}
+
+
+static void ui_image_done(disk_info_t* disk, const char* error_str)
+{
+    static popup_info_t info = {
+        .title = "Build image",
+    };
+    if (error_str) {
+        info.msg = error_str;
+        popup_open(POPUP_MBR, 300, 140, &info);
+        return;
+    }
+
+    /* Stage a copy of the image on the current disk, it will be streamed to it when the changes are applied */
+    uint32_t lba = 0;
+    disk_aligned_free_space(disk, &lba);
+    const char* err = disk_clone_image(disk, lba, s_image.image_path, 1ULL << (16 + s_image.size_idx));
+    if (err == NULL) {
+        disk->label[0] = '*';
+    }
+    snprintf(s_image.message, sizeof(s_image.message), "%s %s. %s",
+             s_image.cached ? "Reused" : "Built", s_image.image_path,
+             err ? err : "Apply the changes to write it to the disk.");
+    info.msg = s_image.message;
+    popup_open(POPUP_MBR, 400, 160, &info);
+}
+
+
+/**
+ * @brief Render the popup to build a partition image from a host folder, and add it to the current disk
+ */
+static void ui_build_image(struct nk_context *ctx, disk_info_t* disk)
+{
+    struct nk_rect position;
+    if (!popup_is_opened(POPUP_IMAGE, &position, NULL)) {
+        return;
+    }
+    if (nk_begin(ctx, "Build image", position, NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE)) {
+        const float ratio[] = { 0.3f, 0.65f };
+        nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 2, ratio);
+        nk_label(ctx, "Host folder:", NK_TEXT_CENTERED);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, s_image.host_path, sizeof(s_image.host_path), nk_filter_default);
+        /* The image doesn't depend on the free space of the disk, all the sizes, 64KiB to 4GiB, are valid */
+        nk_label(ctx, "Size:", NK_TEXT_CENTERED);
+        const float width = nk_widget_width(ctx);
+        s_image.size_idx = nk_combo(ctx, disk_get_partition_size_list(), 17, s_image.size_idx,
+                                    COMBO_HEIGHT, nk_vec2(width, 150));
+        nk_label(ctx, "Cache folder:", NK_TEXT_CENTERED);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, s_image.cache_dir, sizeof(s_image.cache_dir), nk_filter_default);
+
+        nk_layout_row_dynamic(ctx, 30, 2);
+        if (nk_button_label(ctx, "Build") && s_image.host_path[0] != 0 && s_image.cache_dir[0] != 0) {
+            popup_close(POPUP_IMAGE);
+            ui_start_job("Building image", ui_image_job, disk, ui_image_done);
+        }
+        if (nk_button_label(ctx, "Cancel")) {
+            popup_close(POPUP_IMAGE);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/* State of the sector viewer, the disk is only read through the cache, by its own thread */
+#define UI_VIEWER_ROW_BYTES     16
+#define UI_VIEWER_ROW_HEIGHT    14
+/* Height of the list of matches, shown below the rows once a search started */
+#define UI_VIEWER_SEARCH_HEIGHT 100
+
+static struct {
+    disk_cache_t*   cache;
+    int             disk;
+    uint64_t        offset;
+    /* Direction of the last scroll, the next blocks are read ahead in that direction */
+    int             direction;
+    char            lba[24];
+    /* Area of the rows on the last frame, the mouse wheel scrolls them when it's over it */
+    struct nk_rect  rows_area;
+    /* Search of a string or of bytes, in the whole disk or in a partition */
+    disk_search_t*  search;
+    char            find[2 * DISK_SEARCH_MAX_PATTERN + 1];
+    nk_bool         hex;
+    int             scope;
+} s_viewer;
+
+
+/**
+ * @brief Open the sector viewer on the given disk, the blocks are read when the rows are shown.
+ */
+static void ui_viewer_open(int disk)
+{
+    disk_cache_close(s_viewer.cache);
+    disk_search_close(s_viewer.search);
+    s_viewer.cache = NULL;
+    s_viewer.search = NULL;
+
+    const char* err = disk_cache_open(&disks[disk], &s_viewer.cache);
+    if (err) {
+        static popup_info_t info = {
+            .title = "Sector viewer",
+        };
+        info.msg = err;
+        popup_close(POPUP_VIEWER);
+        popup_open(POPUP_MBR, 400, 140, &info);
+        return;
+    }
+    s_viewer.disk = disk;
+    s_viewer.offset = 0;
+    s_viewer.direction = 1;
+    s_viewer.scope = 0;
+    snprintf(s_viewer.lba, sizeof(s_viewer.lba), "0");
+    popup_open(POPUP_VIEWER, 720, MAX(360, winHeight - 60), NULL);
+}
+
+
+/**
+ * @brief Format a row of the sector viewer: the offset, the bytes in hexadecimal, then in ASCII.
+ * The bytes that are not cached yet are shown as `??`.
+ */
+static void ui_viewer_row(char* line, size_t size, uint64_t offset, const uint8_t* bytes, bool cached)
+{
+    int len = snprintf(line, size, "%010llx  ", (unsigned long long) offset);
+    for (int i = 0; i < UI_VIEWER_ROW_BYTES; i++) {
+        const char* sep = i == UI_VIEWER_ROW_BYTES / 2 - 1 ? "  " : " ";
+        if (cached) {
+            len += snprintf(line + len, size - len, "%02x%s", bytes[i], sep);
+        } else {
+            len += snprintf(line + len, size - len, "??%s", sep);
+        }
+    }
+    line[len++] = '|';
+    for (int i = 0; i < UI_VIEWER_ROW_BYTES; i++) {
+        line[len++] = !cached ? ' ' : (bytes[i] >= 0x20 && bytes[i] < 0x7f) ? bytes[i] : '.';
+    }
+    line[len++] = '|';
+    line[len] = 0;
+}
+
+
+/**
+ * @brief Convert the text to find to bytes, either as it is or as hexadecimal digits, the spaces between the
+ * bytes are then ignored.
+ *
+ * @return Number of bytes in `pattern`, 0 if the text is empty or not valid hexadecimal.
+ */
+static uint32_t ui_search_pattern(uint8_t* pattern)
+{
+    uint32_t len = 0;
+    if (!s_viewer.hex) {
+        len = (uint32_t) MIN(strlen(s_viewer.find), DISK_SEARCH_MAX_PATTERN);
+        memcpy(pattern, s_viewer.find, len);
+        return len;
+    }
+    for (const char* text = s_viewer.find; *text != 0; ) {
+        if (*text == ' ') {
+            text++;
+            continue;
+        }
+        if (len == DISK_SEARCH_MAX_PATTERN || !isxdigit((unsigned char) text[0]) ||
+            !isxdigit((unsigned char) text[1])) {
+            return 0;
+        }
+        const char digits[3] = { text[0], text[1], 0 };
+        pattern[len++] = (uint8_t) strtoul(digits, NULL, 16);
+        text += 2;
+    }
+    return len;
+}
+
+
+/**
+ * @brief Start looking for the text or bytes entered in the sector viewer, in the whole disk when `partition`
+ * is negative, else in the given partition. The previous search is stopped.
+ */
+static void ui_search_start(const disk_info_t* disk, int partition)
+{
+    static popup_info_t info = {
+        .title = "Find",
+    };
+    uint8_t pattern[DISK_SEARCH_MAX_PATTERN];
+    const uint32_t len = ui_search_pattern(pattern);
+
+    disk_search_close(s_viewer.search);
+    s_viewer.search = NULL;
+    if (len == 0) {
+        info.msg = "Enter a text, or bytes in hexadecimal such as 5A 02 with Hex checked";
+        popup_open(POPUP_MBR, 400, 140, &info);
+        return;
+    }
+
+    uint64_t start = 0;
+    uint64_t size = disk->size_bytes;
+    if (partition >= 0) {
+        start = (uint64_t) disk->partitions[partition].start_lba * DISK_SECTOR_SIZE;
+        size = (uint64_t) disk->partitions[partition].size_sectors * DISK_SECTOR_SIZE;
+    }
+    const char* err = disk_search_start(disk, start, size, pattern, len, &s_viewer.search);
+    if (err) {
+        info.msg = err;
+        popup_open(POPUP_MBR, 400, 140, &info);
+    }
+}
+
+
+/**
+ * @brief Render the search bar of the sector viewer and the matches found so far, a match is shown in the
+ * viewer when clicked.
+ *
+ * @return true while the search is running.
+ */
+static bool ui_viewer_search(struct nk_context *ctx, const disk_info_t* disk, uint64_t last)
+{
+    /* The partitions on the disk, the staged ones don't exist yet */
+    static char labels[MAX_PART_COUNT + 1][64];
+    const char* items[MAX_PART_COUNT + 1] = { "Whole disk" };
+    int partitions[MAX_PART_COUNT + 1] = { -1 };
+    int count = 1;
+    for (int i = 0; i < MAX_PART_COUNT; i++) {
+        if (disk->partitions[i].active) {
+            char size[32];
+            disk_get_size_str((uint64_t) disk->partitions[i].size_sectors * DISK_SECTOR_SIZE, size, sizeof(size));
+            snprintf(labels[count], sizeof(labels[count]), "Partition %d (%s)", i, size);
+            items[count] = labels[count];
+            partitions[count++] = i;
+        }
+    }
+    s_viewer.scope = MIN(s_viewer.scope, count - 1);
+
+    const float ratio[] = { 0.12f, 0.38f, 0.12f, 0.26f, 0.12f };
+    nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 5, ratio);
+    nk_label(ctx, "Find:", NK_TEXT_CENTERED);
+    nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, s_viewer.find, sizeof(s_viewer.find), nk_filter_ascii);
+    nk_checkbox_label(ctx, "Hex", &s_viewer.hex);
+    const float width = nk_widget_width(ctx);
+    s_viewer.scope = nk_combo(ctx, items, count, s_viewer.scope, COMBO_HEIGHT, nk_vec2(width, 150));
+
+    /* Checked before reading the results, so that the last ones are shown before the polling stops */
+    const bool running = s_viewer.search != NULL && disk_search_running(s_viewer.search);
+    if (nk_button_label(ctx, running ? "Stop" : "Find")) {
+        if (running) {
+            disk_search_close(s_viewer.search);
+            s_viewer.search = NULL;
+        } else {
+            ui_search_start(disk, partitions[s_viewer.scope]);
+        }
+        return false;
+    }
+    if (s_viewer.search == NULL) {
+        return false;
+    }
+
+    bool truncated = false;
+    const int found = disk_search_count(s_viewer.search, &truncated);
+    const char* err = disk_search_error(s_viewer.search);
+    char status[128];
+    if (err) {
+        snprintf(status, sizeof(status), "%s", err);
+    } else {
+        snprintf(status, sizeof(status), "%s%d match(es)%s", truncated ? "First " : "", found,
+                 running ? ", searching..." : "");
+    }
+    nk_layout_row_dynamic(ctx, 20, 2);
+    nk_size progress = (nk_size) (disk_search_progress(s_viewer.search) * 1000);
+    nk_progress(ctx, &progress, 1000, NK_FIXED);
+    nk_label(ctx, status, NK_TEXT_LEFT);
+
+    /* Only the visible matches are formatted */
+    nk_layout_row_dynamic(ctx, UI_VIEWER_SEARCH_HEIGHT, 1);
+    struct nk_list_view view;
+    if (nk_list_view_begin(ctx, &view, "Matches", NK_WINDOW_BORDER, UI_VIEWER_ROW_HEIGHT, found)) {
+        nk_layout_row_dynamic(ctx, UI_VIEWER_ROW_HEIGHT, 1);
+        for (int i = view.begin; i < view.end; i++) {
+            const uint64_t match = disk_search_result(s_viewer.search, i);
+            char label[64];
+            snprintf(label, sizeof(label), "0x%010llx, sector %llu", (unsigned long long) match,
+                     (unsigned long long) (match / DISK_SECTOR_SIZE));
+            if (nk_select_label(ctx, label, NK_TEXT_LEFT, 0)) {
+                const uint64_t target = MIN(match / UI_VIEWER_ROW_BYTES * UI_VIEWER_ROW_BYTES, last);
+                s_viewer.direction = target >= s_viewer.offset ? 1 : -1;
+                s_viewer.offset = target;
+            }
+        }
+        nk_list_view_end(&view);
+    }
+    return running;
+}
+
+
+/**
+ * @brief Render the sector viewer. Only the visible rows are read, from the cache, so a frame never waits
+ * for the disk: the missing rows show up on the next frames, once the cache thread read them.
+ */
+static void ui_sector_viewer(struct nk_context *ctx)
+{
+    struct nk_rect position;
+    s_io_pending = false;
+    if (!popup_is_opened(POPUP_VIEWER, &position, NULL) || s_viewer.cache == NULL) {
+        return;
+    }
+    const int flags = NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_NO_SCROLLBAR;
+    if (nk_begin(ctx, "Sector viewer", position, flags)) {
+        const disk_info_t* disk = &disks[s_viewer.disk];
+        /* Nuklear's own scrollbar can't address the rows of a big disk, the view is moved by hand */
+        const int reserved = 225 + (s_viewer.search ? UI_VIEWER_SEARCH_HEIGHT + 30 : 0);
+        const int rows = MAX(1, (int) (position.h - reserved) / (UI_VIEWER_ROW_HEIGHT + 4));
+        const uint64_t view_bytes = (uint64_t) rows * UI_VIEWER_ROW_BYTES;
+        const uint64_t last = disk->size_bytes > view_bytes ?
+                              (disk->size_bytes - view_bytes) / UI_VIEWER_ROW_BYTES * UI_VIEWER_ROW_BYTES : 0;
+        int64_t move = 0;
+
+        const float ratio[] = { 0.12f, 0.38f, 0.12f, 0.26f, 0.12f };
+        nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 5, ratio);
+        nk_label(ctx, "Disk:", NK_TEXT_CENTERED);
+        const char* labels[MAX_DISKS];
+        for (int i = 0; i < disk_count; i++) {
+            labels[i] = disks[i].label;
+        }
+        const float width = nk_widget_width(ctx);
+        const int selected = nk_combo(ctx, labels, disk_count, s_viewer.disk, COMBO_HEIGHT, nk_vec2(width, 200));
+        nk_label(ctx, "LBA:", NK_TEXT_CENTERED);
+        nk_edit_string_zero_terminated(ctx, NK_EDIT_FIELD, s_viewer.lba, sizeof(s_viewer.lba), nk_filter_decimal);
+        if (nk_button_label(ctx, "Go")) {
+            const uint64_t target = strtoull(s_viewer.lba, NULL, 10) * DISK_SECTOR_SIZE;
+            s_viewer.direction = target >= s_viewer.offset ? 1 : -1;
+            s_viewer.offset = MIN(target, last);
+        }
+
+        /* The slider only gives an approximate position, the other controls move by rows */
+        nk_layout_row_dynamic(ctx, 20, 1);
+        float slider = last > 0 ? (float) ((double) s_viewer.offset / last) : 0.0f;
+        if (nk_slider_float(ctx, 0.0f, &slider, 1.0f, 0.001f)) {
+            const uint64_t target = (uint64_t) (slider * (double) last) / UI_VIEWER_ROW_BYTES * UI_VIEWER_ROW_BYTES;
+            s_viewer.direction = target >= s_viewer.offset ? 1 : -1;
+            s_viewer.offset = target;
+        }
+
+        if (nk_input_is_mouse_hovering_rect(&ctx->input, s_viewer.rows_area)) {
+            move -= (int64_t) (ctx->input.mouse.scroll_delta.y * 3);
+        }
+        if (nk_window_has_focus(ctx)) {
+            move += IsKeyPressed(KEY_DOWN) - IsKeyPressed(KEY_UP);
+            move += (IsKeyPressed(KEY_PAGE_DOWN) - IsKeyPressed(KEY_PAGE_UP)) * rows;
+        }
+        if (move > 0) {
+            s_viewer.direction = 1;
+            s_viewer.offset = MIN(s_viewer.offset + (uint64_t) move * UI_VIEWER_ROW_BYTES, last);
+        } else if (move < 0) {
+            const uint64_t back = (uint64_t) -move * UI_VIEWER_ROW_BYTES;
+            s_viewer.direction = -1;
+            s_viewer.offset = s_viewer.offset > back ? s_viewer.offset - back : 0;
+        }
+
+        bool complete = true;
+        nk_layout_row_dynamic(ctx, UI_VIEWER_ROW_HEIGHT, 1);
+        for (int i = 0; i < rows; i++) {
+            const uint64_t offset = s_viewer.offset + (uint64_t) i * UI_VIEWER_ROW_BYTES;
+            if (offset >= disk->size_bytes) {
+                break;
+            }
+            if (i == 0) {
+                s_viewer.rows_area = nk_widget_bounds(ctx);
+                s_viewer.rows_area.h = rows * (UI_VIEWER_ROW_HEIGHT + 4);
+            }
+            uint8_t bytes[UI_VIEWER_ROW_BYTES];
+            const bool cached = disk_cache_read(s_viewer.cache, offset, bytes, sizeof(bytes));
+            char line[96];
+            ui_viewer_row(line, sizeof(line), offset, bytes, cached);
+            nk_label(ctx, line, NK_TEXT_LEFT);
+            complete = complete && cached;
+        }
+        /* Only read ahead once the visible rows are there, so that they are always read first */
+        if (complete) {
+            const uint64_t edge = s_viewer.direction > 0 ? s_viewer.offset + view_bytes : s_viewer.offset;
+            disk_cache_readahead(s_viewer.cache, edge, s_viewer.direction);
+        }
+
+        const bool searching = ui_viewer_search(ctx, disk, last);
+        const char* err = disk_cache_error(s_viewer.cache);
+        const bool busy = disk_cache_busy(s_viewer.cache);
+        char status[128];
+        snprintf(status, sizeof(status), "Sector %llu, offset 0x%llx%s",
+                 (unsigned long long) (s_viewer.offset / DISK_SECTOR_SIZE),
+                 (unsigned long long) s_viewer.offset, busy ? ", reading..." : "");
+        nk_layout_row_dynamic(ctx, 20, 1);
+        nk_label(ctx, status, NK_TEXT_LEFT);
+        nk_label(ctx, err ? err : "Content on the disk, the pending changes are not shown", NK_TEXT_LEFT);
+        /* Keep drawing frames until the missing rows arrive, a failed block is not read again */
+        s_io_pending = busy || searching || (!complete && err == NULL);
+
+        nk_layout_row_dynamic(ctx, 30, 1);
+        if (nk_button_label(ctx, "Close")) {
+            popup_close(POPUP_VIEWER);
+            disk_cache_close(s_viewer.cache);
+            disk_search_close(s_viewer.search);
+            s_viewer.cache = NULL;
+            s_viewer.search = NULL;
+            s_io_pending = false;
+        } else if (selected != s_viewer.disk) {
+            ui_viewer_open(selected);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+/**
+ * @brief Render the menu bar of the main window, with the tools operating on the current disk
+ */
+static void ui_menubar(struct nk_context *ctx, disk_info_t* disk)
+{
+    nk_menubar_begin(ctx);
+    nk_layout_row_static(ctx, 20, 60, 1);
+    if (nk_menu_begin_label(ctx, "Tools", NK_TEXT_LEFT, nk_vec2(220, 360))) {
+        nk_layout_row_dynamic(ctx, 25, 1);
+        if (nk_menu_item_label(ctx, "Recover partitions", NK_TEXT_LEFT) && disk_count > 0) {
+            ui_start_job("Scanning disk", ui_recover_job, disk, ui_recover_done);
+        }
+        if (nk_menu_item_label(ctx, "Import folder", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_IMPORT, 400, 200, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Synchronize folder", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_SYNC, 400, 230, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Export files", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_EXPORT, 400, 200, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Build image", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_IMAGE, 400, 200, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Check partition", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_FSCK, 400, 170, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Page size advisor", NK_TEXT_LEFT)) {
+            popup_open(POPUP_ADVISOR, 600, 420, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Defragment partition", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_DEFRAG, 400, 140, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Resize partition", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_RESIZE, 400, 170, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Backup partition", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_BACKUP, 400, 170, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Restore partition", NK_TEXT_LEFT) && disk_count > 0) {
+            popup_open(POPUP_RESTORE, 400, 170, NULL);
+        }
+        if (nk_menu_item_label(ctx, "Sector viewer", NK_TEXT_LEFT) && disk_count > 0) {
+            ui_viewer_open((int) (disk - disks));
+        }
+        nk_menu_end(ctx);
+    }
+    nk_menubar_end(ctx);
+}
+
+
+/**
+ * @brief Render the debug overlay when it is enabled: the time spent in each part of a frame, the size of the
+ * Nuklear commands, and the disk accesses of the running job. The statistics are updated twice per second.
+ */
+static void ui_debug_overlay(struct nk_context *ctx)
+{
+    if (IsKeyPressed(KEY_F3)) {
+        s_overlay = !s_overlay;
+    }
+    if (!s_overlay) {
+        return;
+    }
+
+    perf_io_t io;
+    perf_io_stats(&io);
+    const int flags = NK_WINDOW_TITLE | NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_NO_SCROLLBAR;
+    if (nk_begin(ctx, "Debug (F3)", nk_rect(winWidth - 300, 40, 280, 280), flags)) {
+        char lines[10][96];
+        const char* name = job_name();
+        snprintf(lines[0], sizeof(lines[0]), "UI build: %.2f ms", perf_section_ms(PERF_UI_BUILD));
+        snprintf(lines[1], sizeof(lines[1]), "DrawNuklear: %.2f ms", perf_section_ms(PERF_DRAW));
+        snprintf(lines[2], sizeof(lines[2]), "Swap: %.2f ms", perf_section_ms(PERF_SWAP));
+        snprintf(lines[3], sizeof(lines[3]), "Commands: %u, %lu bytes", s_frame_stats.commands,
+                 (unsigned long) s_frame_stats.bytes);
+        snprintf(lines[4], sizeof(lines[4]), "Draw calls: %d", s_frame_stats.draw_calls);
+        if (name) {
+            snprintf(lines[5], sizeof(lines[5]), "Job: %s (%.0f%%)", name, job_get_progress() * 100);
+        } else {
+            snprintf(lines[5], sizeof(lines[5]), "Job: none");
+        }
+        snprintf(lines[6], sizeof(lines[6]), "Read: %.2f MB/s, write: %.2f MB/s", io.read_mbps, io.write_mbps);
+        snprintf(lines[7], sizeof(lines[7]), "Accesses: %.0f/s, %.2f ms each", io.accesses_per_s, io.latency_ms);
+        snprintf(lines[8], sizeof(lines[8]), "Queue depth: %u, max %u", io.in_flight, io.max_in_flight);
+        const nk_size arena = GetNuklearMemorySize(ctx);
+        if (arena > 0) {
+            snprintf(lines[9], sizeof(lines[9]), "Nuklear memory: peak %lu KB, arena %lu KB",
+                     (unsigned long) (GetNuklearMemoryPeak(ctx) / KB), (unsigned long) (arena / KB));
+        } else {
+            snprintf(lines[9], sizeof(lines[9]), "Nuklear memory: peak %lu KB, heap",
+                     (unsigned long) (GetNuklearMemoryPeak(ctx) / KB));
+        }
+
+        nk_layout_row_dynamic(ctx, 18, 1);
+        for (int i = 0; i < 10; i++) {
+            nk_label(ctx, lines[i], NK_TEXT_LEFT);
+        }
+    }
+    nk_end(ctx);
+}
+
+
+static void setup_window() {
+    InitWindow(0, 0, "Zeal Disk Tool " VERSION);
+
+    // get current monitor details
+    int mw, mh;
+    int monitor = GetCurrentMonitor();
+    mw = GetMonitorWidth(monitor);
+    mh = GetMonitorHeight(monitor);
+
+    // clamp the window size to either WIN_SCALE or MIN
+    winWidth = NK_MAX(MIN_WIN_WIDTH, mw * WIN_SCALE);
+    winHeight = NK_MAX(MIN_WIN_HEIGHT, winWidth * WIN_ASPECT);
+    SetWindowSize(winWidth, winHeight);
+
+    // center the window on the current monitor
+    Vector2 mon_pos = GetMonitorPosition(monitor);
+    int pos_x = mon_pos.x, pos_y = mon_pos.y;
+    pos_x += (mw - winWidth) / 2;
+    pos_y += (mh - winHeight) / 2;
+    SetWindowPosition(pos_x, pos_y);
+
+#ifndef __APPLE__
+    /* Set an icon for the application */
+    Image icon = LoadImageFromMemory(".png", s_app_icon_png, sizeof(s_app_icon_png));
+    SetWindowIcon(icon);
+#endif
+}
+
+int main(int argc, char** argv) {
+    log_init();
+
+    /* The trace file can be given on the command line or in the environment */
+    const char* trace_path = getenv(TRACE_ENV_VAR);
+    nk_size arena_size = 0;
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            trace_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--nk-arena") == 0) {
+            char* end;
+            const unsigned long kb = strtoul(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != 0 || kb < UI_NK_ARENA_MIN / KB || kb > UI_NK_ARENA_MAX / KB) {
+                LOG_E("UI", "Invalid Nuklear arena size %s, it must be between %llu and %llu KB",
+                      argv[i + 1], UI_NK_ARENA_MIN / KB, UI_NK_ARENA_MAX / KB);
+                return 1;
+            }
+            arena_size = (nk_size) kb * KB;
+        }
+    }
+    trace_init(trace_path);
+
+    SetTraceLogLevel(LOG_WARNING);
+    setup_window();
+
+    popup_init(winWidth, winHeight);
+
+    const uint64_t list_start = trace_begin();
+    disk_err_t err = disk_list(disks, MAX_DISKS, &disk_count);
+    trace_end("disk list", list_start, 0, 0);
+
+    /* Mac/Linux targets only */
+    if (err == ERR_NOT_ROOT) {
+        LOG_E("UI", "You must run this program as root");
+        return 1;
+    } else if (err == ERR_NOT_ADMIN) {
+        return message_box("You must run this program as Administrator!\n");
+    }
+
+    /* Without it, each mount gets a cache of its own */
+    s_page_cache = zealfs_cache_create(ZEALFS_CACHE_PAGES);
+
+    const int fontSize = 13;
+    Font font = LoadFontFromNuklear(fontSize);
+    ctx = InitNuklearFixed(font, fontSize, arena_size);
+
+    /* Construct the labels for the disks */
+    static const char* disk_labels[MAX_DISKS] = { 0 };
+    int selected_disk = 0;
+    for (int i = 0; i < disk_count; ++i) {
+        char size_str[128];
+        disk_get_size_str(disks[i].size_bytes, size_str, sizeof(size_str));
+        /* Keep the first character empty, it will be a `*` in case there is any pending change */
+        snprintf(disks[i].label, DISK_LABEL_LEN, " %.*s (%s)", (int) sizeof(disks[i].name), disks[i].name, size_str);
+        disk_labels[i] = disks[i].label;
+        disk_parse_mbr_partitions(&disks[i]);
+    }
+
+    if (disk_count == 0) {
+        disk_labels[0] = "No disk found";
+    }
+
+    int selected_partition = 0;
+    bool closing = false;
+
+    /* Closing the window in the middle of a write would leave a partition half written, wait for the job */
+    while (!WindowShouldClose() || job_running()) {
+        const uint64_t build_start = perf_now();
+        UpdateNuklear(ctx);
+
+        if (!closing && WindowShouldClose()) {
+            static popup_info_t info = {
+                .title = "Closing",
+                .msg = "The window will close once the current operation is over",
+            };
+            closing = true;
+            LOG_I("UI", "Waiting for %s before exiting", job_name());
+            popup_open(POPUP_MBR, 300, 140, &info);
+        }
+
+        /* If any popup is opened, the main window must not be focusable. Keep it behind the debug overlay. */
+        const int flags = ((popup_any_opened() || job_running()) ? NK_WINDOW_NO_INPUT : 0) |
+                          (s_overlay ? NK_WINDOW_BACKGROUND : 0);
+        disk_info_t* current_disk = &disks[selected_disk];
+
+        if (nk_begin(ctx, "Disks", nk_rect(0, 0, winWidth, winHeight), flags)) {
+            ui_menubar(ctx, current_disk);
+
+            /* Create the top row with the buttons and the disk selection */
+            const float ratio[] = { 0.10f, 0.13f, 0.13f, 0.13f, 0.07f, 0.07f, 0.12f, 0.25f };
+            nk_layout_row(ctx, NK_DYNAMIC, COMBO_HEIGHT, 8, ratio);
+
+            /* Create the button with label "MBR" */
+            if (nk_widget_is_hovered(ctx)) {
+                nk_tooltip(ctx, "Create an MBR on the disk");
+            }
+            /* Only enable the buttons if we have at least one disk */
+            if (nk_button_label(ctx, "Create MBR") && disk_count > 0) {
+                static popup_info_t info;
+                info.title = "Create MBR table";
+                if (current_disk->has_mbr) {
+                    info.msg = "Selected disk already has an MBR";
+                } else {
+                    info.msg = "Feature not supported yet";
+                    // mbr_last_msg = "MBR created successfully!";
+                }
+                popup_open(POPUP_MBR, 300, 140, &info);
+            }
+
+            /* Create the button to add a new partition */
+            if (nk_widget_is_hovered(ctx)) {
+                nk_tooltip(ctx, "Create a new partition on the disk");
+            }
+            if (nk_button_label(ctx, "New partition") && disk_count > 0) {
+                static int choosen_option = 0;
+                popup_open(POPUP_NEWPART, 300, 300, &choosen_option);
+            }
+
+            /* Create the button to clone a partition from any disk */
+            if (nk_widget_is_hovered(ctx)) {
+                nk_tooltip(ctx, "Copy a ZealFS partition from any disk to this disk");
+            }
+            if (nk_button_label(ctx, "Clone partition") && disk_count > 0) {
+                static int choosen_source = 0;
+                popup_open(POPUP_CLONE, 400, 200, &choosen_source);
+            }
+
+            /* Create the button to delete a partition */
+            if (nk_widget_is_hovered(ctx)) {
+                nk_tooltip(ctx, "Delete the selected partition on the disk");
+            }
+            if ((nk_button_label(ctx, "Delete partition") || (!(flags & NK_WINDOW_NO_INPUT) && IsKeyPressed(KEY_DELETE))) && disk_count > 0) {
+                disk_delete_partition(current_disk, selected_partition);
+            }
+
+            /* Create the button to commit the changes */
+            if (nk_widget_is_hovered(ctx)) {
+                nk_tooltip(ctx, "Apply all the changes to the selected disk");
             }
             if (nk_button_label(ctx, "Apply") && disk_count > 0 && current_disk->has_staged_changes) {
                 popup_open(POPUP_APPLY, 300, 130, NULL);
@@ -534,13 +2228,35 @@ int main(void) {
         ui_apply_handle(ctx, current_disk);
         ui_cancel_handle(ctx, current_disk);
         ui_new_partition(ctx, current_disk);
-
-        BeginDrawing();
-            ClearBackground(WHITE);
-            DrawNuklear(ctx);
-        EndDrawing();
+        ui_clone_partition(ctx, current_disk);
+        ui_recover_partition(ctx, current_disk);
+        ui_transfer_folder(ctx, current_disk, POPUP_IMPORT);
+        ui_transfer_folder(ctx, current_disk, POPUP_SYNC);
+        ui_transfer_folder(ctx, current_disk, POPUP_EXPORT);
+        ui_check_partition(ctx, current_disk);
+        ui_defrag_partition(ctx, current_disk);
+        ui_resize_partition(ctx, current_disk);
+        ui_page_advisor(ctx, current_disk);
+        ui_backup_partition(ctx, current_disk, POPUP_BACKUP);
+        ui_backup_partition(ctx, current_disk, POPUP_RESTORE);
+        ui_build_image(ctx, current_disk);
+        ui_sector_viewer(ctx);
+        ui_job_handle(ctx);
+        ui_debug_overlay(ctx);
+        perf_section_add(PERF_UI_BUILD, build_start);
+
+        ui_render_frame(ctx);
+        trace_end("frame", build_start, 0, 0);
     }
 
+    for (int i = 0; i < MAX_DISKS; i++) {
+        if (s_disk_views[i].bar.id != 0) {
+            UnloadRenderTexture(s_disk_views[i].bar);
+        }
+    }
+    disk_cache_close(s_viewer.cache);
+    disk_search_close(s_viewer.search);
+    zealfs_cache_destroy(s_page_cache);
     UnloadNuklear(ctx);
     CloseWindow();
     return 0;
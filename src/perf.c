@@ -0,0 +1,162 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <time.h>
+#include <stdatomic.h>
+#include "perf.h"
+#include "trace.h"
+
+/* The statistics are published once per window, so that the overlay showing them doesn't change every frame */
+#define PERF_WINDOW_NS  500000000ULL
+
+/* Frame sections, only accessed by the UI thread */
+static struct {
+    uint64_t total[PERF_SECTION_COUNT];
+    uint32_t count[PERF_SECTION_COUNT];
+    double   average_ms[PERF_SECTION_COUNT];
+    uint64_t window_start;
+} s_frame;
+
+/* Disk accesses, updated by any thread */
+static struct {
+    atomic_uint_fast64_t read_bytes;
+    atomic_uint_fast64_t write_bytes;
+    atomic_uint_fast64_t busy_ns;
+    atomic_uint_fast64_t accesses;
+    atomic_uint          in_flight;
+    atomic_uint          max_in_flight;
+} s_io;
+
+/* Counters at the beginning of the current window, only accessed by the UI thread */
+static struct {
+    uint64_t  time;
+    uint64_t  read_bytes;
+    uint64_t  write_bytes;
+    uint64_t  busy_ns;
+    uint64_t  accesses;
+    perf_io_t stats;
+} s_io_window;
+
+/* Names of the frame sections in the trace */
+static const char* s_section_names[PERF_SECTION_COUNT] = {
+    [PERF_UI_BUILD] = "ui build",
+    [PERF_DRAW]     = "draw",
+    [PERF_SWAP]     = "swap",
+};
+
+
+/**
+ * @brief Get the current time of a monotonic clock, in nanoseconds.
+ */
+uint64_t perf_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+
+/**
+ * @brief Account the time elapsed since `start`, as returned by `perf_now`, to a section of the current frame.
+ * Must be called from the UI thread. The section is recorded in the trace too, if enabled.
+ */
+void perf_section_add(perf_section_t section, uint64_t start)
+{
+    s_frame.total[section] += perf_now() - start;
+    s_frame.count[section]++;
+    trace_end(s_section_names[section], start, 0, 0);
+}
+
+
+/**
+ * @brief Mark the end of a frame, the averages of the sections are updated when the window is over.
+ * Sections skipped by a frame, such as the drawing when nothing changed, don't lower their average.
+ */
+void perf_frame_end(void)
+{
+    const uint64_t now = perf_now();
+    if (s_frame.window_start == 0) {
+        s_frame.window_start = now;
+    }
+    if (now - s_frame.window_start < PERF_WINDOW_NS) {
+        return;
+    }
+    for (int i = 0; i < PERF_SECTION_COUNT; i++) {
+        s_frame.average_ms[i] = s_frame.count[i] ? s_frame.total[i] / 1e6 / s_frame.count[i] : 0;
+        s_frame.total[i] = 0;
+        s_frame.count[i] = 0;
+    }
+    s_frame.window_start = now;
+}
+
+
+/**
+ * @brief Get the average duration of a section over the last window, in milliseconds.
+ */
+double perf_section_ms(perf_section_t section)
+{
+    return s_frame.average_ms[section];
+}
+
+
+/**
+ * @brief Mark the beginning of a disk access, to be called by the backends from any thread.
+ *
+ * @return Value to give to `perf_io_end` once the access is over.
+ */
+uint64_t perf_io_begin(void)
+{
+    const unsigned in_flight = atomic_fetch_add(&s_io.in_flight, 1) + 1;
+    unsigned max = atomic_load(&s_io.max_in_flight);
+    while (in_flight > max && !atomic_compare_exchange_weak(&s_io.max_in_flight, &max, in_flight)) {
+    }
+    return perf_now();
+}
+
+
+/**
+ * @brief Mark the end of a disk access started with `perf_io_begin`, `bytes` is the amount transferred.
+ */
+void perf_io_end(uint64_t start, uint64_t bytes, bool write)
+{
+    atomic_fetch_add(write ? &s_io.write_bytes : &s_io.read_bytes, bytes);
+    atomic_fetch_add(&s_io.busy_ns, perf_now() - start);
+    atomic_fetch_add(&s_io.accesses, 1);
+    atomic_fetch_sub(&s_io.in_flight, 1);
+}
+
+
+/**
+ * @brief Get the disk statistics of the last complete window. Must be called from the UI thread.
+ */
+void perf_io_stats(perf_io_t* stats)
+{
+    const uint64_t now = perf_now();
+    if (s_io_window.time == 0) {
+        s_io_window.time = now;
+    } else if (now - s_io_window.time >= PERF_WINDOW_NS) {
+        const uint64_t read_bytes = atomic_load(&s_io.read_bytes);
+        const uint64_t write_bytes = atomic_load(&s_io.write_bytes);
+        const uint64_t busy_ns = atomic_load(&s_io.busy_ns);
+        const uint64_t accesses = atomic_load(&s_io.accesses);
+        const double seconds = (now - s_io_window.time) / 1e9;
+        const uint64_t count = accesses - s_io_window.accesses;
+
+        s_io_window.stats = (perf_io_t) {
+            .read_mbps      = (read_bytes - s_io_window.read_bytes) / seconds / 1e6,
+            .write_mbps     = (write_bytes - s_io_window.write_bytes) / seconds / 1e6,
+            .latency_ms     = count ? (busy_ns - s_io_window.busy_ns) / 1e6 / count : 0,
+            .accesses_per_s = count / seconds,
+            .in_flight      = atomic_load(&s_io.in_flight),
+            .max_in_flight  = atomic_exchange(&s_io.max_in_flight, atomic_load(&s_io.in_flight)),
+        };
+        s_io_window.time = now;
+        s_io_window.read_bytes = read_bytes;
+        s_io_window.write_bytes = write_bytes;
+        s_io_window.busy_ns = busy_ns;
+        s_io_window.accesses = accesses;
+    }
+    *stats = s_io_window.stats;
+}
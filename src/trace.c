@@ -0,0 +1,180 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "trace.h"
+#include "log.h"
+
+/* Events kept per thread, the oldest ones are overwritten when a ring is full */
+#define TRACE_RING_EVENTS   (64*1024)
+
+typedef struct {
+    const char* name;
+    uint64_t    start;
+    uint64_t    end;
+    uint64_t    offset;
+    uint32_t    len;
+    uint32_t    tid;
+} trace_event_t;
+
+/* Only written by the thread owning it, a ring is given to another thread once its owner exits */
+typedef struct trace_ring_t {
+    struct trace_ring_t* next;
+    struct trace_ring_t* next_free;
+    /* Number of events ever written, published after the event itself */
+    atomic_uint_fast64_t head;
+    trace_event_t        events[TRACE_RING_EVENTS];
+} trace_ring_t;
+
+bool g_trace_enabled;
+
+static struct {
+    char            path[512];
+    uint64_t        origin;
+    pthread_key_t   key;
+    /* Only taken when a thread records its first event or exits */
+    pthread_mutex_t lock;
+    trace_ring_t*   rings;
+    trace_ring_t*   free_rings;
+    atomic_uint     next_tid;
+} s_trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static _Thread_local trace_ring_t* s_ring;
+static _Thread_local uint32_t s_tid;
+
+
+static void trace_release_ring(void* arg)
+{
+    trace_ring_t* ring = (trace_ring_t*) arg;
+    pthread_mutex_lock(&s_trace.lock);
+    ring->next_free = s_trace.free_rings;
+    s_trace.free_rings = ring;
+    pthread_mutex_unlock(&s_trace.lock);
+}
+
+
+/**
+ * @brief Give a ring to the calling thread. The backends check errno right after recording an event,
+ * so it is preserved.
+ */
+static trace_ring_t* trace_acquire_ring(void)
+{
+    const int saved_errno = errno;
+    pthread_mutex_lock(&s_trace.lock);
+    trace_ring_t* ring = s_trace.free_rings;
+    if (ring != NULL) {
+        s_trace.free_rings = ring->next_free;
+    } else {
+        ring = calloc(1, sizeof(trace_ring_t));
+        if (ring != NULL) {
+            ring->next = s_trace.rings;
+            s_trace.rings = ring;
+        }
+    }
+    pthread_mutex_unlock(&s_trace.lock);
+
+    if (ring != NULL) {
+        pthread_setspecific(s_trace.key, ring);
+        s_tid = atomic_fetch_add(&s_trace.next_tid, 1) + 1;
+    }
+    errno = saved_errno;
+    return ring;
+}
+
+
+/**
+ * @brief Record a complete event in the ring of the calling thread, without any lock.
+ */
+void trace_record(const char* name, uint64_t start, uint64_t offset, uint32_t len)
+{
+    const uint64_t end = perf_now();
+    trace_ring_t* ring = s_ring;
+    if (ring == NULL) {
+        ring = s_ring = trace_acquire_ring();
+        if (ring == NULL) {
+            return;
+        }
+    }
+    const uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head % TRACE_RING_EVENTS] = (trace_event_t) {
+        .name   = name,
+        .start  = start,
+        .end    = end,
+        .offset = offset,
+        .len    = len,
+        .tid    = s_tid,
+    };
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+/**
+ * @brief Write all the recorded events to the trace file, in the Chrome trace event format that both
+ * chrome://tracing and Perfetto open.
+ */
+static void trace_write(void)
+{
+    /* Threads still running at exit, such as an interrupted job, stop recording */
+    g_trace_enabled = false;
+
+    FILE* file = fopen(s_trace.path, "w");
+    if (file == NULL) {
+        LOG_E("TRACE", "Could not create %s: %s", s_trace.path, strerror(errno));
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Zeal Disk Tool\"}}");
+    uint64_t count = 0;
+    pthread_mutex_lock(&s_trace.lock);
+    for (const trace_ring_t* ring = s_trace.rings; ring != NULL; ring = ring->next) {
+        const uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        const uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const trace_event_t* ev = &ring->events[i % TRACE_RING_EVENTS];
+            /* Times are in microseconds, relative to the start of the trace */
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+                    ev->name, ev->tid, (ev->start - s_trace.origin) / 1e3, (ev->end - ev->start) / 1e3);
+            if (ev->len != 0) {
+                fprintf(file, ",\"args\":{\"offset\":%llu,\"len\":%u}", (unsigned long long) ev->offset, ev->len);
+            }
+            fputc('}', file);
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&s_trace.lock);
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    LOG_I("TRACE", "%llu events written to %s", (unsigned long long) count, s_trace.path);
+}
+
+
+/**
+ * @brief Enable the trace if `path` is not NULL or empty, the events are written to it when the program exits.
+ * Must be called before any other thread is started.
+ *
+ * @return true if the trace is enabled.
+ */
+bool trace_init(const char* path)
+{
+    if (path == NULL || path[0] == 0) {
+        return false;
+    }
+    if (pthread_key_create(&s_trace.key, trace_release_ring) != 0) {
+        LOG_E("TRACE", "Could not create the thread key, the trace is disabled");
+        return false;
+    }
+    strncpy(s_trace.path, path, sizeof(s_trace.path) - 1);
+    s_trace.origin = perf_now();
+    atexit(trace_write);
+    g_trace_enabled = true;
+    LOG_I("TRACE", "Recording to %s", path);
+    return true;
+}
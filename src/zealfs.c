@@ -0,0 +1,1131 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "zealfs.h"
+#include "disk_io.h"
+
+typedef struct {
+    /* Key: disk, offset of the partition on it and page index */
+    const disk_info_t*  disk;
+    uint64_t            part;
+    uint32_t            page;
+    bool                valid;
+    uint32_t            size;
+    uint8_t*            data;
+    /* LRU list, head is the most recently used */
+    int                 prev;
+    int                 next;
+    /* Hash bucket chain */
+    int                 hnext;
+} zealfs_cache_slot_t;
+
+struct zealfs_cache_t {
+    uint32_t             capacity;
+    uint32_t             bucket_mask;
+    int*                 buckets;
+    zealfs_cache_slot_t* slots;
+    int                  head;
+    int                  tail;
+    uint64_t             hits;
+    uint64_t             misses;
+};
+
+
+/**
+ * @brief Create a page cache that holds at most `pages` pages, whatever their size.
+ * It can be shared by several partitions, the entries are keyed by (partition, page).
+ * The cache is not thread-safe.
+ */
+zealfs_cache_t* zealfs_cache_create(uint32_t pages)
+{
+    zealfs_cache_t* cache = calloc(1, sizeof(zealfs_cache_t));
+    if (cache == NULL || pages == 0) {
+        free(cache);
+        return NULL;
+    }
+
+    /* Twice as many buckets as slots, rounded to a power of two */
+    uint32_t buckets = 1;
+    while (buckets < pages * 2) {
+        buckets <<= 1;
+    }
+    cache->capacity = pages;
+    cache->bucket_mask = buckets - 1;
+    cache->buckets = malloc(sizeof(int) * buckets);
+    cache->slots = calloc(pages, sizeof(zealfs_cache_slot_t));
+    if (cache->buckets == NULL || cache->slots == NULL) {
+        zealfs_cache_destroy(cache);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < buckets; i++) {
+        cache->buckets[i] = -1;
+    }
+    /* All the slots are in the LRU list from the beginning, the invalid ones are simply reused first */
+    for (uint32_t i = 0; i < pages; i++) {
+        cache->slots[i].prev = (int) i - 1;
+        cache->slots[i].next = (i + 1 < pages) ? (int) i + 1 : -1;
+        cache->slots[i].hnext = -1;
+    }
+    cache->head = 0;
+    cache->tail = pages - 1;
+    return cache;
+}
+
+
+void zealfs_cache_destroy(zealfs_cache_t* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    if (cache->slots) {
+        for (uint32_t i = 0; i < cache->capacity; i++) {
+            free(cache->slots[i].data);
+        }
+    }
+    free(cache->slots);
+    free(cache->buckets);
+    free(cache);
+}
+
+
+void zealfs_cache_stats(const zealfs_cache_t* cache, uint64_t* hits, uint64_t* misses)
+{
+    *hits = cache->hits;
+    *misses = cache->misses;
+}
+
+
+static uint32_t zealfs_cache_hash(const zealfs_cache_t* cache, const disk_info_t* disk, uint64_t part, uint32_t page)
+{
+    uint64_t h = (uint64_t) (uintptr_t) disk ^ (part * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t) page * 0xc2b2ae3d27d4eb4fULL);
+    h ^= h >> 29;
+    return (uint32_t) h & cache->bucket_mask;
+}
+
+
+static void zealfs_cache_unlink(zealfs_cache_t* cache, int idx)
+{
+    zealfs_cache_slot_t* slot = &cache->slots[idx];
+    if (slot->prev >= 0) {
+        cache->slots[slot->prev].next = slot->next;
+    } else {
+        cache->head = slot->next;
+    }
+    if (slot->next >= 0) {
+        cache->slots[slot->next].prev = slot->prev;
+    } else {
+        cache->tail = slot->prev;
+    }
+}
+
+
+static void zealfs_cache_push_front(zealfs_cache_t* cache, int idx)
+{
+    zealfs_cache_slot_t* slot = &cache->slots[idx];
+    slot->prev = -1;
+    slot->next = cache->head;
+    if (cache->head >= 0) {
+        cache->slots[cache->head].prev = idx;
+    }
+    cache->head = idx;
+    if (cache->tail < 0) {
+        cache->tail = idx;
+    }
+}
+
+
+static void zealfs_cache_remove_hash(zealfs_cache_t* cache, int idx)
+{
+    zealfs_cache_slot_t* slot = &cache->slots[idx];
+    int* link = &cache->buckets[zealfs_cache_hash(cache, slot->disk, slot->part, slot->page)];
+    while (*link >= 0) {
+        if (*link == idx) {
+            *link = slot->hnext;
+            break;
+        }
+        link = &cache->slots[*link].hnext;
+    }
+    slot->valid = false;
+}
+
+
+/**
+ * @brief Drop the page from the cache, if present, after it has been written.
+ */
+static void zealfs_cache_invalidate(zealfs_cache_t* cache, const disk_info_t* disk, uint64_t part, uint32_t page)
+{
+    const uint32_t bucket = zealfs_cache_hash(cache, disk, part, page);
+    for (int idx = cache->buckets[bucket]; idx >= 0; idx = cache->slots[idx].hnext) {
+        zealfs_cache_slot_t* slot = &cache->slots[idx];
+        if (slot->disk == disk && slot->part == part && slot->page == page) {
+            zealfs_cache_remove_hash(cache, idx);
+            /* Reuse it first */
+            zealfs_cache_unlink(cache, idx);
+            slot->prev = cache->tail;
+            slot->next = -1;
+            if (cache->tail >= 0) {
+                cache->slots[cache->tail].next = idx;
+            } else {
+                cache->head = idx;
+            }
+            cache->tail = idx;
+            return;
+        }
+    }
+}
+
+
+/**
+ * @brief Drop all the pages of the partition from its cache, after they have been moved on the disk.
+ */
+void zealfs_cache_forget(zealfs_t* fs)
+{
+    zealfs_cache_t* cache = fs->cache;
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        const zealfs_cache_slot_t* slot = &cache->slots[i];
+        if (slot->valid && slot->disk == fs->disk && slot->part == fs->offset) {
+            zealfs_cache_invalidate(cache, fs->disk, fs->offset, slot->page);
+        }
+    }
+}
+
+
+/**
+ * @brief Drop all the pages from the cache, after the disks were written without going through it.
+ */
+void zealfs_cache_clear(zealfs_cache_t* cache)
+{
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        zealfs_cache_slot_t* slot = &cache->slots[i];
+        if (slot->valid) {
+            zealfs_cache_remove_hash(cache, (int) i);
+        }
+    }
+}
+
+
+/**
+ * @brief Get a page of the partition, from the cache or from the disk.
+ * The returned pointer is valid until the next call to this function.
+ */
+const char* zealfs_read_page(zealfs_t* fs, uint16_t page, const uint8_t** data)
+{
+    static _Thread_local char error_msg[256];
+    zealfs_cache_t* cache = fs->cache;
+
+    if (page >= fs->page_count) {
+        snprintf(error_msg, sizeof(error_msg), "Invalid page %d in the partition\n", page);
+        return error_msg;
+    }
+    /* Pages modified in memory take precedence over the disk */
+    if (page == 0) {
+        *data = (const uint8_t*) fs->header;
+        return NULL;
+    }
+    if (fs->pending_idx != NULL && fs->pending_idx[page] >= 0) {
+        *data = fs->pending[fs->pending_idx[page]].data;
+        return NULL;
+    }
+
+    const uint32_t bucket = zealfs_cache_hash(cache, fs->disk, fs->offset, page);
+    for (int idx = cache->buckets[bucket]; idx >= 0; idx = cache->slots[idx].hnext) {
+        zealfs_cache_slot_t* slot = &cache->slots[idx];
+        if (slot->disk == fs->disk && slot->part == fs->offset && slot->page == page) {
+            cache->hits++;
+            zealfs_cache_unlink(cache, idx);
+            zealfs_cache_push_front(cache, idx);
+            *data = slot->data;
+            return NULL;
+        }
+    }
+
+    /* Miss, recycle the least recently used slot */
+    cache->misses++;
+    const int idx = cache->tail;
+    zealfs_cache_slot_t* slot = &cache->slots[idx];
+    if (slot->valid) {
+        zealfs_cache_remove_hash(cache, idx);
+    }
+    if (slot->size != fs->page_bytes) {
+        free(slot->data);
+        slot->data = malloc(fs->page_bytes);
+        slot->size = slot->data ? fs->page_bytes : 0;
+        if (slot->data == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the page cache\n");
+            return error_msg;
+        }
+    }
+    const uint64_t page_offset = fs->offset + (uint64_t) page * fs->page_bytes;
+    const char* err;
+    if (fs->page_bytes < DISK_SECTOR_SIZE) {
+        /* Raw disks can only be read by sectors */
+        uint8_t sector[DISK_SECTOR_SIZE];
+        const uint64_t sector_offset = page_offset & ~(uint64_t) (DISK_SECTOR_SIZE - 1);
+        err = disk_read(fs->handle, sector_offset, sector, sizeof(sector));
+        if (err == NULL) {
+            memcpy(slot->data, sector + (page_offset - sector_offset), fs->page_bytes);
+        }
+    } else {
+        err = disk_read(fs->handle, page_offset, slot->data, fs->page_bytes);
+    }
+    if (err) {
+        return err;
+    }
+
+    slot->disk = fs->disk;
+    slot->part = fs->offset;
+    slot->page = page;
+    slot->valid = true;
+    slot->hnext = cache->buckets[bucket];
+    cache->buckets[bucket] = idx;
+    zealfs_cache_unlink(cache, idx);
+    zealfs_cache_push_front(cache, idx);
+    *data = slot->data;
+    return NULL;
+}
+
+
+/**
+ * @brief Open the committed ZealFS partition `partition` of the disk. The header, the bitmap and the FAT
+ * are kept in memory for the whole time the partition is mounted, the other pages go through the cache.
+ *
+ * @param cache Page cache to use, if NULL a private cache of ZEALFS_CACHE_PAGES pages is created.
+ *
+ * @return NULL on success, an error message else.
+ */
+const char* zealfs_mount(zealfs_t* fs, disk_handle_t* handle, const disk_info_t* disk, int partition, zealfs_cache_t* cache)
+{
+    static _Thread_local char error_msg[256];
+    const partition_t* part = &disk->partitions[partition];
+    uint8_t sector[DISK_SECTOR_SIZE];
+    uint64_t fs_size = 0;
+
+    memset(fs, 0, sizeof(zealfs_t));
+    if (!part->active || part->type != 0x5a) {
+        snprintf(error_msg, sizeof(error_msg), "Partition %d is not a ZealFS partition\n", partition);
+        return error_msg;
+    }
+    fs->handle = handle;
+    fs->disk = disk;
+    fs->partition = partition;
+    fs->offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+
+    const char* err = disk_read(handle, fs->offset, sector, sizeof(sector));
+    if (err) {
+        return err;
+    }
+    if (zealfsv2_check_header((const ZealFSHeader*) sector, &fs_size) != 0 ||
+        fs_size > (uint64_t) part->size_sectors * DISK_SECTOR_SIZE) {
+        snprintf(error_msg, sizeof(error_msg), "Partition %d is not a valid ZealFSv2 partition\n", partition);
+        return error_msg;
+    }
+
+    const ZealFSHeader* header = (const ZealFSHeader*) sector;
+    fs->page_bytes = zealfsv2_page_bytes(header);
+    fs->page_count = zealfsv2_page_count(header);
+    fs->fat_entries = zealfsv2_fat_entries(header);
+    const uint32_t fat_bytes = zealfsv2_fat_pages(header) * fs->page_bytes;
+
+    /* Read the first page and the FAT at once, they are contiguous */
+    uint8_t* meta = malloc(fs->page_bytes + fat_bytes);
+    fs->fat = malloc(fat_bytes);
+    if (meta == NULL || fs->fat == NULL) {
+        free(meta);
+        zealfs_unmount(fs);
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the partition\n");
+        return error_msg;
+    }
+    err = disk_read(handle, fs->offset, meta, fs->page_bytes + fat_bytes);
+    if (err) {
+        free(meta);
+        zealfs_unmount(fs);
+        return err;
+    }
+    for (uint32_t i = 0; i < fat_bytes / 2; i++) {
+        fs->fat[i] = meta[fs->page_bytes + i * 2] | (meta[fs->page_bytes + i * 2 + 1] << 8);
+    }
+    fs->header = (ZealFSHeader*) realloc(meta, fs->page_bytes);
+
+    fs->cache = cache;
+    if (fs->cache == NULL) {
+        fs->cache = zealfs_cache_create(ZEALFS_CACHE_PAGES);
+        fs->own_cache = true;
+        if (fs->cache == NULL) {
+            zealfs_unmount(fs);
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the page cache\n");
+            return error_msg;
+        }
+    }
+    return NULL;
+}
+
+
+static void zealfs_drop_pending(zealfs_t* fs)
+{
+    for (uint32_t i = 0; i < fs->pending_count; i++) {
+        fs->pending_idx[fs->pending[i].page] = -1;
+        free(fs->pending[i].data);
+    }
+    fs->pending_count = 0;
+    fs->pending_bytes = 0;
+}
+
+
+/**
+ * @brief Unmount the partition, any change not flushed is lost.
+ */
+void zealfs_unmount(zealfs_t* fs)
+{
+    zealfs_drop_pending(fs);
+    free(fs->pending);
+    free(fs->pending_idx);
+    fs->pending = NULL;
+    fs->pending_idx = NULL;
+    fs->pending_cap = 0;
+    if (fs->own_cache) {
+        zealfs_cache_destroy(fs->cache);
+    }
+    free(fs->header);
+    free(fs->fat);
+    fs->header = NULL;
+    fs->fat = NULL;
+    fs->cache = NULL;
+}
+
+
+/**
+ * @brief Get the page following `page` in its chain, 0 if it is the last one.
+ */
+uint16_t zealfs_next_page(const zealfs_t* fs, uint16_t page)
+{
+    return page < fs->fat_entries ? fs->fat[page] : 0;
+}
+
+
+/**
+ * @brief Get an entry representing the root directory, located in the first page.
+ */
+void zealfs_root(const zealfs_t* fs, zealfs_entry_t* root)
+{
+    memset(root, 0, sizeof(zealfs_entry_t));
+    root->name[0] = '/';
+    root->is_dir = true;
+    root->start_page = 0;
+}
+
+
+static void zealfs_decode_entry(const ZealFileEntry* raw, uint16_t page, uint32_t offset, zealfs_entry_t* entry)
+{
+    memcpy(entry->name, raw->name, ZEALFS_NAME_MAX_LEN);
+    entry->name[ZEALFS_NAME_MAX_LEN] = 0;
+    entry->is_dir = (raw->flags & ZEALFS_IS_DIR) != 0;
+    entry->start_page = raw->start_page;
+    entry->size = raw->size;
+    memcpy(entry->date, raw->date, sizeof(entry->date));
+    entry->dir_page = page;
+    entry->dir_offset = offset;
+}
+
+
+/**
+ * @brief Call `cb` on each occupied entry of the directory `dir`.
+ */
+const char* zealfs_foreach(zealfs_t* fs, const zealfs_entry_t* dir, zealfs_dir_cb_t cb, void* arg)
+{
+    static _Thread_local char error_msg[256];
+    zealfs_entry_t entry;
+
+    if (!dir->is_dir) {
+        snprintf(error_msg, sizeof(error_msg), "%s is not a directory\n", dir->name);
+        return error_msg;
+    }
+
+    if (dir->start_page == 0) {
+        /* The root directory is in memory, after the header, it can't grow */
+        const uint32_t first = zealfsv2_header_size(fs->header);
+        for (uint32_t off = first; off + sizeof(ZealFileEntry) <= fs->page_bytes; off += sizeof(ZealFileEntry)) {
+            const ZealFileEntry* raw = (const ZealFileEntry*) ((const uint8_t*) fs->header + off);
+            if (raw->flags & ZEALFS_IS_OCCUPIED) {
+                zealfs_decode_entry(raw, 0, off, &entry);
+                if (cb(fs, &entry, arg)) {
+                    return NULL;
+                }
+            }
+        }
+        return NULL;
+    }
+
+    /* Follow the chain of pages of the directory, bounded in case of a loop */
+    uint16_t page = dir->start_page;
+    for (uint32_t visited = 0; page != 0 && visited < fs->page_count; visited++) {
+        const uint8_t* data;
+        const char* err = zealfs_read_page(fs, page, &data);
+        if (err) {
+            return err;
+        }
+        /* The callback may read other pages, which would invalidate `data`, decode the page first */
+        for (uint32_t off = 0; off < fs->page_bytes; off += sizeof(ZealFileEntry)) {
+            const ZealFileEntry* raw = (const ZealFileEntry*) (data + off);
+            if ((raw->flags & ZEALFS_IS_OCCUPIED) == 0) {
+                continue;
+            }
+            zealfs_decode_entry(raw, page, off, &entry);
+            if (cb(fs, &entry, arg)) {
+                return NULL;
+            }
+            err = zealfs_read_page(fs, page, &data);
+            if (err) {
+                return err;
+            }
+        }
+        page = zealfs_next_page(fs, page);
+    }
+    return NULL;
+}
+
+
+typedef struct {
+    const char*     name;
+    size_t          len;
+    zealfs_entry_t* result;
+    bool            found;
+} zealfs_lookup_t;
+
+
+static int zealfs_lookup_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    zealfs_lookup_t* lookup = (zealfs_lookup_t*) arg;
+    (void) fs;
+    if (strlen(entry->name) == lookup->len && memcmp(entry->name, lookup->name, lookup->len) == 0) {
+        *lookup->result = *entry;
+        lookup->found = true;
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Look for the entry at the given absolute path, `/` being the separator.
+ */
+const char* zealfs_lookup(zealfs_t* fs, const char* path, zealfs_entry_t* entry)
+{
+    static _Thread_local char error_msg[256];
+    zealfs_root(fs, entry);
+
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == 0) {
+            break;
+        }
+        const char* end = strchr(path, '/');
+        const size_t len = end ? (size_t) (end - path) : strlen(path);
+
+        zealfs_entry_t dir = *entry;
+        zealfs_lookup_t lookup = { .name = path, .len = len, .result = entry };
+        const char* err = zealfs_foreach(fs, &dir, zealfs_lookup_cb, &lookup);
+        if (err) {
+            return err;
+        }
+        if (!lookup.found) {
+            snprintf(error_msg, sizeof(error_msg), "%.*s: no such file or directory\n", (int) len, path);
+            return error_msg;
+        }
+        path += len;
+    }
+    return NULL;
+}
+
+
+static bool zealfs_is_pending(const zealfs_t* fs, uint16_t page)
+{
+    return page == 0 || (fs->pending_idx != NULL && fs->pending_idx[page] >= 0);
+}
+
+
+/**
+ * @brief Read `len` bytes from the file, starting at `offset`.
+ * The whole pages are read directly into `buffer`, bypassing the cache: the runs of consecutive pages
+ * in the chain are gathered and submitted as a single batch, so contiguous files are read sequentially.
+ * Partial pages, and pages smaller than a sector, go through the cache.
+ *
+ * @param read Populated with the number of bytes actually read, which is smaller than `len`
+ *             when the end of the file is reached.
+ */
+const char* zealfs_read(zealfs_t* fs, const zealfs_entry_t* file, uint32_t offset, void* buffer, uint32_t len, uint32_t* read)
+{
+    static _Thread_local char error_msg[256];
+    uint8_t* dst = (uint8_t*) buffer;
+    const char* err = NULL;
+    *read = 0;
+
+    if (file->is_dir) {
+        snprintf(error_msg, sizeof(error_msg), "%s is a directory\n", file->name);
+        return error_msg;
+    }
+    if (offset >= file->size) {
+        return NULL;
+    }
+    len = MIN(len, file->size - offset);
+
+    /* Skip the pages before the offset */
+    uint16_t page = file->start_page;
+    for (uint32_t i = 0; i < offset / fs->page_bytes && page != 0; i++) {
+        page = zealfs_next_page(fs, page);
+    }
+    uint32_t page_off = offset % fs->page_bytes;
+
+    /* At most one request per page, plus the partial ones */
+    disk_io_req_t* reqs = malloc(sizeof(disk_io_req_t) * (len / fs->page_bytes + 1));
+    int req_count = 0;
+    if (reqs == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory to read %s\n", file->name);
+        return error_msg;
+    }
+
+    while (len > 0) {
+        if (page == 0 || page >= fs->page_count) {
+            snprintf(error_msg, sizeof(error_msg), "%s: chain is shorter than the file size\n", file->name);
+            err = error_msg;
+            break;
+        }
+
+        if (page_off != 0 || len < fs->page_bytes || fs->page_bytes < DISK_SECTOR_SIZE || zealfs_is_pending(fs, page)) {
+            const uint8_t* data;
+            err = zealfs_read_page(fs, page, &data);
+            if (err) {
+                break;
+            }
+            const uint32_t count = MIN(len, fs->page_bytes - page_off);
+            memcpy(dst, data + page_off, count);
+            dst += count;
+            *read += count;
+            len -= count;
+            page_off = 0;
+            page = zealfs_next_page(fs, page);
+            continue;
+        }
+
+        /* Extend the run as long as the next page of the chain is the next one on the disk */
+        const uint16_t first = page;
+        uint32_t run = 1;
+        page = zealfs_next_page(fs, page);
+        while ((run + 1) * fs->page_bytes <= len && page == first + run &&
+               page < fs->page_count && !zealfs_is_pending(fs, page)) {
+            run++;
+            page = zealfs_next_page(fs, page);
+        }
+        reqs[req_count++] = (disk_io_req_t) {
+            .offset = fs->offset + (uint64_t) first * fs->page_bytes,
+            .len    = run * fs->page_bytes,
+            .data   = dst,
+        };
+        dst += run * fs->page_bytes;
+        *read += run * fs->page_bytes;
+        len -= run * fs->page_bytes;
+    }
+
+    if (err == NULL && req_count > 0) {
+        err = disk_io_read_batch(fs->handle, reqs, req_count);
+    }
+    free(reqs);
+    return err;
+}
+
+
+/**
+ * @brief Get a modifiable copy of a page, the copy will be written back on flush.
+ *
+ * @param load When true, the copy is initialized with the current content of the page, else it is zeroed.
+ */
+static const char* zealfs_pending_page(zealfs_t* fs, uint16_t page, bool load, uint8_t** data)
+{
+    static _Thread_local char error_msg[256];
+
+    assert(page != 0);
+    if (fs->pending_idx == NULL) {
+        fs->pending_idx = malloc(sizeof(int32_t) * fs->page_count);
+        if (fs->pending_idx == NULL) {
+            goto no_memory;
+        }
+        for (uint32_t i = 0; i < fs->page_count; i++) {
+            fs->pending_idx[i] = -1;
+        }
+    }
+    if (fs->pending_idx[page] >= 0) {
+        /* The page may have been freed and allocated again since, its old content must not leak */
+        *data = fs->pending[fs->pending_idx[page]].data;
+        if (!load) {
+            memset(*data, 0, fs->page_bytes);
+        }
+        return NULL;
+    }
+
+    if (fs->pending_count == fs->pending_cap) {
+        const uint32_t cap = fs->pending_cap ? fs->pending_cap * 2 : 64;
+        zealfs_pending_t* pending = realloc(fs->pending, sizeof(zealfs_pending_t) * cap);
+        if (pending == NULL) {
+            goto no_memory;
+        }
+        fs->pending = pending;
+        fs->pending_cap = cap;
+    }
+
+    uint8_t* buffer = malloc(fs->page_bytes);
+    if (buffer == NULL) {
+        goto no_memory;
+    }
+    if (load) {
+        const uint8_t* current;
+        const char* err = zealfs_read_page(fs, page, &current);
+        if (err) {
+            free(buffer);
+            return err;
+        }
+        memcpy(buffer, current, fs->page_bytes);
+    } else {
+        memset(buffer, 0, fs->page_bytes);
+    }
+
+    fs->pending[fs->pending_count] = (zealfs_pending_t) { .page = page, .data = buffer };
+    fs->pending_idx[page] = fs->pending_count++;
+    fs->pending_bytes += fs->page_bytes;
+    *data = buffer;
+    return NULL;
+
+no_memory:
+    snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the modified pages\n");
+    return error_msg;
+}
+
+
+static void zealfs_set_used(zealfs_t* fs, uint32_t page, bool used)
+{
+    uint8_t* byte = &fs->header->pages_bitmap[page / 8];
+    const uint8_t mask = 1 << (page % 8);
+    if (used && (*byte & mask) == 0) {
+        *byte |= mask;
+        fs->header->free_pages--;
+    } else if (!used && (*byte & mask) != 0) {
+        *byte &= ~mask;
+        fs->header->free_pages++;
+    }
+    fs->meta_dirty = true;
+}
+
+
+/**
+ * @brief Find a run of free pages. The first run big enough is returned, if there is none, the biggest
+ * run is returned. Only the pages that have an entry in the FAT can be allocated.
+ *
+ * @return First page of the run, 0 if the partition is full.
+ */
+static uint32_t zealfs_find_run(zealfs_t* fs, uint32_t count, uint32_t* run_len)
+{
+    const uint8_t* bitmap = fs->header->pages_bitmap;
+    const uint32_t limit = fs->fat_entries;
+    uint32_t best = 0;
+    uint32_t best_len = 0;
+
+    uint32_t page = zealfsv2_bitmap_find(bitmap, limit, fs->alloc_hint, 0);
+    /* All the pages before the first free one are used, no need to scan them next time */
+    fs->alloc_hint = page;
+    while (page < limit) {
+        const uint32_t end = zealfsv2_bitmap_find(bitmap, limit, page, 1);
+        if (end - page >= count) {
+            *run_len = count;
+            return page;
+        }
+        if (end - page > best_len) {
+            best = page;
+            best_len = end - page;
+        }
+        page = zealfsv2_bitmap_find(bitmap, limit, end, 0);
+    }
+
+    *run_len = best_len;
+    return best;
+}
+
+
+/**
+ * @brief Allocate a chain of `count` pages, as contiguous as possible, and link them in the FAT.
+ *
+ * @param first Populated with the first page of the chain.
+ */
+const char* zealfs_alloc(zealfs_t* fs, uint32_t count, uint16_t* first)
+{
+    static _Thread_local char error_msg[256];
+    uint32_t prev = 0;
+
+    assert(count > 0);
+    if (count > fs->header->free_pages) {
+        snprintf(error_msg, sizeof(error_msg), "Not enough space in the partition (%u pages needed, %u free)\n",
+                 count, fs->header->free_pages);
+        return error_msg;
+    }
+
+    *first = 0;
+    while (count > 0) {
+        uint32_t len = 0;
+        const uint32_t start = zealfs_find_run(fs, count, &len);
+        if (len == 0) {
+            /* Free pages without a FAT entry can't be used, release what was allocated */
+            zealfs_free_chain(fs, *first);
+            *first = 0;
+            snprintf(error_msg, sizeof(error_msg), "Not enough space in the partition\n");
+            return error_msg;
+        }
+        for (uint32_t page = start; page < start + len; page++) {
+            zealfs_set_used(fs, page, true);
+            if (prev != 0) {
+                fs->fat[prev] = (uint16_t) page;
+            } else {
+                *first = (uint16_t) page;
+            }
+            fs->fat[page] = 0;
+            prev = page;
+        }
+        count -= len;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Release all the pages of the chain starting at `first`.
+ */
+void zealfs_free_chain(zealfs_t* fs, uint16_t first)
+{
+    uint16_t page = first;
+    for (uint32_t visited = 0; page != 0 && page < fs->fat_entries && visited < fs->page_count; visited++) {
+        const uint16_t next = fs->fat[page];
+        zealfs_set_used(fs, page, false);
+        fs->fat[page] = 0;
+        if (page < fs->alloc_hint) {
+            fs->alloc_hint = page;
+        }
+        page = next;
+    }
+}
+
+
+/**
+ * @brief Change the size of a file, pages are released from the end of its chain or appended to it.
+ * The entry itself is only updated in memory, it must be written back with `zealfs_update_entry`.
+ */
+const char* zealfs_resize(zealfs_t* fs, zealfs_entry_t* entry, uint32_t size)
+{
+    static _Thread_local char error_msg[256];
+    const uint32_t needed = MAX((size + fs->page_bytes - 1) / fs->page_bytes, 1);
+    uint32_t count = 1;
+    uint16_t last = entry->start_page;
+
+    /* Find the last page to keep, or the end of the chain if it is too short */
+    while (count < needed && zealfs_next_page(fs, last) != 0 && count < fs->page_count) {
+        last = zealfs_next_page(fs, last);
+        count++;
+    }
+    if (last == 0 || last >= fs->fat_entries) {
+        snprintf(error_msg, sizeof(error_msg), "%s: invalid chain\n", entry->name);
+        return error_msg;
+    }
+
+    if (count == needed) {
+        const uint16_t tail = fs->fat[last];
+        fs->fat[last] = 0;
+        zealfs_free_chain(fs, tail);
+    } else {
+        uint16_t first;
+        const char* err = zealfs_alloc(fs, needed - count, &first);
+        if (err) {
+            return err;
+        }
+        fs->fat[last] = first;
+    }
+    fs->meta_dirty = true;
+    entry->size = size;
+    return NULL;
+}
+
+
+/**
+ * @brief Set the content of a page, `len` bytes at most, the rest of the page is zeroed.
+ * The modified pages are written back in LBA order on flush, or when they reach ZEALFS_FLUSH_BYTES.
+ */
+const char* zealfs_write_page(zealfs_t* fs, uint16_t page, const void* data, uint32_t len)
+{
+    uint8_t* buffer;
+    const char* err = zealfs_pending_page(fs, page, false, &buffer);
+    if (err) {
+        return err;
+    }
+    memcpy(buffer, data, MIN(len, fs->page_bytes));
+    if (len < fs->page_bytes) {
+        memset(buffer + len, 0, fs->page_bytes - len);
+    }
+    if (fs->pending_bytes >= ZEALFS_FLUSH_BYTES) {
+        return zealfs_flush(fs);
+    }
+    return NULL;
+}
+
+
+static void zealfs_encode_entry(const zealfs_entry_t* entry, ZealFileEntry* raw)
+{
+    memset(raw, 0, sizeof(ZealFileEntry));
+    raw->flags = ZEALFS_IS_OCCUPIED | (entry->is_dir ? ZEALFS_IS_DIR : 0);
+    memcpy(raw->name, entry->name, strnlen(entry->name, ZEALFS_NAME_MAX_LEN));
+    raw->start_page = entry->start_page;
+    raw->size = entry->size;
+    memcpy(raw->date, entry->date, sizeof(raw->date));
+}
+
+
+/**
+ * @brief Get a pointer to the raw entry located at `dir_offset` in the directory page `dir_page`.
+ * The page is marked as modified.
+ */
+static const char* zealfs_raw_entry(zealfs_t* fs, uint16_t dir_page, uint32_t dir_offset, ZealFileEntry** raw)
+{
+    if (dir_page == 0) {
+        fs->meta_dirty = true;
+        *raw = (ZealFileEntry*) ((uint8_t*) fs->header + dir_offset);
+        return NULL;
+    }
+    uint8_t* data;
+    const char* err = zealfs_pending_page(fs, dir_page, true, &data);
+    if (err) {
+        return err;
+    }
+    *raw = (ZealFileEntry*) (data + dir_offset);
+    return NULL;
+}
+
+
+/**
+ * @brief Write back an entry at its location in its directory, after its size, date or pages changed.
+ */
+const char* zealfs_update_entry(zealfs_t* fs, const zealfs_entry_t* entry)
+{
+    ZealFileEntry* raw;
+    const char* err = zealfs_raw_entry(fs, entry->dir_page, entry->dir_offset, &raw);
+    if (err == NULL) {
+        zealfs_encode_entry(entry, raw);
+    }
+    return err;
+}
+
+
+/**
+ * @brief Find a free entry in the directory, the directory is extended with a new page if it is full.
+ */
+static const char* zealfs_free_slot(zealfs_t* fs, const zealfs_entry_t* dir, uint16_t* dir_page, uint32_t* dir_offset)
+{
+    static _Thread_local char error_msg[256];
+
+    if (dir->start_page == 0) {
+        for (uint32_t off = zealfsv2_header_size(fs->header); off + sizeof(ZealFileEntry) <= fs->page_bytes; off += sizeof(ZealFileEntry)) {
+            const ZealFileEntry* raw = (const ZealFileEntry*) ((const uint8_t*) fs->header + off);
+            if ((raw->flags & ZEALFS_IS_OCCUPIED) == 0) {
+                *dir_page = 0;
+                *dir_offset = off;
+                return NULL;
+            }
+        }
+        snprintf(error_msg, sizeof(error_msg), "Root directory is full\n");
+        return error_msg;
+    }
+
+    uint16_t page = dir->start_page;
+    uint16_t last = page;
+    for (uint32_t visited = 0; page != 0 && visited < fs->page_count; visited++) {
+        const uint8_t* data;
+        const char* err = zealfs_read_page(fs, page, &data);
+        if (err) {
+            return err;
+        }
+        for (uint32_t off = 0; off < fs->page_bytes; off += sizeof(ZealFileEntry)) {
+            if ((((const ZealFileEntry*) (data + off))->flags & ZEALFS_IS_OCCUPIED) == 0) {
+                *dir_page = page;
+                *dir_offset = off;
+                return NULL;
+            }
+        }
+        last = page;
+        page = zealfs_next_page(fs, page);
+    }
+
+    /* The directory is full, extend it with an empty page */
+    uint16_t new_page;
+    const char* err = zealfs_alloc(fs, 1, &new_page);
+    if (err) {
+        return err;
+    }
+    uint8_t* data;
+    err = zealfs_pending_page(fs, new_page, false, &data);
+    if (err) {
+        return err;
+    }
+    fs->fat[last] = new_page;
+    *dir_page = new_page;
+    *dir_offset = 0;
+    return NULL;
+}
+
+
+/**
+ * @brief Create a new file or directory in `dir`. The pages for `size` bytes are allocated, at least one,
+ * the content of a file must then be written with `zealfs_write_page` following the chain.
+ */
+const char* zealfs_create(zealfs_t* fs, const zealfs_entry_t* dir, const char* name, bool is_dir,
+                          uint32_t size, const uint8_t date[8], zealfs_entry_t* entry)
+{
+    static _Thread_local char error_msg[256];
+    const size_t len = strlen(name);
+
+    if (len == 0 || len > ZEALFS_NAME_MAX_LEN || strchr(name, '/') != NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Invalid name %s, names are at most %d characters\n", name, ZEALFS_NAME_MAX_LEN);
+        return error_msg;
+    }
+
+    memset(entry, 0, sizeof(zealfs_entry_t));
+    memcpy(entry->name, name, len);
+    entry->is_dir = is_dir;
+    entry->size = is_dir ? 0 : size;
+    if (date) {
+        memcpy(entry->date, date, sizeof(entry->date));
+    }
+
+    /* Allocate the pages first, the directory may need one too */
+    const uint32_t pages = is_dir ? 1 : MAX((size + fs->page_bytes - 1) / fs->page_bytes, 1);
+    const char* err = zealfs_alloc(fs, pages, &entry->start_page);
+    if (err) {
+        return err;
+    }
+    if (is_dir) {
+        uint8_t* data;
+        err = zealfs_pending_page(fs, entry->start_page, false, &data);
+    }
+    if (err == NULL) {
+        err = zealfs_free_slot(fs, dir, &entry->dir_page, &entry->dir_offset);
+    }
+    if (err == NULL) {
+        err = zealfs_update_entry(fs, entry);
+    }
+    if (err) {
+        zealfs_free_chain(fs, entry->start_page);
+    }
+    return err;
+}
+
+
+static int zealfs_remove_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    const char** err = (const char**) arg;
+    *err = zealfs_remove(fs, entry);
+    return *err != NULL;
+}
+
+
+/**
+ * @brief Remove a file or a directory, recursively, and release its pages.
+ */
+const char* zealfs_remove(zealfs_t* fs, const zealfs_entry_t* entry)
+{
+    const char* err = NULL;
+
+    if (entry->is_dir) {
+        const char* iter_err = zealfs_foreach(fs, entry, zealfs_remove_cb, &err);
+        if (iter_err || err) {
+            return iter_err ? iter_err : err;
+        }
+    }
+
+    ZealFileEntry* raw;
+    err = zealfs_raw_entry(fs, entry->dir_page, entry->dir_offset, &raw);
+    if (err) {
+        return err;
+    }
+    raw->flags = 0;
+    zealfs_free_chain(fs, entry->start_page);
+    return NULL;
+}
+
+
+/**
+ * @brief Write all the modified pages back to the disk, in LBA order, followed by the header,
+ * the bitmap and the FAT if they changed. The metadata is written in a second step so that it
+ * never refers to pages that are not on the disk yet.
+ */
+const char* zealfs_flush(zealfs_t* fs)
+{
+    static _Thread_local char error_msg[256];
+    const uint32_t fat_bytes = zealfsv2_fat_pages(fs->header) * fs->page_bytes;
+    const char* err = NULL;
+
+    /* Raw disks can only be written by sectors, make sure both pages of a sector are written together */
+    if (fs->page_bytes < DISK_SECTOR_SIZE) {
+        const uint32_t count = fs->pending_count;
+        for (uint32_t i = 0; i < count && err == NULL; i++) {
+            uint8_t* buddy;
+            err = zealfs_pending_page(fs, fs->pending[i].page ^ 1, true, &buddy);
+        }
+        if (err) {
+            return err;
+        }
+    }
+
+    if (fs->pending_count > 0) {
+        disk_io_req_t* reqs = malloc(sizeof(disk_io_req_t) * fs->pending_count);
+        if (reqs == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory to flush the partition\n");
+            return error_msg;
+        }
+        for (uint32_t i = 0; i < fs->pending_count; i++) {
+            reqs[i] = (disk_io_req_t) {
+                .offset = fs->offset + (uint64_t) fs->pending[i].page * fs->page_bytes,
+                .len    = fs->page_bytes,
+                .data   = fs->pending[i].data,
+            };
+        }
+        err = disk_io_write_batch(fs->handle, reqs, fs->pending_count);
+        free(reqs);
+        if (err) {
+            return err;
+        }
+        for (uint32_t i = 0; i < fs->pending_count; i++) {
+            zealfs_cache_invalidate(fs->cache, fs->disk, fs->offset, fs->pending[i].page);
+        }
+        zealfs_drop_pending(fs);
+    }
+
+    /* The first page and the FAT are contiguous, write them with a single request */
+    if (fs->meta_dirty) {
+        uint8_t* meta = malloc(fs->page_bytes + fat_bytes);
+        if (meta == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory to flush the partition\n");
+            return error_msg;
+        }
+        memcpy(meta, fs->header, fs->page_bytes);
+        for (uint32_t i = 0; i < fat_bytes / 2; i++) {
+            meta[fs->page_bytes + i * 2] = fs->fat[i] & 0xff;
+            meta[fs->page_bytes + i * 2 + 1] = fs->fat[i] >> 8;
+        }
+        disk_io_req_t req = { .offset = fs->offset, .len = fs->page_bytes + fat_bytes, .data = meta };
+        err = disk_io_write_batch(fs->handle, &req, 1);
+        if (err == NULL) {
+            fs->meta_dirty = false;
+        }
+        free(meta);
+    }
+    return err;
+}
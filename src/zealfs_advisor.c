@@ -0,0 +1,213 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zealfs.h"
+
+/* Partition sizes simulated, from 64KB to 4GB, as proposed when creating a partition */
+#define ADVISOR_MIN_SHIFT   16
+#define ADVISOR_MAX_SHIFT   32
+/* Page sizes simulated, from 256 bytes to 64KB */
+#define ADVISOR_PAGE_CODES  9
+/* Free pages, in percent of the usable ones, the recommended partition keeps to let the files grow */
+#define ADVISOR_HEADROOM    25
+
+
+/**
+ * @brief Add `count` files of `size` bytes to the workload.
+ */
+const char* zealfs_workload_add_files(zealfs_workload_t* workload, uint32_t size, uint32_t count)
+{
+    static _Thread_local char error_msg[256];
+
+    if (workload->bin_count == workload->bin_cap) {
+        const uint32_t cap = workload->bin_cap ? workload->bin_cap * 2 : 256;
+        zealfs_size_bin_t* bins = realloc(workload->bins, sizeof(zealfs_size_bin_t) * cap);
+        if (bins == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the workload\n");
+            return error_msg;
+        }
+        workload->bins = bins;
+        workload->bin_cap = cap;
+    }
+    workload->bins[workload->bin_count++] = (zealfs_size_bin_t) { .size = size, .count = count };
+    workload->files += count;
+    workload->bytes += (uint64_t) size * count;
+    return NULL;
+}
+
+
+/**
+ * @brief Add a directory, other than the root, holding `entries` files and directories to the workload.
+ */
+const char* zealfs_workload_add_dir(zealfs_workload_t* workload, uint32_t entries)
+{
+    static _Thread_local char error_msg[256];
+
+    if (workload->dir_count == workload->dir_cap) {
+        const uint32_t cap = workload->dir_cap ? workload->dir_cap * 2 : 64;
+        uint32_t* dirs = realloc(workload->dirs, sizeof(uint32_t) * cap);
+        if (dirs == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the workload\n");
+            return error_msg;
+        }
+        workload->dirs = dirs;
+        workload->dir_cap = cap;
+    }
+    workload->dirs[workload->dir_count++] = entries;
+    return NULL;
+}
+
+
+/**
+ * @brief Load a histogram of file sizes from a text file. Each line gives a size in bytes, optionally
+ * followed by the number of files of that size, lines starting with '#' are ignored.
+ * The histogram doesn't describe any tree, the files are assumed to be in a single directory.
+ */
+const char* zealfs_workload_from_histogram(zealfs_workload_t* workload, const char* path)
+{
+    static _Thread_local char error_msg[1100];
+    const char* err = NULL;
+    char line[256];
+    int line_num = 0;
+
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open %s\n", path);
+        return error_msg;
+    }
+    while (err == NULL && fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long long size;
+        unsigned long count = 1;
+        line_num++;
+        const char* start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\r' || *start == 0) {
+            continue;
+        }
+        const int fields = sscanf(start, "%llu %lu", &size, &count);
+        if (fields < 1 || size > UINT32_MAX || count > UINT32_MAX) {
+            snprintf(error_msg, sizeof(error_msg), "%s:%d: expected a size and a count\n", path, line_num);
+            err = error_msg;
+            break;
+        }
+        if (count > 0) {
+            err = zealfs_workload_add_files(workload, (uint32_t) size, (uint32_t) count);
+        }
+    }
+    fclose(fp);
+
+    if (err == NULL && workload->files > 0) {
+        workload->root_entries = 1;
+        err = zealfs_workload_add_dir(workload, (uint32_t) MIN(workload->files, UINT32_MAX));
+    }
+    return err;
+}
+
+
+void zealfs_workload_free(zealfs_workload_t* workload)
+{
+    free(workload->bins);
+    free(workload->dirs);
+    memset(workload, 0, sizeof(zealfs_workload_t));
+}
+
+
+/**
+ * @brief Simulate the workload on a partition of `part_size` bytes formatted with pages of `page_bytes` bytes.
+ *
+ * @return false if the layout itself is not possible, for example when the bitmap doesn't fit in the first page.
+ */
+static bool advisor_simulate(const zealfs_workload_t* workload, uint64_t part_size, uint32_t page_bytes,
+                             zealfs_advice_t* row)
+{
+    const uint64_t page_count = part_size / page_bytes;
+    /* Pages are addressed with 16 bits, the bitmap and at least one root entry must fit in the first page */
+    if (page_count > 65536 || page_count < 8) {
+        return false;
+    }
+    const uint32_t header_size = (sizeof(ZealFSHeader) + page_count / 8 + sizeof(ZealFileEntry) - 1)
+                               / sizeof(ZealFileEntry) * sizeof(ZealFileEntry);
+    if (header_size + sizeof(ZealFileEntry) > page_bytes) {
+        return false;
+    }
+    const uint32_t fat_pages = page_bytes == 256 ? 1 : 2;
+    const uint32_t fat_entries = MIN(page_count, fat_pages * page_bytes / 2);
+    if (fat_entries <= 1 + fat_pages) {
+        return false;
+    }
+
+    memset(row, 0, sizeof(zealfs_advice_t));
+    row->part_size = part_size;
+    row->page_bytes = page_bytes;
+    row->standard = zealfsv2_page_size(part_size) == (int) page_bytes;
+    row->page_count = (uint32_t) page_count;
+    row->usable_pages = fat_entries - 1 - fat_pages;
+    row->root_max = (page_bytes - header_size) / sizeof(ZealFileEntry);
+
+    /* Each file takes at least one page, even when empty */
+    uint64_t used = 0;
+    for (uint32_t i = 0; i < workload->bin_count; i++) {
+        const zealfs_size_bin_t* bin = &workload->bins[i];
+        const uint64_t pages = MAX(((uint64_t) bin->size + page_bytes - 1) / page_bytes, 1);
+        used += pages * bin->count;
+        row->slack += (pages * page_bytes - bin->size) * bin->count;
+    }
+    uint64_t dir_pages = 0;
+    const uint32_t per_page = page_bytes / sizeof(ZealFileEntry);
+    for (uint32_t i = 0; i < workload->dir_count; i++) {
+        dir_pages += MAX((workload->dirs[i] + per_page - 1) / per_page, 1);
+    }
+    used += dir_pages;
+
+    row->used_pages = (uint32_t) MIN(used, UINT32_MAX);
+    row->fits = used <= row->usable_pages && workload->root_entries <= row->root_max;
+    row->overhead = ((uint64_t) (1 + fat_pages) + dir_pages + (page_count - fat_entries)) * page_bytes;
+    return true;
+}
+
+
+/**
+ * @brief Simulate the workload on all the partition sizes with all the page sizes that the layout allows.
+ * Only the page size chosen by the format for each partition size can be created, the others are given
+ * for comparison.
+ *
+ * @param recommended Populated with the index of the recommended row, the smallest partition holding the
+ *                    workload with ADVISOR_HEADROOM percent of its pages still free, or the smallest partition
+ *                    holding it at all. -1 if the workload doesn't fit in any partition.
+ *
+ * @return Number of rows populated, sorted by partition size then page size.
+ */
+int zealfs_advise(const zealfs_workload_t* workload, zealfs_advice_t* rows, int max_rows, int* recommended)
+{
+    int count = 0;
+    int smallest_fit = -1;
+    *recommended = -1;
+
+    for (int shift = ADVISOR_MIN_SHIFT; shift <= ADVISOR_MAX_SHIFT; shift++) {
+        for (int code = 0; code < ADVISOR_PAGE_CODES && count < max_rows; code++) {
+            zealfs_advice_t* row = &rows[count];
+            if (!advisor_simulate(workload, 1ULL << shift, 256U << code, row)) {
+                continue;
+            }
+            if (row->standard && row->fits) {
+                const uint64_t free_pages = row->usable_pages - row->used_pages;
+                if (smallest_fit < 0) {
+                    smallest_fit = count;
+                }
+                if (*recommended < 0 && free_pages * 100 >= (uint64_t) row->usable_pages * ADVISOR_HEADROOM) {
+                    *recommended = count;
+                }
+            }
+            count++;
+        }
+    }
+
+    if (*recommended < 0) {
+        *recommended = smallest_fit;
+    }
+    return count;
+}
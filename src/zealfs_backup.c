@@ -0,0 +1,308 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zealfs.h"
+#include "disk_io.h"
+#include "job.h"
+#include "log.h"
+
+/**
+ * Backup file layout, all the fields are little-endian:
+ *   - backup_header_t
+ *   - index: `used_pages` page numbers (uint16_t), in increasing order, the first one is always 0
+ *   - the content of these pages, in the same order
+ * The checksum covers everything after the header.
+ */
+#define BACKUP_MAGIC        "ZFSBACK"
+#define BACKUP_VERSION      1
+/* Size of the reads and writes */
+#define BACKUP_CHUNK_SIZE   (1*MB)
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t page_bytes;
+    uint32_t page_count;
+    uint32_t used_pages;
+    uint64_t size;
+    uint64_t checksum;
+} backup_header_t;
+
+
+/**
+ * @brief Build the list of the pages marked as used in the bitmap.
+ */
+static uint32_t backup_used_pages(const ZealFSHeader* header, uint32_t page_count, uint16_t* index)
+{
+    uint32_t count = 0;
+    uint32_t page = zealfsv2_bitmap_find(header->pages_bitmap, page_count, 0, 1);
+    while (page < page_count) {
+        const uint32_t end = zealfsv2_bitmap_find(header->pages_bitmap, page_count, page, 0);
+        for (; page < end; page++) {
+            index[count++] = (uint16_t) page;
+        }
+        page = zealfsv2_bitmap_find(header->pages_bitmap, page_count, end, 1);
+    }
+    return count;
+}
+
+
+/**
+ * @brief Save the partition in a compact file holding only the pages marked as used in the bitmap.
+ * Runs of used pages are read with large sequential reads, so the time depends on the used data only.
+ */
+const char* zealfs_backup(zealfs_t* fs, const char* path)
+{
+    static _Thread_local char error_msg[1024];
+    const char* err = NULL;
+    backup_header_t header = {
+        .magic      = BACKUP_MAGIC,
+        .version    = BACKUP_VERSION,
+        .page_bytes = fs->page_bytes,
+        .page_count = fs->page_count,
+        .size       = (uint64_t) fs->page_count * fs->page_bytes,
+    };
+
+    uint16_t* index = malloc(sizeof(uint16_t) * fs->page_count);
+    uint8_t* buffer = malloc(BACKUP_CHUNK_SIZE);
+    FILE* fp = fopen(path, "wb");
+    if (index == NULL || buffer == NULL || fp == NULL) {
+        snprintf(error_msg, sizeof(error_msg), fp ? "Could not allocate memory for the backup\n" : "Could not create %s\n", path);
+        err = error_msg;
+        goto end;
+    }
+    setvbuf(fp, NULL, _IOFBF, BACKUP_CHUNK_SIZE);
+
+    header.used_pages = backup_used_pages(fs->header, fs->page_count, index);
+    job_add_total((uint64_t) header.used_pages * fs->page_bytes);
+    uint64_t checksum = disk_io_hash(index, sizeof(uint16_t) * header.used_pages);
+    bool success = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+                   fwrite(index, sizeof(uint16_t), header.used_pages, fp) == header.used_pages;
+
+    /* The pages are read run by run, a run being the consecutive used pages, in chunks of BACKUP_CHUNK_SIZE.
+     * Pages smaller than a sector are read by pairs, the extra page is simply not saved. */
+    const uint32_t align = fs->page_bytes < DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE / fs->page_bytes : 1;
+    const uint32_t chunk_pages = BACKUP_CHUNK_SIZE / fs->page_bytes;
+    for (uint32_t i = 0; success && err == NULL && i < header.used_pages; ) {
+        const uint32_t first = index[i] - index[i] % align;
+        uint32_t last = index[i];
+        uint32_t j = i + 1;
+        while (j < header.used_pages && index[j] == last + 1 && index[j] - first < chunk_pages - align) {
+            last = index[j++];
+        }
+        const uint32_t count = (last - first + align) / align * align;
+
+        err = disk_read(fs->handle, fs->offset + (uint64_t) first * fs->page_bytes, buffer, count * fs->page_bytes);
+        if (err) {
+            break;
+        }
+        const uint8_t* data = buffer + (index[i] - first) * fs->page_bytes;
+        const uint32_t len = (j - i) * fs->page_bytes;
+        /* The in-memory copy of the first page is the reference, it may be more recent than the disk */
+        if (index[i] == 0) {
+            memcpy(buffer, fs->header, fs->page_bytes);
+        }
+        checksum = disk_io_hash_update(checksum, data, len);
+        success = fwrite(data, 1, len, fp) == len;
+        job_add_progress(len);
+        i = j;
+    }
+
+    /* Now that all the content is known, write the final header */
+    header.checksum = checksum;
+    success = success && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    if (err == NULL && !success) {
+        snprintf(error_msg, sizeof(error_msg), "Could not write %s\n", path);
+        err = error_msg;
+    }
+    if (err == NULL) {
+        LOG_I("ZEALFS", "Saved %u used pages out of %u in %s", header.used_pages, header.page_count, path);
+    }
+
+end:
+    if (fp && fclose(fp) != 0 && err == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not write %s\n", path);
+        err = error_msg;
+    }
+    free(buffer);
+    free(index);
+    return err;
+}
+
+
+/**
+ * @brief Flush the requests gathered by the restore, in LBA order.
+ */
+static const char* restore_flush(disk_handle_t* handle, disk_io_req_t* reqs, int* count, uint32_t* used)
+{
+    const char* err = disk_io_write_batch(handle, reqs, *count);
+    *count = 0;
+    *used = 0;
+    return err;
+}
+
+
+/**
+ * @brief Write a backup made by `zealfs_backup` to the committed ZealFS partition `partition` of the disk,
+ * which must be at least as big as the saved one. The saved pages are written in LBA order with batched writes,
+ * the FAT entries of the unused pages are cleared. The content of the other pages of the target is left as is.
+ */
+const char* zealfs_restore(disk_handle_t* handle, const disk_info_t* disk, int partition, const char* path)
+{
+    static _Thread_local char error_msg[1024];
+    const partition_t* part = &disk->partitions[partition];
+    const char* err = NULL;
+    backup_header_t header;
+    uint16_t* index = NULL;
+    uint8_t* buffer = NULL;
+    disk_io_req_t* reqs = NULL;
+
+    if (!part->active || part->type != 0x5a) {
+        snprintf(error_msg, sizeof(error_msg), "Partition %d is not a ZealFS partition\n", partition);
+        return error_msg;
+    }
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open %s\n", path);
+        return error_msg;
+    }
+    setvbuf(fp, NULL, _IOFBF, BACKUP_CHUNK_SIZE);
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, BACKUP_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != BACKUP_VERSION || header.page_bytes < 256 || header.page_bytes > BACKUP_CHUNK_SIZE ||
+        header.used_pages == 0 || header.used_pages > header.page_count || header.page_count > 65536) {
+        snprintf(error_msg, sizeof(error_msg), "%s is not a valid ZealFS backup\n", path);
+        err = error_msg;
+        goto end;
+    }
+    if (header.size > (uint64_t) part->size_sectors * DISK_SECTOR_SIZE) {
+        snprintf(error_msg, sizeof(error_msg), "The backup is bigger than partition %d\n", partition);
+        err = error_msg;
+        goto end;
+    }
+
+    const uint64_t offset = (uint64_t) part->start_lba * DISK_SECTOR_SIZE;
+    const uint32_t page_bytes = header.page_bytes;
+    /* Each page may need its sector buddy when pages are smaller than a sector */
+    const uint32_t max_reqs = 2 * (BACKUP_CHUNK_SIZE / page_bytes + 1);
+    index = malloc(sizeof(uint16_t) * header.used_pages);
+    buffer = malloc(BACKUP_CHUNK_SIZE + page_bytes);
+    reqs = malloc(sizeof(disk_io_req_t) * max_reqs);
+    if (index == NULL || buffer == NULL || reqs == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the restore\n");
+        err = error_msg;
+        goto end;
+    }
+    if (fread(index, sizeof(uint16_t), header.used_pages, fp) != header.used_pages || index[0] != 0) {
+        snprintf(error_msg, sizeof(error_msg), "%s is truncated\n", path);
+        err = error_msg;
+        goto end;
+    }
+    for (uint32_t i = 1; i < header.used_pages; i++) {
+        if (index[i] <= index[i - 1] || index[i] >= header.page_count) {
+            snprintf(error_msg, sizeof(error_msg), "%s has an invalid index\n", path);
+            err = error_msg;
+            goto end;
+        }
+    }
+
+    /* Verify the whole content before touching the target, the first page is kept in `meta` as it is
+     * needed to clean the FAT and it is written with the last batch */
+    uint8_t* meta = buffer + BACKUP_CHUNK_SIZE;
+    const long data_start = ftell(fp);
+    const uint64_t data_size = (uint64_t) header.used_pages * page_bytes;
+    uint64_t checksum = disk_io_hash(index, sizeof(uint16_t) * header.used_pages);
+    for (uint64_t done = 0; done < data_size; ) {
+        const size_t len = (size_t) MIN(data_size - done, BACKUP_CHUNK_SIZE);
+        if (fread(buffer, 1, len, fp) != len) {
+            snprintf(error_msg, sizeof(error_msg), "%s is truncated\n", path);
+            err = error_msg;
+            goto end;
+        }
+        if (done == 0) {
+            memcpy(meta, buffer, page_bytes);
+        }
+        checksum = disk_io_hash_update(checksum, buffer, len);
+        done += len;
+    }
+    const ZealFSHeader* fs_header = (const ZealFSHeader*) meta;
+    if (checksum != header.checksum || zealfsv2_check_header(fs_header, NULL) != 0 ||
+        zealfsv2_page_count(fs_header) != header.page_count) {
+        snprintf(error_msg, sizeof(error_msg), "%s is corrupted, nothing was written\n", path);
+        err = error_msg;
+        goto end;
+    }
+    if (fseek(fp, data_start + page_bytes, SEEK_SET) != 0) {
+        snprintf(error_msg, sizeof(error_msg), "Could not read %s\n", path);
+        err = error_msg;
+        goto end;
+    }
+    job_add_total(data_size);
+
+    /* The pages are gathered in `buffer` and written in batches, in LBA order */
+    const uint32_t align = page_bytes < DISK_SECTOR_SIZE ? DISK_SECTOR_SIZE / page_bytes : 1;
+    const uint32_t fat_pages = zealfsv2_fat_pages(fs_header);
+    static const uint8_t zero_page[DISK_SECTOR_SIZE];
+    int req_count = 0;
+    uint32_t used = 0;
+
+    for (uint32_t i = 1; i < header.used_pages && err == NULL; i++) {
+        const uint16_t page = index[i];
+        uint8_t* data = buffer + used;
+        if (fread(data, 1, page_bytes, fp) != page_bytes) {
+            snprintf(error_msg, sizeof(error_msg), "Could not read %s\n", path);
+            err = error_msg;
+            break;
+        }
+
+        /* Clear the FAT entries of the pages that are not used */
+        if (page <= fat_pages) {
+            for (uint32_t e = 0; e < page_bytes / 2; e++) {
+                const uint32_t entry = (page - 1) * page_bytes / 2 + e;
+                if (entry >= header.page_count || (fs_header->pages_bitmap[entry / 8] & (1 << (entry % 8))) == 0) {
+                    data[e * 2] = 0;
+                    data[e * 2 + 1] = 0;
+                }
+            }
+        }
+
+        reqs[req_count++] = (disk_io_req_t) { .offset = offset + (uint64_t) page * page_bytes, .len = page_bytes, .data = data };
+        used += page_bytes;
+        /* Raw disks are written by sectors, complete the sector with an empty page if its buddy isn't saved.
+         * The buddy of page 1 is page 0, written at the end. */
+        if (align > 1 && page > 1) {
+            const uint16_t buddy = page ^ 1;
+            const bool saved = (buddy < page) ? (index[i - 1] == buddy) : (i + 1 < header.used_pages && index[i + 1] == buddy);
+            if (!saved) {
+                reqs[req_count++] = (disk_io_req_t) { .offset = offset + (uint64_t) buddy * page_bytes, .len = page_bytes, .data = (uint8_t*) zero_page };
+            }
+        }
+        job_add_progress(page_bytes);
+
+        if (used + page_bytes > BACKUP_CHUNK_SIZE || req_count + 3 > (int) max_reqs) {
+            err = restore_flush(handle, reqs, &req_count, &used);
+        }
+    }
+
+    /* The first page, holding the header and the bitmap, goes with the last batch */
+    if (err == NULL) {
+        reqs[req_count++] = (disk_io_req_t) { .offset = offset, .len = page_bytes, .data = meta };
+        job_add_progress(page_bytes);
+        err = restore_flush(handle, reqs, &req_count, &used);
+    }
+    if (err == NULL) {
+        LOG_I("ZEALFS", "Restored %u pages from %s", header.used_pages, path);
+    }
+
+end:
+    fclose(fp);
+    free(reqs);
+    free(buffer);
+    free(index);
+    return err;
+}
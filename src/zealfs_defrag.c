@@ -0,0 +1,330 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zealfs.h"
+#include "disk_io.h"
+#include "job.h"
+#include "log.h"
+
+/* Memory used to move the pages, half for the current content of a window, half for its new content */
+#define DEFRAG_BUFFER_SIZE  (16*MB)
+
+/* Flags of the pages, indexed by their original position.
+ * Directory page holding an entry whose first page moves */
+#define DEFRAG_CHANGED      (1 << 0)
+
+typedef struct {
+    zealfs_frag_t*  report;
+    const char*     error;
+} frag_state_t;
+
+typedef struct {
+    /* First page that can hold data, right after the FAT */
+    uint16_t        first;
+    /* Next free position in the new layout */
+    uint32_t        next;
+    /* New position of each page, 0 if the page is not referenced */
+    uint16_t*       newpos;
+    /* Original page to put at each position of the new layout */
+    uint16_t*       order;
+    uint8_t*        flags;
+    const char*     error;
+} defrag_plan_t;
+
+
+static int frag_entry_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    frag_state_t* state = (frag_state_t*) arg;
+    zealfs_frag_t* report = state->report;
+    uint32_t extents = 0;
+    uint16_t prev = 0;
+
+    report->entries++;
+    /* The chain is bounded in case of a loop, `zealfs_fsck` reports those */
+    uint16_t page = entry->start_page;
+    for (uint32_t visited = 0; page != 0 && page < fs->fat_entries && visited < fs->page_count; visited++) {
+        if (page != prev + 1) {
+            extents++;
+        }
+        prev = page;
+        page = zealfs_next_page(fs, page);
+    }
+    report->extents += extents;
+    report->fragmented += extents > 1;
+
+    if (entry->is_dir && entry->start_page != 0) {
+        const char* err = zealfs_foreach(fs, entry, frag_entry_cb, state);
+        state->error = state->error ? state->error : err;
+    }
+    return state->error != NULL;
+}
+
+
+/**
+ * @brief Measure the fragmentation of the files, directories and free space of the partition.
+ */
+const char* zealfs_fragmentation(zealfs_t* fs, zealfs_frag_t* report)
+{
+    frag_state_t state = { .report = report };
+    memset(report, 0, sizeof(zealfs_frag_t));
+
+    zealfs_entry_t root;
+    zealfs_root(fs, &root);
+    const char* err = zealfs_foreach(fs, &root, frag_entry_cb, &state);
+    err = err ? err : state.error;
+    if (err) {
+        return err;
+    }
+
+    /* Only the pages that have a FAT entry can be allocated */
+    const uint8_t* bitmap = fs->header->pages_bitmap;
+    uint32_t page = zealfsv2_bitmap_find(bitmap, fs->fat_entries, 0, 0);
+    while (page < fs->fat_entries) {
+        const uint32_t end = zealfsv2_bitmap_find(bitmap, fs->fat_entries, page, 1);
+        report->free_extents++;
+        report->largest_free = MAX(report->largest_free, end - page);
+        page = zealfsv2_bitmap_find(bitmap, fs->fat_entries, end, 0);
+    }
+    return NULL;
+}
+
+
+static int plan_entry_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    static _Thread_local char error_msg[256];
+    defrag_plan_t* plan = (defrag_plan_t*) arg;
+
+    /* Give the pages of the chain consecutive positions, in the order of the chain */
+    for (uint16_t page = entry->start_page; page != 0; page = zealfs_next_page(fs, page)) {
+        if (page < plan->first || page >= fs->fat_entries || plan->newpos[page] != 0) {
+            snprintf(error_msg, sizeof(error_msg),
+                     "%s has an invalid chain, check the partition before defragmenting it\n", entry->name);
+            plan->error = error_msg;
+            return 1;
+        }
+        plan->newpos[page] = plan->next;
+        plan->order[plan->next++] = page;
+    }
+    if (entry->start_page != 0 && plan->newpos[entry->start_page] != entry->start_page) {
+        plan->flags[entry->dir_page] |= DEFRAG_CHANGED;
+    }
+
+    /* The content of a directory follows it */
+    if (entry->is_dir && entry->start_page != 0) {
+        const char* err = zealfs_foreach(fs, entry, plan_entry_cb, plan);
+        plan->error = plan->error ? plan->error : err;
+    }
+    return plan->error != NULL;
+}
+
+
+/**
+ * @brief Update the first page of the entries of a directory page to their new position.
+ */
+static void defrag_patch_dir(uint8_t* data, uint32_t from, uint32_t to, const uint16_t* newpos)
+{
+    for (uint32_t off = from; off + sizeof(ZealFileEntry) <= to; off += sizeof(ZealFileEntry)) {
+        ZealFileEntry* raw = (ZealFileEntry*) (data + off);
+        if ((raw->flags & ZEALFS_IS_OCCUPIED) && raw->start_page != 0 && newpos[raw->start_page] != 0) {
+            raw->start_page = newpos[raw->start_page];
+        }
+    }
+}
+
+
+/**
+ * @brief Rewrite the partition so that each file and directory occupies consecutive pages, in the order of
+ * the tree, and the free space is a single run at the end.
+ *
+ * All the moves are planned first. The new layout is then written window by window, in increasing order:
+ * the pages of a window are gathered from their current position and written with a single write, while the
+ * pages that were in the window and still need to move are parked in the positions freed by the gathered ones.
+ * The memory used is bounded by DEFRAG_BUFFER_SIZE. The FAT and the bitmap are rebuilt and written last.
+ *
+ * The partition is inconsistent while the pages move, it must not be interrupted.
+ */
+const char* zealfs_defrag(zealfs_t* fs, zealfs_defrag_t* report)
+{
+    static _Thread_local char error_msg[256];
+    const uint32_t pb = fs->page_bytes;
+    const uint32_t count = fs->page_count;
+    uint16_t* loc = NULL;
+    uint16_t* at = NULL;
+    uint16_t* old_fat = NULL;
+    uint8_t* buffer = NULL;
+    disk_io_req_t* reqs = NULL;
+
+    memset(report, 0, sizeof(zealfs_defrag_t));
+    const char* err = zealfs_fragmentation(fs, &report->before);
+    if (err) {
+        return err;
+    }
+
+    defrag_plan_t plan = {
+        .first  = 1 + zealfsv2_fat_pages(fs->header),
+        .newpos = calloc(count, sizeof(uint16_t)),
+        .order  = calloc(count, sizeof(uint16_t)),
+        .flags  = calloc(count, sizeof(uint8_t)),
+    };
+    plan.next = plan.first;
+    /* Pages smaller than a sector are only used by the smallest partitions, they are moved in a single window */
+    const uint32_t window = pb < DISK_SECTOR_SIZE ? count : DEFRAG_BUFFER_SIZE / 2 / pb;
+    loc = malloc(sizeof(uint16_t) * count);
+    at = calloc(count, sizeof(uint16_t));
+    old_fat = malloc(sizeof(uint16_t) * fs->fat_entries);
+    buffer = malloc((size_t) 2 * window * pb);
+    reqs = malloc(sizeof(disk_io_req_t) * (2 * window + 1));
+    if (plan.newpos == NULL || plan.order == NULL || plan.flags == NULL || loc == NULL || at == NULL ||
+        old_fat == NULL || buffer == NULL || reqs == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the defragmentation\n");
+        err = error_msg;
+        goto end;
+    }
+
+    zealfs_entry_t root;
+    zealfs_root(fs, &root);
+    err = zealfs_foreach(fs, &root, plan_entry_cb, &plan);
+    err = err ? err : plan.error;
+    if (err) {
+        goto end;
+    }
+    /* The root entries are in memory, they are written back with the header */
+    if (plan.flags[0] & DEFRAG_CHANGED) {
+        defrag_patch_dir((uint8_t*) fs->header, zealfsv2_header_size(fs->header), pb, plan.newpos);
+    }
+
+    /* `at` gives the original page currently at a position, 0 for the free and leaked ones */
+    const uint32_t used_end = plan.next;
+    for (uint32_t page = plan.first; page < used_end; page++) {
+        const uint16_t orig = plan.order[page];
+        loc[orig] = orig;
+        at[orig] = orig;
+    }
+    job_add_total((uint64_t) (used_end - plan.first) * pb);
+
+    uint8_t* cur = buffer;
+    uint8_t* next = buffer + (size_t) window * pb;
+    for (uint32_t start = plan.first; start < used_end; ) {
+        const uint32_t end = pb < DISK_SECTOR_SIZE ? count : MIN(start + window, used_end);
+        const uint32_t n = end - start;
+
+        bool in_place = true;
+        for (uint32_t pos = start; pos < MIN(end, used_end) && in_place; pos++) {
+            in_place = at[pos] == plan.order[pos] && (plan.flags[plan.order[pos]] & DEFRAG_CHANGED) == 0;
+        }
+        if (in_place) {
+            job_add_progress((uint64_t) n * pb);
+            start = end;
+            continue;
+        }
+
+        err = disk_read(fs->handle, fs->offset + (uint64_t) start * pb, cur, (uint64_t) n * pb);
+        if (err) {
+            goto end;
+        }
+
+        /* Gather the new content of the window, the positions beyond the used pages are cleared */
+        int req_count = 0;
+        memset(next, 0, (size_t) n * pb);
+        for (uint32_t pos = start; pos < MIN(end, used_end); pos++) {
+            const uint16_t src = loc[plan.order[pos]];
+            uint8_t* dst = next + (size_t) (pos - start) * pb;
+            if (src >= start && src < end) {
+                memcpy(dst, cur + (size_t) (src - start) * pb, pb);
+            } else {
+                reqs[req_count++] = (disk_io_req_t) { .offset = fs->offset + (uint64_t) src * pb, .len = pb, .data = dst };
+            }
+        }
+        err = disk_io_read_batch(fs->handle, reqs, req_count);
+        if (err) {
+            goto end;
+        }
+
+        /* The pages gathered from outside the window leave free positions, park the displaced pages there */
+        const int vacated = req_count;
+        req_count = 0;
+        int parked = 0;
+        for (uint32_t pos = start; pos < end; pos++) {
+            const uint16_t orig = at[pos];
+            if (orig == 0 || plan.newpos[orig] < end) {
+                continue;
+            }
+            const uint16_t dest = (uint16_t) ((reqs[parked++].offset - fs->offset) / pb);
+            loc[orig] = dest;
+            at[dest] = orig;
+            report->pages_moved++;
+            reqs[vacated + req_count++] = (disk_io_req_t) {
+                .offset = fs->offset + (uint64_t) dest * pb,
+                .len    = pb,
+                .data   = cur + (size_t) (pos - start) * pb,
+            };
+        }
+        for (int i = parked; i < vacated; i++) {
+            at[(reqs[i].offset - fs->offset) / pb] = 0;
+        }
+
+        for (uint32_t pos = start; pos < MIN(end, used_end); pos++) {
+            const uint16_t orig = plan.order[pos];
+            if (plan.flags[orig] & DEFRAG_CHANGED) {
+                defrag_patch_dir(next + (size_t) (pos - start) * pb, 0, pb, plan.newpos);
+            }
+            report->pages_moved += loc[orig] != pos;
+            loc[orig] = pos;
+            at[pos] = orig;
+        }
+
+        /* One large write for the window, the parked pages are outside of it */
+        reqs[vacated + req_count++] = (disk_io_req_t) {
+            .offset = fs->offset + (uint64_t) start * pb,
+            .len    = (uint64_t) n * pb,
+            .data   = next,
+        };
+        err = disk_io_write_batch(fs->handle, reqs + vacated, req_count);
+        if (err) {
+            goto end;
+        }
+        job_add_progress((uint64_t) n * pb);
+        start = end;
+    }
+
+    /* Rebuild the FAT and the bitmap for the new layout, the header and the FAT pages don't move */
+    memcpy(old_fat, fs->fat, sizeof(uint16_t) * fs->fat_entries);
+    memset(fs->fat + plan.first, 0, sizeof(uint16_t) * (fs->fat_entries - plan.first));
+    for (uint32_t pos = plan.first; pos < used_end; pos++) {
+        const uint16_t orig_next = old_fat[plan.order[pos]];
+        fs->fat[pos] = orig_next ? plan.newpos[orig_next] : 0;
+    }
+    memset(fs->header->pages_bitmap, 0, fs->header->bitmap_size);
+    for (uint32_t page = 0; page < used_end; page++) {
+        fs->header->pages_bitmap[page / 8] |= 1 << (page % 8);
+    }
+    fs->header->free_pages = count - used_end;
+    fs->alloc_hint = used_end;
+    fs->meta_dirty = true;
+    zealfs_cache_forget(fs);
+    err = zealfs_flush(fs);
+    if (err == NULL) {
+        err = zealfs_fragmentation(fs, &report->after);
+    }
+    if (err == NULL) {
+        LOG_I("ZEALFS", "Defragmented %u entries, %u pages moved: %u to %u extents, %u to %u free extents",
+              report->after.entries, report->pages_moved, report->before.extents, report->after.extents,
+              report->before.free_extents, report->after.free_extents);
+    }
+
+end:
+    free(reqs);
+    free(buffer);
+    free(old_fat);
+    free(at);
+    free(loc);
+    free(plan.flags);
+    free(plan.order);
+    free(plan.newpos);
+    return err;
+}
@@ -0,0 +1,204 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zealfs.h"
+#include "log.h"
+
+typedef struct {
+    zealfs_fsck_t*  report;
+    bool            repair;
+    /* Pages referenced so far, one bit per page, same layout as the on-disk bitmap */
+    uint64_t*       refs;
+    const char*     error;
+} fsck_state_t;
+
+
+static bool fsck_test_and_set(uint64_t* refs, uint32_t page)
+{
+    const uint64_t mask = 1ULL << (page % 64);
+    const bool set = (refs[page / 64] & mask) != 0;
+    refs[page / 64] |= mask;
+    return set;
+}
+
+
+/**
+ * @brief Load 64 bits of the on-disk bitmap, the bits beyond the bitmap are 0.
+ */
+static uint64_t fsck_load_word(const uint8_t* bitmap, uint32_t nbytes, uint32_t word)
+{
+    uint64_t value = 0;
+    const uint32_t byte = word * 8;
+    if (byte < nbytes) {
+        memcpy(&value, bitmap + byte, MIN(nbytes - byte, 8));
+    }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+
+static void fsck_store_word(uint8_t* bitmap, uint32_t nbytes, uint32_t word, uint64_t value)
+{
+    const uint32_t byte = word * 8;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    if (byte < nbytes) {
+        memcpy(bitmap + byte, &value, MIN(nbytes - byte, 8));
+    }
+}
+
+
+static int fsck_entry_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg);
+
+
+/**
+ * @brief Follow the chain of the entry and mark its pages as referenced.
+ * A broken chain is cut after its last valid page when repairing, an entry without any valid page is removed.
+ */
+static void fsck_check_entry(zealfs_t* fs, fsck_state_t* state, const zealfs_entry_t* entry)
+{
+    zealfs_fsck_t* report = state->report;
+    const uint32_t expected = entry->is_dir ? 1 : MAX((entry->size + fs->page_bytes - 1) / fs->page_bytes, 1);
+    uint32_t pages = 0;
+    uint16_t last = 0;
+    uint16_t page = entry->start_page;
+    bool broken = false;
+
+    if (entry->is_dir) {
+        report->dirs++;
+    } else {
+        report->files++;
+    }
+
+    while (page != 0) {
+        if (page >= fs->fat_entries) {
+            LOG_W("ZEALFS", "%s: page %u is out of the partition", entry->name, page);
+            report->dangling++;
+            broken = true;
+            break;
+        }
+        if (fsck_test_and_set(state->refs, page)) {
+            LOG_W("ZEALFS", "%s: page %u is already used", entry->name, page);
+            report->cross_linked++;
+            broken = true;
+            break;
+        }
+        pages++;
+        last = page;
+        page = zealfs_next_page(fs, page);
+    }
+
+    if (!broken && pages < expected) {
+        LOG_W("ZEALFS", "%s: chain has %u pages, %u expected", entry->name, pages, expected);
+        report->dangling++;
+        broken = true;
+    }
+
+    if (broken && state->repair) {
+        report->repaired++;
+        if (pages == 0) {
+            /* Detach the chain first so that removing the entry doesn't free anything */
+            zealfs_entry_t detached = *entry;
+            detached.is_dir = false;
+            detached.start_page = 0;
+            state->error = zealfs_remove(fs, &detached);
+            return;
+        }
+        zealfs_entry_t fixed = *entry;
+        fs->fat[last] = 0;
+        fs->meta_dirty = true;
+        if (!entry->is_dir) {
+            fixed.size = MIN(entry->size, pages * fs->page_bytes);
+        }
+        state->error = zealfs_update_entry(fs, &fixed);
+    }
+
+    if (entry->is_dir && pages > 0 && state->error == NULL) {
+        const char* err = zealfs_foreach(fs, entry, fsck_entry_cb, state);
+        state->error = state->error ? state->error : err;
+    }
+}
+
+
+static int fsck_entry_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    fsck_state_t* state = (fsck_state_t*) arg;
+    fsck_check_entry(fs, state, entry);
+    return state->error != NULL;
+}
+
+
+/**
+ * @brief Check the consistency of the partition: walk all the directories and chains to rebuild the bitmap
+ * of the used pages, then compare it with the on-disk bitmap and free pages counter, 64 pages at a time.
+ *
+ * @param repair When true, the broken chains are cut, the entries without any valid page are removed and
+ *               the bitmap and counter are rebuilt. The changes are written back with `zealfs_flush`.
+ */
+const char* zealfs_fsck(zealfs_t* fs, bool repair, zealfs_fsck_t* report)
+{
+    static _Thread_local char error_msg[256];
+    const uint32_t words = (fs->page_count + 63) / 64;
+    const uint32_t nbytes = fs->header->bitmap_size;
+
+    memset(report, 0, sizeof(zealfs_fsck_t));
+    fsck_state_t state = {
+        .report = report,
+        .repair = repair,
+        .refs   = calloc(words, sizeof(uint64_t)),
+    };
+    if (state.refs == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the check\n");
+        return error_msg;
+    }
+
+    /* The header and the FAT are always used */
+    for (uint32_t page = 0; page <= zealfsv2_fat_pages(fs->header); page++) {
+        fsck_test_and_set(state.refs, page);
+    }
+
+    zealfs_entry_t root;
+    zealfs_root(fs, &root);
+    const char* err = zealfs_foreach(fs, &root, fsck_entry_cb, &state);
+    err = err ? err : state.error;
+    if (err) {
+        free(state.refs);
+        return err;
+    }
+
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < words; i++) {
+        const uint64_t disk = fsck_load_word(fs->header->pages_bitmap, nbytes, i);
+        const uint64_t diff = disk ^ state.refs[i];
+        used += __builtin_popcountll(state.refs[i]);
+        if (diff != 0) {
+            report->leaked_pages += __builtin_popcountll(diff & disk);
+            report->unmarked_pages += __builtin_popcountll(diff & state.refs[i]);
+            if (repair) {
+                fsck_store_word(fs->header->pages_bitmap, nbytes, i, state.refs[i]);
+            }
+        }
+    }
+    report->free_pages = fs->header->free_pages;
+    report->expected_free_pages = fs->page_count - used;
+
+    if (repair && (report->leaked_pages || report->unmarked_pages || report->free_pages != report->expected_free_pages)) {
+        fs->header->free_pages = report->expected_free_pages;
+        fs->meta_dirty = true;
+    }
+
+    LOG_I("ZEALFS", "Checked %u files and %u directories: %u leaked pages, %u unmarked pages, "
+                    "%u cross-linked chains, %u dangling entries, %u/%u free pages",
+          report->files, report->dirs, report->leaked_pages, report->unmarked_pages,
+          report->cross_linked, report->dangling, report->free_pages, report->expected_free_pages);
+    free(state.refs);
+    return NULL;
+}
@@ -0,0 +1,282 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zealfs.h"
+#include "disk_io.h"
+#include "job.h"
+#include "log.h"
+
+/* Size of the reads when relocating pages, the writes go through the pending pages */
+#define GROW_CHUNK_SIZE     (1*MB)
+
+typedef struct {
+    /* New position of the relocated pages, 0 for the others */
+    const uint16_t* map;
+    /* Entries whose first page is relocated */
+    zealfs_entry_t* entries;
+    uint32_t        count;
+    uint32_t        cap;
+    const char*     error;
+} grow_state_t;
+
+
+static int grow_entry_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    static _Thread_local char error_msg[256];
+    grow_state_t* state = (grow_state_t*) arg;
+
+    if (entry->start_page != 0 && entry->start_page < fs->page_count && state->map[entry->start_page] != 0) {
+        if (state->count == state->cap) {
+            const uint32_t cap = state->cap ? state->cap * 2 : 64;
+            zealfs_entry_t* entries = realloc(state->entries, sizeof(zealfs_entry_t) * cap);
+            if (entries == NULL) {
+                snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the resize\n");
+                state->error = error_msg;
+                return 1;
+            }
+            state->entries = entries;
+            state->cap = cap;
+        }
+        state->entries[state->count++] = *entry;
+    }
+    if (entry->is_dir && entry->start_page != 0) {
+        const char* err = zealfs_foreach(fs, entry, grow_entry_cb, state);
+        state->error = state->error ? state->error : err;
+    }
+    return state->error != NULL;
+}
+
+
+static uint32_t grow_header_size(uint32_t page_count)
+{
+    const uint32_t size = sizeof(ZealFSHeader) + page_count / 8;
+    return (size + sizeof(ZealFileEntry) - 1) / sizeof(ZealFileEntry) * sizeof(ZealFileEntry);
+}
+
+
+/**
+ * @brief Move the root entries out of the first page bytes that the bigger bitmap needs, to free slots.
+ */
+static const char* grow_move_root(zealfs_t* fs, uint32_t old_size, uint32_t new_size)
+{
+    static _Thread_local char error_msg[256];
+    uint8_t* page = (uint8_t*) fs->header;
+    uint32_t free_off = new_size;
+
+    for (uint32_t off = old_size; off < new_size; off += sizeof(ZealFileEntry)) {
+        if ((((const ZealFileEntry*) (page + off))->flags & ZEALFS_IS_OCCUPIED) == 0) {
+            continue;
+        }
+        while (free_off + sizeof(ZealFileEntry) <= fs->page_bytes &&
+               (((const ZealFileEntry*) (page + free_off))->flags & ZEALFS_IS_OCCUPIED)) {
+            free_off += sizeof(ZealFileEntry);
+        }
+        if (free_off + sizeof(ZealFileEntry) > fs->page_bytes) {
+            snprintf(error_msg, sizeof(error_msg), "The root directory has too many entries for the new size\n");
+            return error_msg;
+        }
+        memcpy(page + free_off, page + off, sizeof(ZealFileEntry));
+        free_off += sizeof(ZealFileEntry);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Move the used pages of `map` to their new position, the data is read by chunks and written
+ * through the pending pages.
+ */
+static const char* grow_relocate(zealfs_t* fs, const uint16_t* map, const uint16_t* moved, uint32_t count)
+{
+    static _Thread_local char error_msg[256];
+    const uint32_t chunk_pages = GROW_CHUNK_SIZE / fs->page_bytes;
+    const char* err = NULL;
+
+    uint8_t* buffer = malloc(GROW_CHUNK_SIZE);
+    disk_io_req_t* reqs = malloc(sizeof(disk_io_req_t) * chunk_pages);
+    if (buffer == NULL || reqs == NULL) {
+        free(reqs);
+        free(buffer);
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the resize\n");
+        return error_msg;
+    }
+
+    for (uint32_t i = 0; i < count && err == NULL; i += chunk_pages) {
+        const uint32_t n = MIN(chunk_pages, count - i);
+        for (uint32_t j = 0; j < n; j++) {
+            reqs[j] = (disk_io_req_t) {
+                .offset = fs->offset + (uint64_t) moved[i + j] * fs->page_bytes,
+                .len    = fs->page_bytes,
+                .data   = buffer + (size_t) j * fs->page_bytes,
+            };
+        }
+        err = disk_io_read_batch(fs->handle, reqs, n);
+        for (uint32_t j = 0; j < n && err == NULL; j++) {
+            /* `reqs` may have been sorted, but each buffer stays at the index of its page in `moved` */
+            err = zealfs_write_page(fs, map[moved[i + j]], buffer + (size_t) j * fs->page_bytes, fs->page_bytes);
+        }
+        job_add_progress((uint64_t) n * fs->page_bytes);
+    }
+
+    free(reqs);
+    free(buffer);
+    return err;
+}
+
+
+/**
+ * @brief Grow or shrink the file system to `size` bytes, keeping its page size so that the data pages don't
+ * need to be rewritten. The format derives the page size from the partition size, so only the other size
+ * sharing the same page size can be reached, for example 512KB and 1MB.
+ *
+ * When shrinking, the used pages beyond the new limit are first copied to free pages below it, and these
+ * copies are flushed before anything else is modified: the partition stays valid at its old size if the
+ * resize is interrupted until then. The final flush writes the updated directory pages, then the header,
+ * the bitmap and the FAT, an interruption during it must be repaired with a check of the partition.
+ *
+ * @param relocated Populated with the number of pages moved.
+ */
+const char* zealfs_resize_partition(zealfs_t* fs, uint64_t size, uint32_t* relocated)
+{
+    static _Thread_local char error_msg[256];
+    const uint32_t pb = fs->page_bytes;
+    const uint32_t old_count = fs->page_count;
+    uint16_t* map = NULL;
+    uint16_t* moved = NULL;
+    grow_state_t state = { 0 };
+
+    *relocated = 0;
+    if (size < 64*KB || size > 4*GB || (size & (size - 1)) != 0 || zealfsv2_page_size(size) != (int) pb) {
+        snprintf(error_msg, sizeof(error_msg), "The page size would change, a %u-byte page partition can't be resized to this size\n", pb);
+        return error_msg;
+    }
+    const uint32_t new_count = (uint32_t) (size / pb);
+    if (new_count == old_count) {
+        return NULL;
+    }
+
+    const char* err = zealfs_flush(fs);
+    if (err) {
+        return err;
+    }
+
+    const uint32_t fat_pages = zealfsv2_fat_pages(fs->header);
+    const uint32_t new_fat_entries = MIN(new_count, fat_pages * pb / 2);
+    const uint32_t first = 1 + fat_pages;
+    const uint32_t old_header = grow_header_size(old_count);
+    const uint32_t new_header = grow_header_size(new_count);
+    uint8_t* bitmap = fs->header->pages_bitmap;
+
+    /* Plan the relocation of the pages the FAT won't cover anymore, before modifying anything */
+    uint32_t count = 0;
+    if (new_fat_entries < fs->fat_entries) {
+        map = calloc(old_count, sizeof(uint16_t));
+        moved = malloc(sizeof(uint16_t) * old_count);
+        if (map == NULL || moved == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the resize\n");
+            err = error_msg;
+            goto end;
+        }
+        uint32_t dest = first;
+        uint32_t page = zealfsv2_bitmap_find(bitmap, fs->fat_entries, new_fat_entries, 1);
+        while (page < fs->fat_entries) {
+            dest = zealfsv2_bitmap_find(bitmap, new_fat_entries, dest, 0);
+            if (dest >= new_fat_entries) {
+                snprintf(error_msg, sizeof(error_msg), "Not enough free pages to shrink the partition\n");
+                err = error_msg;
+                goto end;
+            }
+            map[page] = (uint16_t) dest++;
+            moved[count++] = (uint16_t) page;
+            page = zealfsv2_bitmap_find(bitmap, fs->fat_entries, page + 1, 1);
+        }
+    }
+    if (new_header > old_header) {
+        err = grow_move_root(fs, old_header, new_header);
+        if (err) {
+            goto end;
+        }
+    }
+
+    if (count > 0) {
+        state.map = map;
+        zealfs_entry_t root;
+        zealfs_root(fs, &root);
+        err = zealfs_foreach(fs, &root, grow_entry_cb, &state);
+        err = err ? err : state.error;
+        if (err) {
+            goto end;
+        }
+        job_add_total((uint64_t) count * pb);
+        err = grow_relocate(fs, map, moved, count);
+        /* Only the copies are pending, make sure they are on the disk before the metadata refers to them */
+        err = err ? err : zealfs_flush(fs);
+        if (err) {
+            goto end;
+        }
+
+        /* Follow the relocation in the chains, then in the entries, whose directory page may have moved too */
+        for (uint32_t page = 0; page < fs->fat_entries; page++) {
+            if (fs->fat[page] != 0 && fs->fat[page] < old_count && map[fs->fat[page]] != 0) {
+                fs->fat[page] = map[fs->fat[page]];
+            }
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            const uint16_t page = moved[i];
+            fs->fat[map[page]] = fs->fat[page];
+            fs->fat[page] = 0;
+            bitmap[map[page] / 8] |= 1 << (map[page] % 8);
+            bitmap[page / 8] &= ~(1 << (page % 8));
+        }
+        for (uint32_t i = 0; i < state.count && err == NULL; i++) {
+            zealfs_entry_t* entry = &state.entries[i];
+            entry->start_page = map[entry->start_page];
+            if (entry->dir_page != 0 && map[entry->dir_page] != 0) {
+                entry->dir_page = map[entry->dir_page];
+            }
+            err = zealfs_update_entry(fs, entry);
+        }
+        if (err) {
+            goto end;
+        }
+    }
+
+    /* The first page: the bitmap grows over the first root entries, or gives some back */
+    const uint32_t old_bytes = old_count / 8;
+    const uint32_t new_bytes = new_count / 8;
+    if (new_bytes > old_bytes) {
+        memset(bitmap + old_bytes, 0, new_header - sizeof(ZealFSHeader) - old_bytes);
+    } else {
+        memset(bitmap + new_bytes, 0, old_header - sizeof(ZealFSHeader) - new_bytes);
+    }
+    fs->header->bitmap_size = (uint16_t) new_bytes;
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < new_bytes; i++) {
+        used += __builtin_popcount(bitmap[i]);
+    }
+    fs->header->free_pages = (uint16_t) (new_count - used);
+
+    fs->meta_dirty = true;
+    err = zealfs_flush(fs);
+    if (err == NULL) {
+        /* The pending pages are indexed by page, drop the index so that it's reallocated for the new count */
+        free(fs->pending_idx);
+        fs->pending_idx = NULL;
+        fs->page_count = new_count;
+        fs->fat_entries = new_fat_entries;
+        fs->alloc_hint = first;
+        *relocated = count;
+        LOG_I("ZEALFS", "Resized from %u to %u pages, %u pages relocated", old_count, new_count, count);
+    }
+
+end:
+    free(state.entries);
+    free(moved);
+    free(map);
+    return err;
+}
@@ -0,0 +1,1125 @@
+/**
+ * SPDX-FileCopyrightText: 2025 Zeal 8-bit Computer <contact@zeal8bit.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "zealfs.h"
+#include "disk_io.h"
+#include "job.h"
+#include "log.h"
+
+#ifdef _WIN32
+#define host_mkdir(path)    mkdir(path)
+#else
+#define host_mkdir(path)    mkdir(path, 0755)
+#endif
+
+/* Size of the reads and writes on the host files */
+#define HOST_CHUNK_SIZE     (1*MB)
+/* Number of chunks read ahead from the partition during an export */
+#define HOST_SLOTS          DISK_IO_SLOTS
+/* Bump when the way images are built changes, to invalidate the cached ones */
+#define HOST_IMAGE_VERSION  1
+/* Directories nested deeper than this are taken as a loop in a corrupted partition */
+#define HOST_MAX_DEPTH      32
+
+/* Chunk of a file, or directory, read from the partition and waiting to be written on the host */
+typedef struct {
+    char     path[1024];
+    bool     is_dir;
+    uint32_t offset;
+    uint32_t len;
+    uint8_t* data;
+} export_slot_t;
+
+typedef struct {
+    zealfs_t*               fs;
+    const zealfs_entry_t*   src;
+    const char*             host_dir;
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    export_slot_t           slots[HOST_SLOTS];
+    /* Number of slots filled by the reader and emptied by the writer */
+    uint64_t                produced;
+    uint64_t                consumed;
+    bool                    reader_done;
+    bool                    abort;
+    const char*             error;
+    char                    reader_error[256];
+} export_pipeline_t;
+
+typedef struct {
+    const char*     name;
+    zealfs_entry_t* result;
+    bool            found;
+} host_find_t;
+
+
+static int host_find_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    host_find_t* find = (host_find_t*) arg;
+    (void) fs;
+    if (strcmp(entry->name, find->name) == 0) {
+        *find->result = *entry;
+        find->found = true;
+        return 1;
+    }
+    return 0;
+}
+
+
+static uint8_t host_to_bcd(int value)
+{
+    return (uint8_t) (((value / 10) % 10) << 4 | (value % 10));
+}
+
+
+/**
+ * @brief Convert a host modification time to a ZealFS date, in BCD.
+ */
+static void host_date(time_t t, uint8_t date[8])
+{
+    const struct tm* tm = localtime(&t);
+    if (tm == NULL) {
+        memset(date, 0, 8);
+        return;
+    }
+    const int year = tm->tm_year + 1900;
+    date[0] = host_to_bcd(year / 100);
+    date[1] = host_to_bcd(year % 100);
+    date[2] = host_to_bcd(tm->tm_mon + 1);
+    date[3] = host_to_bcd(tm->tm_mday);
+    date[4] = host_to_bcd(tm->tm_wday);
+    date[5] = host_to_bcd(tm->tm_hour);
+    date[6] = host_to_bcd(tm->tm_min);
+    date[7] = host_to_bcd(tm->tm_sec);
+}
+
+
+/**
+ * @brief Sum the size of all the regular files in the host directory, for the job progress.
+ */
+static uint64_t host_dir_size(const char* path)
+{
+    char child[1024];
+    struct stat st;
+    uint64_t total = 0;
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (stat(child, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            total += host_dir_size(child);
+        } else if (S_ISREG(st.st_mode)) {
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+    return total;
+}
+
+
+/**
+ * @brief Copy the content of a host file to the pages of a freshly created ZealFS file.
+ */
+static const char* host_import_file(zealfs_t* fs, const char* path, const zealfs_entry_t* file, uint8_t* buffer)
+{
+    static _Thread_local char error_msg[1024];
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open %s\n", path);
+        return error_msg;
+    }
+
+    /* The chunk size is a multiple of any page size, only the very last page can be partial */
+    uint16_t page = file->start_page;
+    uint32_t remaining = file->size;
+    while (remaining > 0) {
+        const uint32_t len = MIN(remaining, HOST_CHUNK_SIZE);
+        if (fread(buffer, 1, len, fp) != len) {
+            fclose(fp);
+            snprintf(error_msg, sizeof(error_msg), "Could not read %s\n", path);
+            return error_msg;
+        }
+        for (uint32_t off = 0; off < len; off += fs->page_bytes) {
+            if (page == 0) {
+                fclose(fp);
+                snprintf(error_msg, sizeof(error_msg), "Chain of %s is too short\n", file->name);
+                return error_msg;
+            }
+            const char* err = zealfs_write_page(fs, page, buffer + off, MIN(fs->page_bytes, len - off));
+            if (err) {
+                fclose(fp);
+                return err;
+            }
+            page = zealfs_next_page(fs, page);
+        }
+        remaining -= len;
+        job_add_progress(len);
+    }
+
+    fclose(fp);
+    return NULL;
+}
+
+
+/**
+ * @brief Remove a file whose content could not be written completely. Its entry and its chain are already
+ * linked, without this the flush following the error would publish a file made of stale pages.
+ *
+ * @return The error that interrupted the write, `err`.
+ */
+static const char* host_discard_file(zealfs_t* fs, const zealfs_entry_t* file, const char* err)
+{
+    static _Thread_local char error_msg[1024];
+
+    /* The message may be in a buffer the removal reuses */
+    snprintf(error_msg, sizeof(error_msg), "%s", err);
+    const char* remove_err = zealfs_remove(fs, file);
+    if (remove_err) {
+        LOG_W("ZEALFS", "Could not remove %s: %s", file->name, remove_err);
+    } else {
+        LOG_W("ZEALFS", "Removed %s, its content could not be written", file->name);
+    }
+    return error_msg;
+}
+
+
+static int host_name_cmp(const void* a, const void* b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+
+static void host_free_list(char** names, int count)
+{
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+
+/**
+ * @brief List the names of the entries of a host directory, sorted, so that the result doesn't depend
+ * on the order of the host file system. The list must be freed with `host_free_list`.
+ */
+static const char* host_list_dir(const char* path, char*** out_names, int* out_count)
+{
+    static _Thread_local char error_msg[1024];
+    char** names = NULL;
+    int count = 0;
+    int cap = 0;
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open directory %s\n", path);
+        return error_msg;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        if (count == cap) {
+            cap = cap ? cap * 2 : 32;
+            char** grown = realloc(names, sizeof(char*) * cap);
+            if (grown == NULL) {
+                goto no_memory;
+            }
+            names = grown;
+        }
+        names[count] = strdup(ent->d_name);
+        if (names[count] == NULL) {
+            goto no_memory;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    if (count > 1) {
+        qsort(names, count, sizeof(char*), host_name_cmp);
+    }
+    *out_names = names;
+    *out_count = count;
+    return NULL;
+
+no_memory:
+    closedir(dir);
+    host_free_list(names, count);
+    snprintf(error_msg, sizeof(error_msg), "Could not allocate memory to list %s\n", path);
+    return error_msg;
+}
+
+
+static const char* host_import_dir(zealfs_t* fs, const char* path, const zealfs_entry_t* dest,
+                                   const uint8_t* fixed_date, uint8_t* buffer)
+{
+    char child[1024];
+    struct stat st;
+    char** names;
+    int count;
+
+    const char* err = host_list_dir(path, &names, &count);
+    if (err) {
+        return err;
+    }
+
+    for (int i = 0; i < count && err == NULL; i++) {
+        const char* name = names[i];
+        snprintf(child, sizeof(child), "%s/%s", path, name);
+        if (stat(child, &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+            continue;
+        }
+        if (strlen(name) > ZEALFS_NAME_MAX_LEN) {
+            LOG_W("ZEALFS", "Skipping %s, names are limited to %d characters", child, ZEALFS_NAME_MAX_LEN);
+            if (S_ISREG(st.st_mode)) {
+                job_add_progress(st.st_size);
+            }
+            continue;
+        }
+        if (S_ISREG(st.st_mode) && (uint64_t) st.st_size > UINT32_MAX) {
+            LOG_W("ZEALFS", "Skipping %s, file is too big", child);
+            job_add_progress(st.st_size);
+            continue;
+        }
+
+        /* Existing directories are merged, existing files are replaced */
+        zealfs_entry_t entry;
+        host_find_t find = { .name = name, .result = &entry };
+        err = zealfs_foreach(fs, dest, host_find_cb, &find);
+        if (err == NULL && find.found && !(entry.is_dir && S_ISDIR(st.st_mode))) {
+            err = zealfs_remove(fs, &entry);
+            find.found = false;
+        }
+        if (err) {
+            break;
+        }
+
+        if (!find.found) {
+            uint8_t date[8];
+            if (fixed_date) {
+                memcpy(date, fixed_date, sizeof(date));
+            } else {
+                host_date(st.st_mtime, date);
+            }
+            err = zealfs_create(fs, dest, name, S_ISDIR(st.st_mode), (uint32_t) st.st_size, date, &entry);
+        }
+        if (err == NULL && S_ISDIR(st.st_mode)) {
+            err = host_import_dir(fs, child, &entry, fixed_date, buffer);
+        } else if (err == NULL) {
+            err = host_import_file(fs, child, &entry, buffer);
+            if (err) {
+                err = host_discard_file(fs, &entry, err);
+            }
+        }
+    }
+
+    host_free_list(names, count);
+    return err;
+}
+
+
+/**
+ * @brief Copy the content of a host directory, recursively, into the directory `dest_path` of the partition.
+ * The entries are imported in alphabetical order and the pages are allocated in contiguous runs when possible.
+ * All the modified pages, data, directories, FAT and bitmap, are written back in LBA order by `zealfs_flush`,
+ * which must be called afterwards. Files whose name is longer than ZEALFS_NAME_MAX_LEN are skipped.
+ *
+ * @param date When not NULL, date given to all the new entries instead of their modification date.
+ */
+const char* zealfs_import(zealfs_t* fs, const char* host_dir, const char* dest_path, const uint8_t date[8])
+{
+    static _Thread_local char error_msg[1024];
+    zealfs_entry_t dest;
+
+    const char* err = zealfs_lookup(fs, dest_path, &dest);
+    if (err) {
+        return err;
+    }
+    if (!dest.is_dir) {
+        snprintf(error_msg, sizeof(error_msg), "%s is not a directory\n", dest_path);
+        return error_msg;
+    }
+
+    uint8_t* buffer = malloc(HOST_CHUNK_SIZE);
+    if (buffer == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the import\n");
+        return error_msg;
+    }
+
+    job_add_total(host_dir_size(host_dir));
+    err = host_import_dir(fs, host_dir, &dest, date, buffer);
+    free(buffer);
+    return err;
+}
+
+
+/**
+ * @brief Add the files and directories of the host directory to the workload, as the import would create
+ * them. `entries` is populated with the number of entries of the directory itself.
+ */
+static const char* host_workload_dir(zealfs_workload_t* workload, const char* path, uint32_t* entries)
+{
+    static _Thread_local char error_msg[1100];
+    char child[1024];
+    struct stat st;
+    const char* err = NULL;
+
+    *entries = 0;
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open %s\n", path);
+        return error_msg;
+    }
+    struct dirent* ent;
+    while (err == NULL && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0 ||
+            strlen(ent->d_name) > ZEALFS_NAME_MAX_LEN) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (stat(child, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            uint32_t sub_entries;
+            err = host_workload_dir(workload, child, &sub_entries);
+            err = err ? err : zealfs_workload_add_dir(workload, sub_entries);
+            (*entries)++;
+        } else if (S_ISREG(st.st_mode) && (uint64_t) st.st_size <= UINT32_MAX) {
+            err = zealfs_workload_add_files(workload, (uint32_t) st.st_size, 1);
+            (*entries)++;
+        }
+    }
+    closedir(dir);
+    return err;
+}
+
+
+/**
+ * @brief Build the workload of the page size advisor from the files of a host directory, which would be
+ * imported at the root of the partition.
+ */
+const char* zealfs_workload_from_dir(zealfs_workload_t* workload, const char* host_dir)
+{
+    return host_workload_dir(workload, host_dir, &workload->root_entries);
+}
+
+
+typedef struct {
+    const char*     host_path;
+    bool            compare;
+    zealfs_sync_t*  stats;
+    uint8_t*        buffer;
+    uint8_t*        current;
+    const char*     error;
+} sync_state_t;
+
+
+/**
+ * @brief Bring an existing ZealFS file up to date with the host file: the chain is resized if needed
+ * and only the pages whose content differ are written.
+ */
+static const char* host_sync_file(zealfs_t* fs, sync_state_t* state, const char* path, zealfs_entry_t* entry,
+                                  uint32_t size, const uint8_t date[8])
+{
+    static _Thread_local char error_msg[1024];
+    const char* err = NULL;
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open %s\n", path);
+        return error_msg;
+    }
+
+    /* The content of the pages appended by the resize is undefined, they will simply never match */
+    err = zealfs_resize(fs, entry, size);
+    memcpy(entry->date, date, sizeof(entry->date));
+    if (err == NULL) {
+        err = zealfs_update_entry(fs, entry);
+    }
+
+    uint16_t page = entry->start_page;
+    for (uint32_t offset = 0; err == NULL && offset < size; ) {
+        const uint32_t len = MIN(size - offset, HOST_CHUNK_SIZE);
+        uint32_t read = 0;
+        if (fread(state->buffer, 1, len, fp) != len) {
+            snprintf(error_msg, sizeof(error_msg), "Could not read %s\n", path);
+            err = error_msg;
+            break;
+        }
+        err = zealfs_read(fs, entry, offset, state->current, len, &read);
+        for (uint32_t off = 0; err == NULL && off < len; off += fs->page_bytes) {
+            const uint32_t page_len = MIN(fs->page_bytes, len - off);
+            if (memcmp(state->buffer + off, state->current + off, page_len) != 0) {
+                err = zealfs_write_page(fs, page, state->buffer + off, page_len);
+                state->stats->pages_written++;
+            }
+            page = zealfs_next_page(fs, page);
+        }
+        offset += len;
+        job_add_progress(len);
+    }
+
+    fclose(fp);
+    return err;
+}
+
+
+/**
+ * @brief Remove the entries of the ZealFS directory that don't exist anymore on the host.
+ */
+static int host_sync_remove_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    sync_state_t* state = (sync_state_t*) arg;
+    char child[1024];
+    struct stat st;
+
+    snprintf(child, sizeof(child), "%s/%s", state->host_path, entry->name);
+    if (stat(child, &st) == 0 && (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+        return 0;
+    }
+    state->error = zealfs_remove(fs, entry);
+    state->stats->removed++;
+    return state->error != NULL;
+}
+
+
+static const char* host_sync_dir(zealfs_t* fs, sync_state_t* state, const char* path, const zealfs_entry_t* dest)
+{
+    static _Thread_local char error_msg[1024];
+    char child[1024];
+    struct stat st;
+    const char* err = NULL;
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not open directory %s\n", path);
+        return error_msg;
+    }
+
+    struct dirent* ent;
+    while (err == NULL && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (stat(child, &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode))) {
+            continue;
+        }
+        const bool is_dir = S_ISDIR(st.st_mode);
+        if (strlen(ent->d_name) > ZEALFS_NAME_MAX_LEN || (!is_dir && (uint64_t) st.st_size > UINT32_MAX)) {
+            LOG_W("ZEALFS", "Skipping %s, name or size not supported", child);
+            job_add_progress(is_dir ? 0 : st.st_size);
+            continue;
+        }
+
+        uint8_t date[8];
+        host_date(st.st_mtime, date);
+        zealfs_entry_t entry;
+        host_find_t find = { .name = ent->d_name, .result = &entry };
+        err = zealfs_foreach(fs, dest, host_find_cb, &find);
+        if (err == NULL && find.found && entry.is_dir != is_dir) {
+            err = zealfs_remove(fs, &entry);
+            state->stats->removed++;
+            find.found = false;
+        }
+        if (err) {
+            break;
+        }
+
+        if (is_dir) {
+            if (!find.found) {
+                err = zealfs_create(fs, dest, ent->d_name, true, 0, date, &entry);
+                state->stats->created++;
+            }
+            if (err == NULL) {
+                err = host_sync_dir(fs, state, child, &entry);
+            }
+        } else if (!find.found) {
+            err = zealfs_create(fs, dest, ent->d_name, false, (uint32_t) st.st_size, date, &entry);
+            if (err == NULL) {
+                err = host_import_file(fs, child, &entry, state->buffer);
+                if (err) {
+                    err = host_discard_file(fs, &entry, err);
+                }
+            }
+            state->stats->created++;
+        } else if (!state->compare && entry.size == (uint32_t) st.st_size && memcmp(entry.date, date, sizeof(date)) == 0) {
+            state->stats->unchanged++;
+            job_add_progress(st.st_size);
+        } else {
+            const uint32_t written = state->stats->pages_written;
+            const bool changed = entry.size != (uint32_t) st.st_size || memcmp(entry.date, date, sizeof(date)) != 0;
+            err = host_sync_file(fs, state, child, &entry, (uint32_t) st.st_size, date);
+            /* Its size and date are already the new ones, the next sync would take it as up to date */
+            if (err) {
+                err = host_discard_file(fs, &entry, err);
+            }
+            if (changed || state->stats->pages_written != written) {
+                state->stats->updated++;
+            } else {
+                state->stats->unchanged++;
+            }
+        }
+    }
+    closedir(dir);
+
+    if (err == NULL) {
+        const char* host_path = state->host_path;
+        state->host_path = path;
+        err = zealfs_foreach(fs, dest, host_sync_remove_cb, state);
+        err = err ? err : state->error;
+        state->host_path = host_path;
+    }
+    return err;
+}
+
+
+/**
+ * @brief Make the directory `dest_path` of the partition identical to the host directory: new files are
+ * created, deleted ones are removed and their pages released, and the files whose size or modification date
+ * differ are updated by writing only the pages that changed.
+ * As with `zealfs_import`, the changes must be written back with `zealfs_flush`.
+ *
+ * @param compare When true, the content of the files is compared even if their size and date match.
+ */
+const char* zealfs_sync(zealfs_t* fs, const char* host_dir, const char* dest_path, bool compare, zealfs_sync_t* stats)
+{
+    static _Thread_local char error_msg[1024];
+    zealfs_entry_t dest;
+
+    memset(stats, 0, sizeof(zealfs_sync_t));
+    const char* err = zealfs_lookup(fs, dest_path, &dest);
+    if (err) {
+        return err;
+    }
+    if (!dest.is_dir) {
+        snprintf(error_msg, sizeof(error_msg), "%s is not a directory\n", dest_path);
+        return error_msg;
+    }
+
+    /* One buffer for the host file and one for the current content of the ZealFS file */
+    sync_state_t state = {
+        .compare = compare,
+        .stats   = stats,
+        .buffer  = malloc(2 * HOST_CHUNK_SIZE),
+    };
+    if (state.buffer == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the synchronization\n");
+        return error_msg;
+    }
+    state.current = state.buffer + HOST_CHUNK_SIZE;
+
+    job_add_total(host_dir_size(host_dir));
+    err = host_sync_dir(fs, &state, host_dir, &dest);
+    free(state.buffer);
+
+    LOG_I("ZEALFS", "Synchronized %s: %u unchanged, %u updated, %u created, %u removed, %u pages written",
+          host_dir, stats->unchanged, stats->updated, stats->created, stats->removed, stats->pages_written);
+    return err;
+}
+
+
+/**
+ * @brief Get the next free slot of the export pipeline, NULL if the export was aborted.
+ */
+static export_slot_t* export_slot_get(export_pipeline_t* pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->abort && pipe->produced - pipe->consumed == HOST_SLOTS) {
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+    }
+    const bool abort = pipe->abort;
+    pthread_mutex_unlock(&pipe->lock);
+    return abort ? NULL : &pipe->slots[pipe->produced % HOST_SLOTS];
+}
+
+
+static void export_slot_put(export_pipeline_t* pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipe->produced++;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+
+typedef struct {
+    export_pipeline_t*  pipe;
+    const char*         path;
+    int                 depth;
+    const char*         error;
+} export_walk_t;
+
+
+/**
+ * @brief Check that the name of an entry can't designate anything else than a file in the destination
+ * directory. The names come from the partition, a corrupted one could contain `..` or a path.
+ */
+static const char* export_check_name(const char* name)
+{
+    static _Thread_local char error_msg[256];
+
+    if (name[0] == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || strpbrk(name, "/\\:") != NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Invalid name \"%s\" in the partition, it may be corrupted\n", name);
+        return error_msg;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Queue an entry of the partition, and its content, to be written at `path` on the host.
+ *
+ * @param depth Number of directories above the entry, from the exported one.
+ */
+static const char* export_entry(export_pipeline_t* pipe, const zealfs_entry_t* entry, const char* path, int depth);
+
+
+static int export_walk_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    export_walk_t* walk = (export_walk_t*) arg;
+    char path[1024];
+    (void) fs;
+    walk->error = export_check_name(entry->name);
+    if (walk->error == NULL) {
+        snprintf(path, sizeof(path), "%s/%s", walk->path, entry->name);
+        walk->error = export_entry(walk->pipe, entry, path, walk->depth);
+    }
+    return walk->error != NULL || walk->pipe->abort;
+}
+
+
+static const char* export_entry(export_pipeline_t* pipe, const zealfs_entry_t* entry, const char* path, int depth)
+{
+    static _Thread_local char error_msg[1100];
+    uint32_t offset = 0;
+
+    do {
+        export_slot_t* slot = export_slot_get(pipe);
+        if (slot == NULL) {
+            return NULL;
+        }
+        snprintf(slot->path, sizeof(slot->path), "%s", path);
+        slot->is_dir = entry->is_dir;
+        slot->offset = offset;
+        slot->len = 0;
+        if (!entry->is_dir) {
+            const char* err = zealfs_read(pipe->fs, entry, offset, slot->data, HOST_CHUNK_SIZE, &slot->len);
+            if (err) {
+                return err;
+            }
+            offset += slot->len;
+        }
+        export_slot_put(pipe);
+        /* A directory is a single slot, whatever its size field says */
+    } while (!entry->is_dir && offset < entry->size);
+
+    if (entry->is_dir) {
+        if (depth >= HOST_MAX_DEPTH) {
+            snprintf(error_msg, sizeof(error_msg), "Directories nested too deep at %s, the partition may be corrupted\n",
+                     path);
+            return error_msg;
+        }
+        export_walk_t walk = { .pipe = pipe, .path = path, .depth = depth + 1 };
+        const char* err = zealfs_foreach(pipe->fs, entry, export_walk_cb, &walk);
+        return err ? err : walk.error;
+    }
+    return NULL;
+}
+
+
+typedef struct {
+    uint64_t total;
+    int      depth;
+} export_size_t;
+
+
+static int export_size_cb(zealfs_t* fs, const zealfs_entry_t* entry, void* arg)
+{
+    export_size_t* size = (export_size_t*) arg;
+    if (!entry->is_dir) {
+        size->total += entry->size;
+    }
+    /* The walk reports the directories nested too deep, only the progress is computed here */
+    if (entry->is_dir && size->depth < HOST_MAX_DEPTH) {
+        size->depth++;
+        zealfs_foreach(fs, entry, export_size_cb, arg);
+        size->depth--;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Reader side of the export: walk the tree and read the files ahead of the writer.
+ */
+static void* export_reader(void* arg)
+{
+    export_pipeline_t* pipe = (export_pipeline_t*) arg;
+    const zealfs_entry_t* src = pipe->src;
+    const char* err = NULL;
+
+    if (src->is_dir) {
+        /* The content of the directory goes directly in the host directory */
+        export_walk_t walk = { .pipe = pipe, .path = pipe->host_dir };
+        err = zealfs_foreach(pipe->fs, src, export_walk_cb, &walk);
+        err = err ? err : walk.error;
+    } else {
+        char path[1024];
+        err = export_check_name(src->name);
+        if (err == NULL) {
+            snprintf(path, sizeof(path), "%s/%s", pipe->host_dir, src->name);
+            err = export_entry(pipe, src, path, 0);
+        }
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    if (err && pipe->error == NULL) {
+        snprintf(pipe->reader_error, sizeof(pipe->reader_error), "%s", err);
+        pipe->error = pipe->reader_error;
+    }
+    pipe->reader_done = true;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+
+/**
+ * @brief Write a slot of the export pipeline to the host.
+ *
+ * @param file Currently opened host file, replaced when the slot starts a new file.
+ * @param file_path Path of `file`, kept to report an error when closing it.
+ */
+static const char* export_write_slot(const export_slot_t* slot, FILE** file, char* file_path, char* file_buffer)
+{
+    static _Thread_local char error_msg[1100];
+
+    if (slot->is_dir) {
+        struct stat st;
+        if (host_mkdir(slot->path) != 0 && (stat(slot->path, &st) != 0 || !S_ISDIR(st.st_mode))) {
+            snprintf(error_msg, sizeof(error_msg), "Could not create directory %s\n", slot->path);
+            return error_msg;
+        }
+        return NULL;
+    }
+
+    if (slot->offset == 0) {
+        /* The small files are only written to the disk when closed, a full disk is reported there */
+        if (*file) {
+            const int closed = fclose(*file);
+            *file = NULL;
+            if (closed != 0) {
+                snprintf(error_msg, sizeof(error_msg), "Could not write %s\n", file_path);
+                return error_msg;
+            }
+        }
+        *file = fopen(slot->path, "wb");
+        if (*file == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not create %s\n", slot->path);
+            return error_msg;
+        }
+        snprintf(file_path, sizeof(slot->path), "%s", slot->path);
+        /* Small files are accumulated and written at once, big ones are written chunk by chunk */
+        setvbuf(*file, file_buffer, _IOFBF, HOST_CHUNK_SIZE);
+    }
+    if (fwrite(slot->data, 1, slot->len, *file) != slot->len) {
+        snprintf(error_msg, sizeof(error_msg), "Could not write %s\n", slot->path);
+        return error_msg;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Copy the file or directory at `src_path` in the partition to the host directory `host_dir`,
+ * which must exist. A directory is copied recursively, its content goes directly in `host_dir`.
+ * Reading and writing are overlapped: a reader thread walks the tree and reads up to HOST_SLOTS chunks
+ * ahead of the calling thread, which writes them on the host.
+ */
+const char* zealfs_export(zealfs_t* fs, const char* src_path, const char* host_dir)
+{
+    static _Thread_local char error_msg[1100];
+    zealfs_entry_t src;
+    FILE* file = NULL;
+    char file_path[1024] = "";
+
+    const char* err = zealfs_lookup(fs, src_path, &src);
+    if (err) {
+        return err;
+    }
+
+    export_size_t size = { .total = src.is_dir ? 0 : src.size };
+    if (src.is_dir) {
+        zealfs_foreach(fs, &src, export_size_cb, &size);
+    }
+    job_add_total(size.total);
+
+    /* One buffer per slot, plus the host file buffer */
+    uint8_t* buffers = malloc((size_t) (HOST_SLOTS + 1) * HOST_CHUNK_SIZE);
+    if (buffers == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the export\n");
+        return error_msg;
+    }
+    char* file_buffer = (char*) buffers + (size_t) HOST_SLOTS * HOST_CHUNK_SIZE;
+
+    export_pipeline_t pipe = {
+        .fs       = fs,
+        .src      = &src,
+        .host_dir = host_dir,
+    };
+    for (int i = 0; i < HOST_SLOTS; i++) {
+        pipe.slots[i].data = buffers + (size_t) i * HOST_CHUNK_SIZE;
+    }
+    pthread_mutex_init(&pipe.lock, NULL);
+    pthread_cond_init(&pipe.cond, NULL);
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, export_reader, &pipe) != 0) {
+        snprintf(error_msg, sizeof(error_msg), "Could not create the reader thread\n");
+        pipe.error = error_msg;
+        goto cleanup;
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pipe.lock);
+        while (pipe.produced == pipe.consumed && !pipe.reader_done) {
+            pthread_cond_wait(&pipe.cond, &pipe.lock);
+        }
+        const bool empty = pipe.produced == pipe.consumed;
+        pthread_mutex_unlock(&pipe.lock);
+        if (empty) {
+            break;
+        }
+
+        const export_slot_t* slot = &pipe.slots[pipe.consumed % HOST_SLOTS];
+        err = export_write_slot(slot, &file, file_path, file_buffer);
+        job_add_progress(slot->len);
+
+        pthread_mutex_lock(&pipe.lock);
+        pipe.consumed++;
+        if (err) {
+            pipe.error = err;
+            pipe.abort = true;
+        }
+        pthread_cond_broadcast(&pipe.cond);
+        pthread_mutex_unlock(&pipe.lock);
+        if (err) {
+            break;
+        }
+    }
+
+    pthread_join(reader, NULL);
+cleanup:
+    if (file && fclose(file) != 0 && pipe.error == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not write %s\n", file_path);
+        pipe.error = error_msg;
+    }
+    pthread_cond_destroy(&pipe.cond);
+    pthread_mutex_destroy(&pipe.lock);
+    free(buffers);
+    if (pipe.error && pipe.error != error_msg) {
+        snprintf(error_msg, sizeof(error_msg), "%s", pipe.error);
+        return error_msg;
+    }
+    return pipe.error;
+}
+
+
+/**
+ * @brief Hash the names, types, sizes and contents of the host tree, in the order used by the import.
+ */
+static const char* host_tree_hash(const char* path, uint64_t* hash, uint8_t* buffer)
+{
+    static _Thread_local char error_msg[1100];
+    char child[1024];
+    struct stat st;
+    char** names;
+    int count;
+
+    const char* err = host_list_dir(path, &names, &count);
+    if (err) {
+        return err;
+    }
+
+    for (int i = 0; i < count && err == NULL; i++) {
+        snprintf(child, sizeof(child), "%s/%s", path, names[i]);
+        if (stat(child, &st) != 0 || !(S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) ||
+            strlen(names[i]) > ZEALFS_NAME_MAX_LEN || (uint64_t) st.st_size > UINT32_MAX) {
+            continue;
+        }
+        const uint8_t type = S_ISDIR(st.st_mode) ? 'D' : 'F';
+        *hash = disk_io_hash_update(*hash, &type, 1);
+        *hash = disk_io_hash_update(*hash, names[i], strlen(names[i]) + 1);
+        if (S_ISDIR(st.st_mode)) {
+            err = host_tree_hash(child, hash, buffer);
+            /* Mark the end of the directory, else moving a file one level up wouldn't change the hash */
+            *hash = disk_io_hash_update(*hash, "", 1);
+            continue;
+        }
+
+        const uint32_t size = (uint32_t) st.st_size;
+        *hash = disk_io_hash_update(*hash, &size, sizeof(size));
+        FILE* fp = fopen(child, "rb");
+        if (fp == NULL) {
+            snprintf(error_msg, sizeof(error_msg), "Could not open %s\n", child);
+            err = error_msg;
+            break;
+        }
+        size_t len;
+        while ((len = fread(buffer, 1, HOST_CHUNK_SIZE, fp)) > 0) {
+            *hash = disk_io_hash_update(*hash, buffer, len);
+            job_add_progress(len);
+        }
+        fclose(fp);
+    }
+
+    host_free_list(names, count);
+    return err;
+}
+
+
+/**
+ * @brief Create an empty, formatted, partition image of `size` bytes.
+ */
+static const char* host_image_format(const char* path, uint64_t size)
+{
+    static _Thread_local char error_msg[1024];
+    const uint32_t page_bytes = zealfsv2_page_size(size);
+    const uint32_t meta_bytes = page_bytes * (page_bytes == 256 ? 2 : 3);
+
+    uint8_t* meta = calloc(1, meta_bytes);
+    if (meta == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the image\n");
+        return error_msg;
+    }
+    zealfsv2_format(meta, size);
+
+    FILE* fp = fopen(path, "wb");
+    bool success = fp != NULL && fwrite(meta, 1, meta_bytes, fp) == meta_bytes;
+    /* Set the size of the image by writing its last byte, the rest is left to the file system */
+#ifdef _WIN32
+    success = success && _fseeki64(fp, (long long) size - 1, SEEK_SET) == 0;
+#else
+    success = success && fseeko(fp, (off_t) size - 1, SEEK_SET) == 0;
+#endif
+    success = success && fputc(0, fp) != EOF;
+    if (fp) {
+        success = (fclose(fp) == 0) && success;
+    }
+    free(meta);
+
+    if (!success) {
+        snprintf(error_msg, sizeof(error_msg), "Could not create the image %s\n", path);
+        return error_msg;
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Build a partition image of `size` bytes from a host directory. The build is reproducible: the entries
+ * are imported in alphabetical order with a fixed date, so the same tree always gives the same image.
+ * Images are cached in `cache_dir`, named after the hash of the tree and of the size, an image already built
+ * for the same input is reused as is.
+ *
+ * @param image_path Populated with the path of the image, which can be described with `disk_image_info`.
+ * @param cached Set to true when the image was found in the cache.
+ */
+const char* zealfs_build_image(const char* host_dir, uint64_t size, const char* cache_dir,
+                               char* image_path, size_t path_len, bool* cached)
+{
+    /* 2025-01-01, Wednesday, 00:00:00 */
+    static const uint8_t image_date[8] = { 0x20, 0x25, 0x01, 0x01, 0x03, 0x00, 0x00, 0x00 };
+    static _Thread_local char error_msg[1024];
+    char tmp_path[1100];
+    struct stat st;
+
+    *cached = false;
+    uint8_t* buffer = malloc(HOST_CHUNK_SIZE);
+    if (buffer == NULL) {
+        snprintf(error_msg, sizeof(error_msg), "Could not allocate memory for the image\n");
+        return error_msg;
+    }
+
+    /* The page size only depends on the partition size, hashing the size is enough */
+    const uint32_t version = HOST_IMAGE_VERSION;
+    uint64_t hash = disk_io_hash_update(DISK_IO_HASH_INIT, &version, sizeof(version));
+    hash = disk_io_hash_update(hash, &size, sizeof(size));
+    job_add_total(host_dir_size(host_dir));
+    const char* err = host_tree_hash(host_dir, &hash, buffer);
+    free(buffer);
+    if (err) {
+        return err;
+    }
+
+    host_mkdir(cache_dir);
+    snprintf(image_path, path_len, "%s/zealfs-%016llx.img", cache_dir, (unsigned long long) hash);
+    if (stat(image_path, &st) == 0 && (uint64_t) st.st_size == size) {
+        LOG_I("ZEALFS", "Reusing cached image %s", image_path);
+        *cached = true;
+        return NULL;
+    }
+
+    /* Build the image under a temporary name, so that an interrupted build is never taken from the cache */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", image_path);
+    err = host_image_format(tmp_path, size);
+    if (err) {
+        return err;
+    }
+
+    disk_info_t image;
+    disk_handle_t* handle;
+    zealfs_t fs;
+    disk_image_info(&image, tmp_path, size);
+    err = disk_open(&image, true, &handle);
+    if (err) {
+        remove(tmp_path);
+        return err;
+    }
+    err = zealfs_mount(&fs, handle, &image, 0, NULL);
+    if (err == NULL) {
+        err = zealfs_import(&fs, host_dir, "/", image_date);
+    }
+    if (err == NULL) {
+        err = zealfs_flush(&fs);
+    }
+    zealfs_unmount(&fs);
+    disk_close(handle);
+
+    if (err == NULL) {
+        remove(image_path);
+        if (rename(tmp_path, image_path) != 0) {
+            snprintf(error_msg, sizeof(error_msg), "Could not rename the image to %s\n", image_path);
+            err = error_msg;
+        }
+    }
+    if (err) {
+        remove(tmp_path);
+        return err;
+    }
+    LOG_I("ZEALFS", "Built image %s", image_path);
+    return NULL;
+}